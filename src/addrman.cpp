@@ -85,6 +85,7 @@ CAddrInfo* CAddrMan::Create(const CAddress& addr, const CNetAddr& addrSource, in
     mapAddr[addr] = nId;
     mapInfo[nId].nRandomPos = vRandom.size();
     vRandom.push_back(nId);
+    nRandomSize = vRandom.size();
     if (pnId)
         *pnId = nId;
     return &mapInfo[nId];
@@ -119,6 +120,7 @@ void CAddrMan::Delete(int nId)
 
     SwapRandom(info.nRandomPos, vRandom.size() - 1);
     vRandom.pop_back();
+    nRandomSize = vRandom.size();
     mapAddr.erase(info);
     mapInfo.erase(nId);
     nNew--;
@@ -133,12 +135,29 @@ void CAddrMan::ClearNew(int nUBucket, int nUBucketPos)
         assert(infoDelete.nRefCount > 0);
         infoDelete.nRefCount--;
         vvNew[nUBucket][nUBucketPos] = -1;
+        vNewBucketSize[nUBucket]--;
+        nNewPositions--;
         if (infoDelete.nRefCount == 0) {
             Delete(nIdDelete);
         }
     }
 }
 
+void CAddrMan::SetNew(int nUBucket, int nUBucketPos, int nId)
+{
+    assert(vvNew[nUBucket][nUBucketPos] == -1);
+    vvNew[nUBucket][nUBucketPos] = nId;
+    vNewBucketSize[nUBucket]++;
+    nNewPositions++;
+}
+
+void CAddrMan::SetTried(int nKBucket, int nKBucketPos, int nId)
+{
+    assert(vvTried[nKBucket][nKBucketPos] == -1);
+    vvTried[nKBucket][nKBucketPos] = nId;
+    vTriedBucketSize[nKBucket]++;
+}
+
 void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 {
     // remove the entry from all new buckets
@@ -146,6 +165,8 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
         int pos = info.GetBucketPosition(nKey, true, bucket);
         if (vvNew[bucket][pos] == nId) {
             vvNew[bucket][pos] = -1;
+            vNewBucketSize[bucket]--;
+            nNewPositions--;
             info.nRefCount--;
         }
     }
@@ -167,6 +188,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
         // Remove the to-be-evicted item from the tried set.
         infoOld.fInTried = false;
         vvTried[nKBucket][nKBucketPos] = -1;
+        vTriedBucketSize[nKBucket]--;
         nTried--;
 
         // find which new bucket it belongs to
@@ -177,12 +199,11 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId)
 
         // Enter it into the new set again.
         infoOld.nRefCount = 1;
-        vvNew[nUBucket][nUBucketPos] = nIdEvict;
+        SetNew(nUBucket, nUBucketPos, nIdEvict);
         nNew++;
     }
-    assert(vvTried[nKBucket][nKBucketPos] == -1);
 
-    vvTried[nKBucket][nKBucketPos] = nId;
+    SetTried(nKBucket, nKBucketPos, nId);
     nTried++;
     info.fInTried = true;
 }
@@ -302,7 +323,7 @@ bool CAddrMan::Add_(const CAddress& addr, const CNetAddr& source, int64_t nTimeP
         if (fInsert) {
             ClearNew(nUBucket, nUBucketPos);
             pinfo->nRefCount++;
-            vvNew[nUBucket][nUBucketPos] = nId;
+            SetNew(nUBucket, nUBucketPos, nId);
         } else {
             if (pinfo->nRefCount == 0) {
                 Delete(nId);
@@ -348,12 +369,8 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
         // use a tried node
         double fChanceFactor = 1.0;
         while (1) {
-            int nKBucket = RandomInt(ADDRMAN_TRIED_BUCKET_COUNT);
-            int nKBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvTried[nKBucket][nKBucketPos] == -1) {
-                nKBucket = (nKBucket + insecure_rand.rand32()) % ADDRMAN_TRIED_BUCKET_COUNT;
-                nKBucketPos = (nKBucketPos + insecure_rand.rand32()) % ADDRMAN_BUCKET_SIZE;
-            }
+            int nKBucket, nKBucketPos;
+            SelectPosition(vvTried, vTriedBucketSize, nTried, nKBucket, nKBucketPos);
             int nId = vvTried[nKBucket][nKBucketPos];
             assert(mapInfo.count(nId) == 1);
             CAddrInfo& info = mapInfo[nId];
@@ -365,12 +382,8 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
         // use a new node
         double fChanceFactor = 1.0;
         while (1) {
-            int nUBucket = RandomInt(ADDRMAN_NEW_BUCKET_COUNT);
-            int nUBucketPos = RandomInt(ADDRMAN_BUCKET_SIZE);
-            while (vvNew[nUBucket][nUBucketPos] == -1) {
-                nUBucket = (nUBucket + insecure_rand.rand32()) % ADDRMAN_NEW_BUCKET_COUNT;
-                nUBucketPos = (nUBucketPos + insecure_rand.rand32()) % ADDRMAN_BUCKET_SIZE;
-            }
+            int nUBucket, nUBucketPos;
+            SelectPosition(vvNew, vNewBucketSize, nNewPositions, nUBucket, nUBucketPos);
             int nId = vvNew[nUBucket][nUBucketPos];
             assert(mapInfo.count(nId) == 1);
             CAddrInfo& info = mapInfo[nId];
@@ -381,6 +394,21 @@ CAddrInfo CAddrMan::Select_(bool newOnly)
     }
 }
 
+void CAddrMan::SelectPosition(const int (*vvTable)[ADDRMAN_BUCKET_SIZE], const int *vBucketSize, int nPositions, int &nBucket, int &nBucketPos)
+{
+    assert(nPositions > 0);
+    int nIndex = RandomInt(nPositions);
+    nBucket = 0;
+    while (nIndex >= vBucketSize[nBucket]) {
+        nIndex -= vBucketSize[nBucket];
+        nBucket++;
+    }
+    nBucketPos = 0;
+    while (vvTable[nBucket][nBucketPos] == -1 || nIndex-- > 0) {
+        nBucketPos++;
+    }
+}
+
 #ifdef DEBUG_ADDRMAN
 int CAddrMan::Check_()
 {
@@ -421,6 +449,26 @@ int CAddrMan::Check_()
     if (mapNew.size() != nNew)
         return -10;
 
+    int nNewPositionsCheck = 0;
+    for (int n = 0; n < ADDRMAN_NEW_BUCKET_COUNT; n++) {
+        int nSize = 0;
+        for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++)
+            nSize += vvNew[n][i] != -1;
+        if (nSize != vNewBucketSize[n])
+            return -20;
+        nNewPositionsCheck += nSize;
+    }
+    if (nNewPositionsCheck != nNewPositions)
+        return -21;
+
+    for (int n = 0; n < ADDRMAN_TRIED_BUCKET_COUNT; n++) {
+        int nSize = 0;
+        for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++)
+            nSize += vvTried[n][i] != -1;
+        if (nSize != vTriedBucketSize[n])
+            return -22;
+    }
+
     for (int n = 0; n < ADDRMAN_TRIED_BUCKET_COUNT; n++) {
         for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
              if (vvTried[n][i] != -1) {
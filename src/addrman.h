@@ -13,6 +13,7 @@
 #include "timedata.h"
 #include "util.h"
 
+#include <atomic>
 #include <map>
 #include <set>
 #include <stdint.h>
@@ -192,18 +193,28 @@ private:
     //! randomly-ordered vector of all nIds
     std::vector<int> vRandom;
 
+    //! size of vRandom, readable without holding cs
+    std::atomic<size_t> nRandomSize;
+
     // number of "tried" entries
     int nTried;
 
     //! list of "tried" buckets
     int vvTried[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! number of occupied positions in each "tried" bucket (nTried in total)
+    int vTriedBucketSize[ADDRMAN_TRIED_BUCKET_COUNT];
+
     //! number of (unique) "new" entries
     int nNew;
 
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! number of occupied positions in each "new" bucket, and in all of them
+    int vNewBucketSize[ADDRMAN_NEW_BUCKET_COUNT];
+    int nNewPositions;
+
     //! last time Good was called (memory only)
     int64_t nLastGood;
 
@@ -233,6 +244,14 @@ protected:
     //! Clear a position in a "new" table. This is the only place where entries are actually deleted.
     void ClearNew(int nUBucket, int nUBucketPos);
 
+    //! Store an entry at an empty position in the "new" or "tried" table.
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+
+    //! Pick a uniformly random occupied position in a table, given the number of occupied positions in
+    //! each of its buckets and in total, without probing any of the empty ones.
+    void SelectPosition(const int (*vvTable)[ADDRMAN_BUCKET_SIZE], const int *vBucketSize, int nPositions, int &nBucket, int &nBucketPos);
+
     //! Mark an entry "good", possibly moving it from "new" to "tried".
     void Good_(const CService &addr, int64_t nTime);
 
@@ -378,13 +397,14 @@ public:
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
+            nRandomSize = vRandom.size();
             if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
                 // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
                 // immediately try to give them a reference based on their primary source address.
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    SetNew(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
@@ -402,9 +422,10 @@ public:
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
                 vRandom.push_back(nIdCount);
+                nRandomSize = vRandom.size();
                 mapInfo[nIdCount] = info;
                 mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
+                SetTried(nKBucket, nKBucketPos, nIdCount);
                 nIdCount++;
             } else {
                 nLost++;
@@ -424,7 +445,7 @@ public:
                     int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
                     if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        SetNew(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -451,17 +472,21 @@ public:
     void Clear()
     {
         std::vector<int>().swap(vRandom);
+        nRandomSize = 0;
         nKey = GetRandHash();
         for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
                 vvNew[bucket][entry] = -1;
             }
+            vNewBucketSize[bucket] = 0;
         }
         for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
                 vvTried[bucket][entry] = -1;
             }
+            vTriedBucketSize[bucket] = 0;
         }
+        nNewPositions = 0;
 
         nIdCount = 0;
         nTried = 0;
@@ -482,8 +507,7 @@ public:
     //! Return the number of (unique) addresses in all tables.
     size_t size() const
     {
-        LOCK(cs); // TODO: Cache this in an atomic to avoid this overhead
-        return vRandom.size();
+        return nRandomSize;
     }
 
     //! Consistency check
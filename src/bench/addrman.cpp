@@ -0,0 +1,107 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "addrman.h"
+#include "random.h"
+#include "timedata.h"
+#include "util.h"
+
+#include <vector>
+
+/* A "source" is a source address from which we have received a bunch of other addresses. */
+
+static const size_t NUM_SOURCES = 64;
+static const size_t NUM_ADDRESSES_PER_SOURCE = 256;
+
+static std::vector<CAddress> g_sources;
+static std::vector<std::vector<CAddress>> g_addresses;
+
+static CAddress RandomRoutableAddress(FastRandomContext& rand)
+{
+    struct in_addr addr;
+    // Stay inside 1.0.0.0/8 - 126.0.0.0/8 to always be routable
+    addr.s_addr = htonl(((1 + rand.rand32() % 126) << 24) | (rand.rand32() & 0xffffff));
+    CAddress ret(CService(CNetAddr(addr), 8333), NODE_NETWORK);
+    ret.nTime = GetAdjustedTime();
+    return ret;
+}
+
+static void CreateAddresses()
+{
+    if (g_sources.size() > 0) { // already created
+        return;
+    }
+
+    FastRandomContext rand(true);
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
+        g_sources.push_back(RandomRoutableAddress(rand));
+        g_addresses.emplace_back();
+        for (size_t addr_i = 0; addr_i < NUM_ADDRESSES_PER_SOURCE; ++addr_i) {
+            g_addresses[source_i].push_back(RandomRoutableAddress(rand));
+        }
+    }
+}
+
+static void AddAddressesToAddrMan(CAddrMan& addrman)
+{
+    for (size_t source_i = 0; source_i < NUM_SOURCES; ++source_i) {
+        addrman.Add(g_addresses[source_i], g_sources[source_i]);
+    }
+}
+
+static void AddrManAdd(benchmark::State& state)
+{
+    CreateAddresses();
+
+    while (state.KeepRunning()) {
+        CAddrMan addrman;
+        AddAddressesToAddrMan(addrman);
+    }
+}
+
+// Selection from an almost empty table, where probing for an occupied
+// position would mostly find empty ones.
+static void AddrManSelectSparse(benchmark::State& state)
+{
+    CreateAddresses();
+    CAddrMan addrman;
+    addrman.Add(g_addresses[0][0], g_sources[0]);
+    addrman.Add(g_addresses[0][1], g_sources[0]);
+
+    while (state.KeepRunning()) {
+        CAddrInfo addr = addrman.Select();
+        assert(addr.GetPort() == 8333);
+    }
+}
+
+static void AddrManSelect(benchmark::State& state)
+{
+    CreateAddresses();
+    CAddrMan addrman;
+    AddAddressesToAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        CAddrInfo addr = addrman.Select();
+        assert(addr.GetPort() == 8333);
+    }
+}
+
+static void AddrManGetAddr(benchmark::State& state)
+{
+    CreateAddresses();
+    CAddrMan addrman;
+    AddAddressesToAddrMan(addrman);
+
+    while (state.KeepRunning()) {
+        std::vector<CAddress> addresses = addrman.GetAddr();
+        assert(addresses.size() > 0);
+    }
+}
+
+BENCHMARK(AddrManAdd);
+BENCHMARK(AddrManSelectSparse);
+BENCHMARK(AddrManSelect);
+BENCHMARK(AddrManGetAddr);
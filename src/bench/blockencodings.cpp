@@ -0,0 +1,59 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "blockencodings.h"
+#include "policy/policy.h"
+#include "primitives/block.h"
+#include "txmempool.h"
+
+#include <vector>
+
+static void AddTx(const CTransactionRef& tx, CTxMemPool& pool)
+{
+    LockPoints lp;
+    pool.addUnchecked(tx->GetHash(), CTxMemPoolEntry(tx, 1000, 0, 10.0, 1, tx->GetValueOut(), false, 4, lp));
+}
+
+// Reconstruct a block of 2000 transactions from a cmpctblock, with all of
+// them (plus 48000 others) in the mempool.
+static void CmpctBlockReconstructFullMempool(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    CBlock block;
+    block.nVersion = 4;
+    block.nBits = 0x207fffff;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_1 << OP_1;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].nValue = 50 * COIN;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    for (uint32_t i = 0; i < 50000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(coinbase.GetHash(), i);
+        tx.vin[0].scriptSig = CScript() << OP_1;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = COIN;
+        CTransactionRef txref = MakeTransactionRef(tx);
+        AddTx(txref, pool);
+        if (i % 25 == 0)
+            block.vtx.push_back(txref);
+    }
+
+    CBlockHeaderAndShortTxIDs cmpctblock(block, true);
+    std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+
+    while (state.KeepRunning()) {
+        PartiallyDownloadedBlock partialBlock(&pool);
+        partialBlock.InitData(cmpctblock, extra_txn);
+    }
+}
+
+BENCHMARK(CmpctBlockReconstructFullMempool);
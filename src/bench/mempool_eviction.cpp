@@ -112,4 +112,71 @@ static void MempoolEviction(benchmark::State& state)
     }
 }
 
+/** A chain of transactions where transaction i spends output j of transaction
+ *  i-1-j, so that each has nLinks in-mempool parents and children */
+static std::vector<CTransactionRef> CreateChain(size_t nTx, size_t nLinks)
+{
+    std::vector<CTransactionRef> vtx;
+    for (size_t i = 0; i < nTx; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(nLinks);
+        tx.vout.resize(nLinks);
+        for (size_t j = 0; j < nLinks; j++) {
+            if (i > j)
+                tx.vin[j].prevout = COutPoint(vtx[i - 1 - j]->GetHash(), j);
+            else
+                tx.vin[j].prevout = COutPoint(uint256S("0x1"), i * nLinks + j);
+            tx.vout[j].scriptPubKey = CScript() << OP_TRUE;
+            tx.vout[j].nValue = COIN;
+        }
+        vtx.push_back(MakeTransactionRef(tx));
+    }
+    return vtx;
+}
+
+// Add a chain and remove it again through its first transaction, walking the
+// links of every entry
+static void MempoolLinks(benchmark::State& state, size_t nLinks)
+{
+    std::vector<CTransactionRef> vtx = CreateChain(100, nLinks);
+    CTxMemPool pool(CFeeRate(1000));
+
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : vtx)
+            AddTx(*tx, 1000LL, pool);
+        pool.removeRecursive(*vtx[0]);
+    }
+}
+
+// Two parents and children per entry fit in the links' inline storage
+static void MempoolLinksInline(benchmark::State& state)
+{
+    MempoolLinks(state, 2);
+}
+
+// Eight do not
+static void MempoolLinksSpilled(benchmark::State& state)
+{
+    MempoolLinks(state, 8);
+}
+
+// Confirm the first half of a chain in a block, which unlinks the second half
+// from it, then remove the rest
+static void MempoolRemoveForBlock(benchmark::State& state)
+{
+    std::vector<CTransactionRef> vtx = CreateChain(100, 2);
+    std::vector<CTransactionRef> vtxBlock(vtx.begin(), vtx.begin() + vtx.size() / 2);
+    CTxMemPool pool(CFeeRate(1000));
+
+    while (state.KeepRunning()) {
+        for (const CTransactionRef& tx : vtx)
+            AddTx(*tx, 1000LL, pool);
+        pool.removeForBlock(vtxBlock, 1);
+        pool.removeRecursive(*vtx[vtxBlock.size()]);
+    }
+}
+
 BENCHMARK(MempoolEviction);
+BENCHMARK(MempoolLinksInline);
+BENCHMARK(MempoolLinksSpilled);
+BENCHMARK(MempoolRemoveForBlock);
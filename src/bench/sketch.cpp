@@ -0,0 +1,43 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "random.h"
+#include "sketch.h"
+
+#include <vector>
+
+// Sketch a reconciliation set of 1000 transactions at the largest capacity we accept.
+static void SketchAdd(benchmark::State& state)
+{
+    FastRandomContext rand(true);
+    std::vector<uint32_t> vElements;
+    for (int i = 0; i < 1000; i++)
+        vElements.push_back(rand.rand32() | 1);
+
+    while (state.KeepRunning()) {
+        CSketch sketch(128);
+        for (uint32_t n : vElements)
+            sketch.Add(n);
+    }
+}
+
+// Decode a difference of 32 transactions.
+static void SketchDecode(benchmark::State& state)
+{
+    FastRandomContext rand(true);
+    CSketch sketch(32);
+    for (int i = 0; i < 32; i++)
+        sketch.Add(rand.rand32() | 1);
+
+    while (state.KeepRunning()) {
+        std::vector<uint32_t> vElements;
+        bool fDecoded = sketch.Decode(vElements);
+        assert(fDecoded && vElements.size() == 32);
+    }
+}
+
+BENCHMARK(SketchAdd);
+BENCHMARK(SketchDecode);
@@ -17,6 +17,9 @@
 
 #define MIN_TRANSACTION_BASE_SIZE (::GetSerializeSize(CTransaction(), SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS))
 
+/** Bits per short ID in the filter InitData checks before looking up a candidate transaction */
+static const size_t SHORTTXIDS_FILTER_BITS = 16;
+
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
         shorttxids(block.vtx.size() - 1), prefilledtxn(1), header(block) {
@@ -105,12 +108,25 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     if (shorttxids.size() != cmpctblock.shorttxids.size())
         return READ_STATUS_FAILED; // Short ID collision
 
+    // Short IDs are uniformly distributed, so a bitmap indexed by their low bits rules out
+    // almost all mempool and extra txn that are not in the block, without the map lookup
+    // (and likely cache miss) for each of them.
+    size_t filter_size = 64;
+    while (filter_size < cmpctblock.shorttxids.size() * SHORTTXIDS_FILTER_BITS)
+        filter_size <<= 1;
+    const uint64_t filter_mask = filter_size - 1;
+    std::vector<bool> shortid_filter(filter_size);
+    for (const uint64_t shortid : cmpctblock.shorttxids)
+        shortid_filter[shortid & filter_mask] = true;
+
     std::vector<bool> have_txn(txn_available.size());
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
     for (size_t i = 0; i < vTxHashes.size(); i++) {
         uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
+        if (!shortid_filter[shortid & filter_mask])
+            continue;
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
@@ -137,6 +153,8 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
 
     for (size_t i = 0; i < extra_txn.size(); i++) {
         uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
+        if (!shortid_filter[shortid & filter_mask])
+            continue;
         std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
         if (idit != shorttxids.end()) {
             if (!have_txn[idit->second]) {
@@ -79,10 +79,22 @@ typedef u_int SOCKET;
 #define MSG_NOSIGNAL 0
 #endif
 
+// Socket event backends besides select(). poll() is known to misbehave on
+// Windows and OS X, so it is only used where it is reliable.
+#if defined(__linux__)
+#define USE_POLL
+#define USE_EPOLL
+#endif
+
+#ifdef USE_POLL
+#include <poll.h>
+#endif
+
 #if HAVE_DECL_STRNLEN == 0
 size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
+/** Whether select() can wait on s. Not a concern when waiting with poll() or epoll. */
 bool static inline IsSelectableSocket(SOCKET s) {
 #ifdef WIN32
     return true;
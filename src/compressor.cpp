@@ -183,3 +183,23 @@ uint64_t CTxOutCompressor::DecompressAmount(uint64_t x)
     }
     return n;
 }
+
+bool CTxCompressor::IsCompressible(const CTransaction& tx)
+{
+    // Amounts outside the money range and overly long scripts do not
+    // survive CTxOutCompressor unchanged.
+    for (const CTxOut& txout : tx.vout) {
+        if (!MoneyRange(txout.nValue) || txout.scriptPubKey.size() > MAX_SCRIPT_SIZE)
+            return false;
+    }
+    return true;
+}
+
+bool CBlockCompressor::IsCompressible(const CBlock& block)
+{
+    for (const CTransactionRef& tx : block.vtx) {
+        if (!CTxCompressor::IsCompressible(*tx))
+            return false;
+    }
+    return true;
+}
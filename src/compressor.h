@@ -6,6 +6,8 @@
 #ifndef BITCOIN_COMPRESSOR_H
 #define BITCOIN_COMPRESSOR_H
 
+#include "amount.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "script/script.h"
 #include "serialize.h"
@@ -118,4 +120,106 @@ public:
     }
 };
 
+/** Wrapper for CTransactionRef that provides a more compact serialization.
+ *
+ *  Outputs are stored through CTxOutCompressor, output indexes and lock
+ *  times as VARINTs, and sequence numbers inverted as VARINTs so that the
+ *  common SEQUENCE_FINAL takes a single byte. Transactions are only eligible
+ *  when this encoding round-trips exactly, see IsCompressible().
+ */
+class CTxCompressor
+{
+private:
+    CTransactionRef &tx;
+
+public:
+    CTxCompressor(CTransactionRef &txIn) : tx(txIn) { }
+
+    static bool IsCompressible(const CTransaction& tx);
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        unsigned char flags = tx->HasWitness() ? 1 : 0;
+        s << tx->nVersion;
+        s << flags;
+        WriteCompactSize(s, tx->vin.size());
+        for (const CTxIn& txin : tx->vin) {
+            uint32_t n = txin.prevout.n;
+            uint32_t nSequenceInv = ~txin.nSequence;
+            s << txin.prevout.hash;
+            s << VARINT(n);
+            s << *(const CScriptBase*)(&txin.scriptSig);
+            s << VARINT(nSequenceInv);
+        }
+        WriteCompactSize(s, tx->vout.size());
+        for (const CTxOut& txout : tx->vout)
+            s << CTxOutCompressor(REF(txout));
+        if (flags & 1) {
+            for (const CTxIn& txin : tx->vin)
+                s << txin.scriptWitness.stack;
+        }
+        uint32_t nLockTime = tx->nLockTime;
+        s << VARINT(nLockTime);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        CMutableTransaction mtx;
+        unsigned char flags = 0;
+        s >> mtx.nVersion;
+        s >> flags;
+        if (flags & ~1)
+            throw std::ios_base::failure("Unknown transaction optional data");
+        mtx.vin.resize(ReadCompactSize(s));
+        for (CTxIn& txin : mtx.vin) {
+            uint32_t nSequenceInv = 0;
+            s >> txin.prevout.hash;
+            s >> VARINT(txin.prevout.n);
+            s >> *(CScriptBase*)(&txin.scriptSig);
+            s >> VARINT(nSequenceInv);
+            txin.nSequence = ~nSequenceInv;
+        }
+        mtx.vout.resize(ReadCompactSize(s));
+        for (CTxOut& txout : mtx.vout)
+            s >> REF(CTxOutCompressor(txout));
+        if (flags & 1) {
+            for (CTxIn& txin : mtx.vin)
+                s >> txin.scriptWitness.stack;
+        }
+        s >> VARINT(mtx.nLockTime);
+        tx = MakeTransactionRef(std::move(mtx));
+    }
+};
+
+/** Wrapper for CBlock that serializes its transactions through CTxCompressor.
+ *  Used for compressed records in blk?????.dat files.
+ */
+class CBlockCompressor
+{
+private:
+    CBlock &block;
+
+public:
+    CBlockCompressor(CBlock &blockIn) : block(blockIn) { }
+
+    /** Whether every transaction of the block can be stored compressed */
+    static bool IsCompressible(const CBlock& block);
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        s << *(const CBlockHeader*)(&block);
+        WriteCompactSize(s, block.vtx.size());
+        for (const CTransactionRef& tx : block.vtx)
+            s << CTxCompressor(REF(tx));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        s >> *(CBlockHeader*)(&block);
+        block.vtx.resize(ReadCompactSize(s));
+        for (CTransactionRef& tx : block.vtx)
+            s >> REF(CTxCompressor(tx));
+    }
+};
+
 #endif // BITCOIN_COMPRESSOR_H
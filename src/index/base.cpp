@@ -0,0 +1,242 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/base.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "init.h"
+#include "tinyformat.h"
+#include "ui_interface.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+#include "warnings.h"
+
+#include <functional>
+
+static const char DB_BEST_BLOCK = 'B';
+
+/** Interval between progress log messages while an index is catching up (seconds) */
+static const int64_t SYNC_LOG_INTERVAL = 30;
+/** Interval between best block locator writes while an index is catching up (seconds) */
+static const int64_t SYNC_LOCATOR_WRITE_INTERVAL = 30;
+
+template<typename... Args>
+static void FatalError(const char* fmt, const Args&... args)
+{
+    std::string strMessage = tfm::format(fmt, args...);
+    SetMiscWarning(strMessage);
+    LogPrintf("*** %s\n", strMessage);
+    uiInterface.ThreadSafeMessageBox(
+        "Error: A fatal internal error occurred, see debug.log for details",
+        "", CClientUIInterface::MSG_ERROR);
+    StartShutdown();
+}
+
+BaseIndex::DB::DB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe) :
+    CDBWrapper(path, nCacheSize, fMemory, fWipe)
+{
+}
+
+bool BaseIndex::DB::ReadBestBlock(CBlockLocator& locator) const
+{
+    bool success = Read(DB_BEST_BLOCK, locator);
+    if (!success) {
+        locator.SetNull();
+    }
+    return success;
+}
+
+bool BaseIndex::DB::WriteBestBlock(const CBlockLocator& locator)
+{
+    return Write(DB_BEST_BLOCK, locator);
+}
+
+BaseIndex::BaseIndex() : fSynced(false), pindexBest(NULL), fWakeUp(false)
+{
+}
+
+BaseIndex::~BaseIndex()
+{
+    Interrupt();
+    Stop();
+}
+
+void BaseIndex::Start()
+{
+    CBlockLocator locator;
+    GetDB().ReadBestBlock(locator);
+    {
+        LOCK(cs_main);
+        // The first locator entry is the exact block the index was in sync
+        // with; it may since have been disconnected, in which case the sync
+        // thread rewinds it.
+        const CBlockIndex* pindex = NULL;
+        for (const uint256& hash : locator.vHave) {
+            BlockMap::const_iterator it = mapBlockIndex.find(hash);
+            if (it != mapBlockIndex.end()) {
+                pindex = it->second;
+                break;
+            }
+        }
+        pindexBest = pindex;
+    }
+
+    interruptSync.reset();
+    RegisterValidationInterface(this);
+    threadSync = std::thread(&TraceThread<std::function<void()> >, GetName(), std::function<void()>(std::bind(&BaseIndex::ThreadSync, this)));
+}
+
+void BaseIndex::Interrupt()
+{
+    interruptSync();
+    WakeUp();
+}
+
+void BaseIndex::Stop()
+{
+    UnregisterValidationInterface(this);
+
+    if (threadSync.joinable()) {
+        threadSync.join();
+    }
+}
+
+void BaseIndex::WakeUp()
+{
+    std::lock_guard<std::mutex> lock(mutexSync);
+    fWakeUp = true;
+    condSync.notify_all();
+}
+
+void BaseIndex::SetBestBlockIndex(const CBlockIndex* pindex)
+{
+    std::lock_guard<std::mutex> lock(mutexSync);
+    pindexBest = pindex;
+    condSync.notify_all();
+}
+
+bool BaseIndex::CommitBestBlock(const CBlockIndex* pindex)
+{
+    CBlockLocator locator;
+    {
+        LOCK(cs_main);
+        locator = chainActive.GetLocator(pindex);
+    }
+    return GetDB().WriteBestBlock(locator);
+}
+
+void BaseIndex::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    WakeUp();
+}
+
+void BaseIndex::ThreadSync()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    int64_t nLastLogTime = 0;
+    int64_t nLastLocatorWriteTime = GetTime();
+    const CBlockIndex* pindexCommitted = pindexBest;
+
+    while (!interruptSync) {
+        const CBlockIndex* pindex = pindexBest;
+        const CBlockIndex* pindexNext = NULL;
+        bool fRewind = false;
+        {
+            LOCK(cs_main);
+            if (!pindex) {
+                pindexNext = chainActive.Genesis();
+            } else if (chainActive.Contains(pindex)) {
+                pindexNext = chainActive.Next(pindex);
+            } else if (chainActive.FindFork(pindex) != chainActive.Tip()) {
+                fRewind = true;
+            }
+            // Otherwise the active chain is behind the index on the same
+            // branch (e.g. during -reindex-chainstate); wait for it.
+        }
+
+        if (fRewind) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindex, consensusParams)) {
+                FatalError("%s: Failed to read block %s from disk", __func__, pindex->GetBlockHash().ToString());
+                return;
+            }
+            if (!RewindBlock(block, pindex)) {
+                FatalError("%s: Failed to rewind block %s from %s", __func__, pindex->GetBlockHash().ToString(), GetName());
+                return;
+            }
+            SetBestBlockIndex(pindex->pprev);
+            continue;
+        }
+
+        if (!pindexNext) {
+            // An empty active chain (e.g. before the genesis block is
+            // loaded) does not count as being in sync.
+            if (!fSynced && pindex) {
+                fSynced = true;
+                LogPrintf("%s is enabled at height %d\n", GetName(), pindex->nHeight);
+            }
+            if (pindex && pindex != pindexCommitted) {
+                if (!CommitBestBlock(pindex)) {
+                    FatalError("%s: Failed to write locator to %s", __func__, GetName());
+                    return;
+                }
+                pindexCommitted = pindex;
+            }
+
+            std::unique_lock<std::mutex> lock(mutexSync);
+            condSync.wait(lock, [this] { return fWakeUp || interruptSync; });
+            fWakeUp = false;
+            continue;
+        }
+
+        int64_t nNow = GetTime();
+        if (!fSynced && nLastLogTime + SYNC_LOG_INTERVAL < nNow) {
+            LogPrintf("Syncing %s with block chain from height %d\n", GetName(), pindexNext->nHeight);
+            nLastLogTime = nNow;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindexNext, consensusParams)) {
+            FatalError("%s: Failed to read block %s from disk", __func__, pindexNext->GetBlockHash().ToString());
+            return;
+        }
+        if (!WriteBlock(block, pindexNext)) {
+            FatalError("%s: Failed to write block %s to %s", __func__, pindexNext->GetBlockHash().ToString(), GetName());
+            return;
+        }
+        SetBestBlockIndex(pindexNext);
+
+        // While catching up, only write the locator every so often; the
+        // entries of blocks written since are rewritten after a restart.
+        if (fSynced || nLastLocatorWriteTime + SYNC_LOCATOR_WRITE_INTERVAL < nNow) {
+            if (!CommitBestBlock(pindexNext)) {
+                FatalError("%s: Failed to write locator to %s", __func__, GetName());
+                return;
+            }
+            pindexCommitted = pindexNext;
+            nLastLocatorWriteTime = nNow;
+        }
+    }
+}
+
+bool BaseIndex::BlockUntilSyncedToCurrentChain()
+{
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    if (!pindexTip)
+        return true;
+
+    WakeUp();
+    std::unique_lock<std::mutex> lock(mutexSync);
+    condSync.wait(lock, [this, pindexTip] {
+        const CBlockIndex* pindex = pindexBest;
+        return (pindex && pindex->GetAncestor(pindexTip->nHeight) == pindexTip) || interruptSync || !threadSync.joinable();
+    });
+    return !interruptSync;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BASE_H
+#define BITCOIN_INDEX_BASE_H
+
+#include "dbwrapper.h"
+#include "primitives/block.h"
+#include "threadinterrupt.h"
+#include "validationinterface.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class CBlockIndex;
+
+/**
+ * Base class for indices of blockchain data. An index follows the active
+ * chain from its own thread: it catches up by reading blocks from disk, is
+ * woken up by UpdatedBlockTip notifications once it is in sync, and rewinds
+ * blocks that are disconnected by a reorganization. Each index keeps the
+ * locator of the block it is in sync with in its own database, so it can be
+ * enabled at any time and resumes where it left off after being disabled,
+ * without reindexing the chain.
+ */
+class BaseIndex : public CValidationInterface
+{
+public:
+    /** Database of an index, which stores the index's best block locator */
+    class DB : public CDBWrapper
+    {
+    public:
+        DB(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+        /** Read the locator of the chain that the index is in sync with. */
+        bool ReadBestBlock(CBlockLocator& locator) const;
+
+        /** Write the locator of the chain that the index is in sync with. */
+        bool WriteBestBlock(const CBlockLocator& locator);
+    };
+
+private:
+    /** Whether the index has caught up with the active chain at least once */
+    std::atomic<bool> fSynced;
+
+    /** The last block in the chain that the index is in sync with */
+    std::atomic<const CBlockIndex*> pindexBest;
+
+    std::thread threadSync;
+    CThreadInterrupt interruptSync;
+
+    /** Guards fWakeUp and is held when waking up the sync thread or waiters */
+    std::mutex mutexSync;
+    std::condition_variable condSync;
+    bool fWakeUp;
+
+    /** Follow the active chain, writing and rewinding blocks as needed. */
+    void ThreadSync();
+
+    /** Write the locator of pindex to the index database. */
+    bool CommitBestBlock(const CBlockIndex* pindex);
+
+    void SetBestBlockIndex(const CBlockIndex* pindex);
+
+    void WakeUp();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+    /** Write update index entries for a newly connected block. */
+    virtual bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) { return true; }
+
+    /** Remove the index entries of a block that was disconnected from the active chain. */
+    virtual bool RewindBlock(const CBlock& block, const CBlockIndex* pindex) { return true; }
+
+    virtual DB& GetDB() const = 0;
+
+    /** Get the name of the index for display in logs. */
+    virtual const char* GetName() const = 0;
+
+public:
+    BaseIndex();
+    /** Destructor interrupts sync thread if running and blocks until it exits. */
+    virtual ~BaseIndex();
+
+    /** Whether the index has caught up with the active chain since it was started. */
+    bool IsSynced() const { return fSynced; }
+
+    /**
+     * Blocks the current thread until the index has processed the tip of the
+     * active chain at the time of the call. Returns false if the index was
+     * interrupted before reaching it. Must not be called with cs_main held.
+     */
+    bool BlockUntilSyncedToCurrentChain();
+
+    /** Start initializes the sync state and registers the instance as a
+     * ValidationInterface so that it stays in sync with blockchain updates. */
+    void Start();
+
+    /** Interrupt the sync thread, without waiting for it to exit. */
+    void Interrupt();
+
+    /** Stops the instance from staying in sync with blockchain updates. */
+    void Stop();
+};
+
+#endif // BITCOIN_INDEX_BASE_H
@@ -0,0 +1,176 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/blockfilterindex.h"
+
+#include "chain.h"
+#include "undo.h"
+#include "util.h"
+#include "validation.h"
+
+#include <map>
+
+/* The index database stores one entry per block, keyed by block hash, with
+ * the filter hash, the filter header and the encoded filter. Lookups by
+ * height walk back from the requested stop block.
+ */
+static const char DB_FILTER = 'f';
+
+namespace {
+
+struct DBVal {
+    uint256 hash;
+    uint256 header;
+    std::vector<unsigned char> encoded_filter;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hash);
+        READWRITE(header);
+        READWRITE(encoded_filter);
+    }
+};
+
+} // namespace
+
+static std::map<BlockFilterType, std::unique_ptr<BlockFilterIndex> > g_filter_indexes;
+
+BlockFilterIndex::DB::DB(BlockFilterType filter_type, size_t nCacheSize, bool fMemory, bool fWipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "blockfilter" / BlockFilterTypeName(filter_type), nCacheSize, fMemory, fWipe)
+{
+}
+
+BlockFilterIndex::BlockFilterIndex(BlockFilterType filter_type,
+                                   size_t nCacheSize, bool fMemory, bool fWipe)
+    : m_filter_type(filter_type)
+{
+    if (BlockFilterTypeName(filter_type).empty())
+        throw std::invalid_argument("unknown filter_type");
+
+    pdb.reset(new BlockFilterIndex::DB(filter_type, nCacheSize, fMemory, fWipe));
+}
+
+BlockFilterIndex::~BlockFilterIndex() {}
+
+bool BlockFilterIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    CBlockUndo block_undo;
+    uint256 prev_header;
+
+    if (pindex->nHeight > 0) {
+        if (!UndoReadFromDisk(block_undo, pindex)) {
+            return false;
+        }
+
+        if (!LookupEntry(pindex->pprev, NULL, &prev_header, NULL)) {
+            return error("%s: Failed to read filter header of block %s", __func__, pindex->pprev->GetBlockHash().ToString());
+        }
+    }
+
+    BlockFilter filter(m_filter_type, block, block_undo);
+
+    DBVal value;
+    value.hash = filter.GetHash();
+    value.header = filter.ComputeHeader(prev_header);
+    value.encoded_filter = filter.GetEncodedFilter();
+    return pdb->Write(std::make_pair(DB_FILTER, pindex->GetBlockHash()), value);
+}
+
+BaseIndex::DB& BlockFilterIndex::GetDB() const { return *pdb; }
+
+bool BlockFilterIndex::LookupEntry(const CBlockIndex* pindex, uint256* filter_hash, uint256* header,
+                                   std::vector<unsigned char>* encoded_filter) const
+{
+    DBVal value;
+    if (!pdb->Read(std::make_pair(DB_FILTER, pindex->GetBlockHash()), value)) {
+        return false;
+    }
+    if (filter_hash) *filter_hash = value.hash;
+    if (header) *header = value.header;
+    if (encoded_filter) encoded_filter->swap(value.encoded_filter);
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilter(const CBlockIndex* pindex, BlockFilter& filter_out) const
+{
+    std::vector<unsigned char> encoded_filter;
+    if (!LookupEntry(pindex, NULL, NULL, &encoded_filter)) {
+        return false;
+    }
+
+    try {
+        filter_out = BlockFilter(m_filter_type, pindex->GetBlockHash(), std::move(encoded_filter));
+    } catch (const std::exception& e) {
+        return error("%s: Failed to decode filter of block %s: %s", __func__, pindex->GetBlockHash().ToString(), e.what());
+    }
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterHeader(const CBlockIndex* pindex, uint256& header_out) const
+{
+    return LookupEntry(pindex, NULL, &header_out, NULL);
+}
+
+bool BlockFilterIndex::LookupFilterRange(int start_height, const CBlockIndex* stop_index,
+                                         std::vector<BlockFilter>& filters_out) const
+{
+    if (start_height < 0 || start_height > stop_index->nHeight) {
+        return error("%s: start height (%d) is outside the range of the stop block (%d)",
+                     __func__, start_height, stop_index->nHeight);
+    }
+
+    filters_out.resize(stop_index->nHeight - start_height + 1);
+    const CBlockIndex* pindex = stop_index;
+    for (int i = filters_out.size() - 1; i >= 0; i--, pindex = pindex->pprev) {
+        if (!LookupFilter(pindex, filters_out[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BlockFilterIndex::LookupFilterHashRange(int start_height, const CBlockIndex* stop_index,
+                                             std::vector<uint256>& hashes_out) const
+{
+    if (start_height < 0 || start_height > stop_index->nHeight) {
+        return error("%s: start height (%d) is outside the range of the stop block (%d)",
+                     __func__, start_height, stop_index->nHeight);
+    }
+
+    hashes_out.resize(stop_index->nHeight - start_height + 1);
+    const CBlockIndex* pindex = stop_index;
+    for (int i = hashes_out.size() - 1; i >= 0; i--, pindex = pindex->pprev) {
+        if (!LookupEntry(pindex, &hashes_out[i], NULL, NULL)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+BlockFilterIndex* GetBlockFilterIndex(BlockFilterType filter_type)
+{
+    auto it = g_filter_indexes.find(filter_type);
+    return it != g_filter_indexes.end() ? it->second.get() : NULL;
+}
+
+void ForEachBlockFilterIndex(std::function<void (BlockFilterIndex&)> fn)
+{
+    for (auto& entry : g_filter_indexes) fn(*entry.second);
+}
+
+bool InitBlockFilterIndex(BlockFilterType filter_type,
+                          size_t nCacheSize, bool fMemory, bool fWipe)
+{
+    if (g_filter_indexes.count(filter_type))
+        return false;
+    g_filter_indexes[filter_type].reset(new BlockFilterIndex(filter_type, nCacheSize, fMemory, fWipe));
+    return true;
+}
+
+void DestroyAllBlockFilterIndexes()
+{
+    g_filter_indexes.clear();
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_BLOCKFILTERINDEX_H
+#define BITCOIN_INDEX_BLOCKFILTERINDEX_H
+
+#include "blockfilter.h"
+#include "index/base.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+static const char* const DEFAULT_BLOCKFILTERINDEX = "0";
+
+/**
+ * BlockFilterIndex is used to store and retrieve block filters, hashes, and
+ * headers for a range of blocks by height. Filters are computed once, when
+ * the index processes a block, so serving them to peers is a plain lookup.
+ * Entries are keyed by block hash, so filters of blocks that were
+ * disconnected by a reorganization stay valid and need no rewinding.
+ */
+class BlockFilterIndex : public BaseIndex
+{
+public:
+    /** Access to a block filter database (indexes/blockfilter/<type>/) */
+    class DB : public BaseIndex::DB
+    {
+    public:
+        DB(BlockFilterType filter_type, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    };
+
+private:
+    BlockFilterType m_filter_type;
+    std::unique_ptr<DB> pdb;
+
+    bool LookupEntry(const CBlockIndex* pindex, uint256* filter_hash, uint256* header,
+                     std::vector<unsigned char>* encoded_filter) const;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "blockfilterindex"; }
+
+public:
+    /** Constructs the index, which becomes available to be queried. */
+    explicit BlockFilterIndex(BlockFilterType filter_type,
+                              size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    virtual ~BlockFilterIndex();
+
+    BlockFilterType GetFilterType() const { return m_filter_type; }
+
+    /** Get a single filter by block. */
+    bool LookupFilter(const CBlockIndex* pindex, BlockFilter& filter_out) const;
+
+    /** Get a single filter header by block. */
+    bool LookupFilterHeader(const CBlockIndex* pindex, uint256& header_out) const;
+
+    /** Get a range of filters between two heights on a chain. */
+    bool LookupFilterRange(int start_height, const CBlockIndex* stop_index,
+                           std::vector<BlockFilter>& filters_out) const;
+
+    /** Get a range of filter hashes between two heights on a chain. */
+    bool LookupFilterHashRange(int start_height, const CBlockIndex* stop_index,
+                               std::vector<uint256>& hashes_out) const;
+};
+
+/**
+ * Get a block filter index by type. Returns nullptr if index has not been
+ * initialized or was already destroyed.
+ */
+BlockFilterIndex* GetBlockFilterIndex(BlockFilterType filter_type);
+
+/** Iterate over all running block filter indexes, invoking fn on each. */
+void ForEachBlockFilterIndex(std::function<void (BlockFilterIndex&)> fn);
+
+/**
+ * Initialize a block filter index for the given type if one does not already
+ * exist. Returns true if a new index is created and false if one has already
+ * been initialized.
+ */
+bool InitBlockFilterIndex(BlockFilterType filter_type,
+                          size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+/** Destroy all open block filter indexes. */
+void DestroyAllBlockFilterIndexes();
+
+#endif // BITCOIN_INDEX_BLOCKFILTERINDEX_H
@@ -0,0 +1,75 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/spentindex.h"
+
+#include "chain.h"
+#include "util.h"
+
+static const char DB_SPENTINDEX = 's';
+
+std::unique_ptr<SpentIndex> g_spentindex;
+
+SpentIndex::DB::DB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "spentindex", nCacheSize, fMemory, fWipe)
+{
+}
+
+bool SpentIndex::DB::ReadSpent(const CSpentIndexKey& key, CSpentIndexValue& value) const
+{
+    return Read(std::make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool SpentIndex::DB::UpdateSpent(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >& vect)
+{
+    CDBBatch batch(*this);
+    for (const auto& entry : vect) {
+        if (entry.second.IsNull())
+            batch.Erase(std::make_pair(DB_SPENTINDEX, entry.first));
+        else
+            batch.Write(std::make_pair(DB_SPENTINDEX, entry.first), entry.second);
+    }
+    return WriteBatch(batch);
+}
+
+SpentIndex::SpentIndex(size_t nCacheSize, bool fMemory, bool fWipe)
+    : pdb(new SpentIndex::DB(nCacheSize, fMemory, fWipe))
+{
+}
+
+SpentIndex::~SpentIndex() {}
+
+bool SpentIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpent;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (unsigned int j = 0; j < tx->vin.size(); j++) {
+            const COutPoint& prevout = tx->vin[j].prevout;
+            vSpent.push_back(std::make_pair(CSpentIndexKey(prevout.hash, prevout.n), CSpentIndexValue(tx->GetHash(), j, pindex->nHeight)));
+        }
+    }
+    return pdb->UpdateSpent(vSpent);
+}
+
+bool SpentIndex::RewindBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpent;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            vSpent.push_back(std::make_pair(CSpentIndexKey(txin.prevout.hash, txin.prevout.n), CSpentIndexValue()));
+        }
+    }
+    return pdb->UpdateSpent(vSpent);
+}
+
+BaseIndex::DB& SpentIndex::GetDB() const { return *pdb; }
+
+bool SpentIndex::FindSpent(const CSpentIndexKey& key, CSpentIndexValue& value) const
+{
+    return pdb->ReadSpent(key, value);
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_SPENTINDEX_H
+#define BITCOIN_INDEX_SPENTINDEX_H
+
+#include "index/base.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/** Key of the spent index: the outpoint being spent */
+struct CSpentIndexKey
+{
+    uint256 txid;
+    unsigned int outputIndex;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(outputIndex);
+    }
+
+    CSpentIndexKey(const uint256& txidIn, unsigned int outputIndexIn) : txid(txidIn), outputIndex(outputIndexIn) {
+    }
+
+    CSpentIndexKey() {
+        SetNull();
+    }
+
+    void SetNull() {
+        txid.SetNull();
+        outputIndex = 0;
+    }
+};
+
+/** Value of the spent index: the input that spends the outpoint, and where it was confirmed */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    unsigned int inputIndex;
+    int blockHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(VARINT(inputIndex));
+        READWRITE(VARINT(blockHeight));
+    }
+
+    CSpentIndexValue(const uint256& txidIn, unsigned int inputIndexIn, int blockHeightIn) : txid(txidIn), inputIndex(inputIndexIn), blockHeight(blockHeightIn) {
+    }
+
+    CSpentIndexValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        txid.SetNull();
+        inputIndex = 0;
+        blockHeight = 0;
+    }
+
+    bool IsNull() const {
+        return txid.IsNull();
+    }
+};
+
+/**
+ * SpentIndex maps each confirmed outpoint to the input that spends it, and
+ * the height of the block that input was confirmed in.
+ */
+class SpentIndex : public BaseIndex
+{
+public:
+    /** Access to the spent index database (indexes/spentindex/) */
+    class DB : public BaseIndex::DB
+    {
+    public:
+        explicit DB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+        bool ReadSpent(const CSpentIndexKey& key, CSpentIndexValue& value) const;
+
+        /** Write the given entries to the index; entries with a null value are erased. */
+        bool UpdateSpent(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >& vect);
+    };
+
+private:
+    const std::unique_ptr<DB> pdb;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    bool RewindBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "spentindex"; }
+
+public:
+    explicit SpentIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    virtual ~SpentIndex();
+
+    /** Look up the confirmed input spending an outpoint. */
+    bool FindSpent(const CSpentIndexKey& key, CSpentIndexValue& value) const;
+};
+
+/** The global spent index, used by getspentinfo. May be null. */
+extern std::unique_ptr<SpentIndex> g_spentindex;
+
+#endif // BITCOIN_INDEX_SPENTINDEX_H
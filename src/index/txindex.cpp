@@ -0,0 +1,100 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/txindex.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "util.h"
+#include "validation.h"
+
+static const char DB_TXINDEX = 't';
+
+std::unique_ptr<TxIndex> g_txindex;
+
+TxIndex::DB::DB(size_t nCacheSize, bool fMemory, bool fWipe) :
+    BaseIndex::DB(GetDataDir() / "indexes" / "txindex", nCacheSize, fMemory, fWipe)
+{
+}
+
+bool TxIndex::DB::ReadTxPos(const uint256& txid, CDiskTxPos& pos) const
+{
+    return Read(std::make_pair(DB_TXINDEX, txid), pos);
+}
+
+bool TxIndex::DB::WriteTxs(const std::vector<std::pair<uint256, CDiskTxPos> >& vPos)
+{
+    CDBBatch batch(*this);
+    for (const auto& tuple : vPos) {
+        batch.Write(std::make_pair(DB_TXINDEX, tuple.first), tuple.second);
+    }
+    return WriteBatch(batch);
+}
+
+TxIndex::TxIndex(size_t nCacheSize, bool fMemory, bool fWipe)
+    : pdb(new TxIndex::DB(nCacheSize, fMemory, fWipe))
+{
+}
+
+TxIndex::~TxIndex() {}
+
+bool TxIndex::WriteBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    // Exclude genesis block transaction because outputs are not spendable.
+    if (pindex->nHeight == 0)
+        return true;
+
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    vPos.reserve(block.vtx.size());
+    for (const auto& tx : block.vtx) {
+        vPos.push_back(std::make_pair(tx->GetHash(), pos));
+        pos.nTxOffset += ::GetSerializeSize(*tx, SER_DISK, CLIENT_VERSION);
+    }
+    return pdb->WriteTxs(vPos);
+}
+
+BaseIndex::DB& TxIndex::GetDB() const { return *pdb; }
+
+bool TxIndex::FindTx(const uint256& txid, uint256& hashBlock, CTransactionRef& tx) const
+{
+    CDiskTxPos postx;
+    if (!pdb->ReadTxPos(txid, postx))
+        return false;
+
+    // Transaction offsets refer to the network serialization of the block;
+    // compressed records have to be decoded as a whole.
+    BlockRecordCodec codec;
+    if (!ReadBlockRecordCodec(postx, codec))
+        return false;
+    if (codec != BLOCK_CODEC_RAW) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, postx, Params().GetConsensus()))
+            return false;
+        for (const CTransactionRef& blocktx : block.vtx) {
+            if (blocktx->GetHash() == txid) {
+                tx = blocktx;
+                hashBlock = block.GetHash();
+                return true;
+            }
+        }
+        return error("%s: txid %s not found in block at %s", __func__, txid.ToString(), postx.ToString());
+    }
+
+    CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return error("%s: OpenBlockFile failed", __func__);
+    CBlockHeader header;
+    try {
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> tx;
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    if (tx->GetHash() != txid)
+        return error("%s: txid mismatch", __func__);
+    hashBlock = header.GetHash();
+    return true;
+}
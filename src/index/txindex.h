@@ -0,0 +1,69 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_INDEX_TXINDEX_H
+#define BITCOIN_INDEX_TXINDEX_H
+
+#include "index/base.h"
+#include "primitives/transaction.h"
+#include "txdb.h"
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/**
+ * TxIndex is used to look up transactions included in the blockchain by hash.
+ * The index is written to a LevelDB database and records the filesystem
+ * location of each transaction by transaction hash.
+ */
+class TxIndex : public BaseIndex
+{
+public:
+    /** Access to the txindex database (indexes/txindex/) */
+    class DB : public BaseIndex::DB
+    {
+    public:
+        explicit DB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+        /** Read the disk location of the transaction data with the given hash. Returns false if the
+         *  transaction hash is not indexed. */
+        bool ReadTxPos(const uint256& txid, CDiskTxPos& pos) const;
+
+        /** Write a batch of transaction positions to the DB. */
+        bool WriteTxs(const std::vector<std::pair<uint256, CDiskTxPos> >& vPos);
+    };
+
+private:
+    const std::unique_ptr<DB> pdb;
+
+protected:
+    bool WriteBlock(const CBlock& block, const CBlockIndex* pindex) override;
+
+    BaseIndex::DB& GetDB() const override;
+
+    const char* GetName() const override { return "txindex"; }
+
+public:
+    /** Constructs the index, which becomes available to be queried. */
+    explicit TxIndex(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+
+    /** Destructor is declared because this class contains a unique_ptr to an incomplete type. */
+    virtual ~TxIndex();
+
+    /**
+     * Look up a transaction by hash.
+     *
+     * @param[in]   txid  The hash of the transaction to be returned.
+     * @param[out]  hashBlock  The hash of the block the transaction is found in.
+     * @param[out]  tx  The transaction itself.
+     * @return  true if transaction is found, false otherwise
+     */
+    bool FindTx(const uint256& txid, uint256& hashBlock, CTransactionRef& tx) const;
+};
+
+/** The global transaction index, used in GetTransaction. May be null. */
+extern std::unique_ptr<TxIndex> g_txindex;
+
+#endif // BITCOIN_INDEX_TXINDEX_H
@@ -18,6 +18,9 @@
 #include "consensus/validation.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "index/blockfilterindex.h"
+#include "index/spentindex.h"
+#include "index/txindex.h"
 #include "key.h"
 #include "validation.h"
 #include "miner.h"
@@ -168,6 +171,8 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
+static std::set<BlockFilterType> g_enabled_filter_types;
+
 static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static std::unique_ptr<ECCVerifyHandle> globalVerifyHandle;
@@ -179,6 +184,11 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    if (g_txindex)
+        g_txindex->Interrupt();
+    if (g_spentindex)
+        g_spentindex->Interrupt();
+    ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Interrupt(); });
     if (g_connman)
         g_connman->Interrupt();
     threadGroup.interrupt_all();
@@ -217,6 +227,17 @@ void Shutdown()
     if (fDumpMempoolLater)
         DumpMempool();
 
+    if (g_txindex) {
+        g_txindex->Stop();
+        g_txindex.reset();
+    }
+    if (g_spentindex) {
+        g_spentindex->Stop();
+        g_spentindex.reset();
+    }
+    ForEachBlockFilterIndex([](BlockFilterIndex& index) { index.Stop(); });
+    DestroyAllBlockFilterIndexes();
+
     if (fFeeEstimatesInitialized)
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -328,7 +349,11 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-blockcompression", strprintf(_("Store new blocks in the block files in a compressed format (default: %u)"), DEFAULT_BLOCKCOMPRESSION));
+    strUsage += HelpMessageOpt("-blockfilterindex=<type>", strprintf(_("Maintain an index of compact filters by block (default: %s, values: %s)."), DEFAULT_BLOCKFILTERINDEX, BlockFilterTypeName(BLOCK_FILTER_BASIC)) +
+                                                         " " + _("If <type> is not supplied or if <type> = 1, indexes for all known types are enabled."));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    strUsage += HelpMessageOpt("-blocksdir=<dir>", _("Specify directory to hold the block and undo files (default: <datadir>/blocks)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage +=HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their script verification (0 to verify all, default: %s, testnet: %s)"), Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
@@ -361,6 +386,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-spentindex", strprintf(_("Maintain an index of spent outputs, used by the getspentinfo rpc call (default: %u)"), DEFAULT_SPENTINDEX));
     strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
@@ -381,17 +407,21 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-maxtimeadjustment", strprintf(_("Maximum allowed median peer time offset adjustment. Local perspective of time may be influenced by peers forward or backward by this amount. (default: %u seconds)"), DEFAULT_MAX_TIME_ADJUSTMENT));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Set the number of threads processing peer messages (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"), 1, MAX_MSGHANDLER_THREADS, DEFAULT_MSGHANDLER_THREADS));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers per BIP 157 (default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     strUsage += HelpMessageOpt("-port=<port>", strprintf(_("Listen for connections on <port> (default: %u or testnet: %u)"), Params(CBaseChainParams::MAIN).GetDefaultPort(), Params(CBaseChainParams::TESTNET).GetDefaultPort()));
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-rpcserialversion", strprintf(_("Sets the serialization of raw transaction or block hex returned in non-verbose mode, non-segwit(0) or segwit(1) (default: %d)"), DEFAULT_RPC_SERIALIZE_VERSION));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("Wait for socket events with <mode>, one of: %s (default: %s)"), GetSupportedSocketEventsModes(), GetSocketEventsModeName(DEFAULT_SOCKETEVENTS)));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
+    strUsage += HelpMessageOpt("-txreconciliation", strprintf(_("Announce transactions to peers that support it through periodic set reconciliation instead of an inv per transaction, flooding them only to a few outbound peers (default: %u)"), DEFAULT_TXRECONCILIATION));
 #ifdef USE_UPNP
     #if USE_UPNP
     strUsage += HelpMessageOpt("-upnp", _("Use UPnP to map the listening port (default: 1 when listening and no -proxy)"));
@@ -404,6 +434,7 @@ std::string HelpMessage(HelpMessageMode mode)
                                                                      " " + _("Whitelisted peers cannot be DoS banned and their transactions are always relayed, even if they are already in the mempool, useful e.g. for a gateway"));
     strUsage += HelpMessageOpt("-whitelistrelay", strprintf(_("Accept relayed transactions received from whitelisted peers even when not relaying transactions (default: %d)"), DEFAULT_WHITELISTRELAY));
     strUsage += HelpMessageOpt("-whitelistforcerelay", strprintf(_("Force relay of transactions from whitelisted peers even if they violate local relay policy (default: %d)"), DEFAULT_WHITELISTFORCERELAY));
+    strUsage += HelpMessageOpt("-whitelistcmpctrelay", strprintf(_("Have all whitelisted peers announce new blocks with compact blocks, and forward those to the other whitelisted peers as soon as the block header is valid, before the block is validated (default: %d)"), DEFAULT_WHITELISTCMPCTRELAY));
     strUsage += HelpMessageOpt("-maxuploadtarget=<n>", strprintf(_("Tries to keep outbound traffic under the given target (in MiB per 24h), 0 = no limit (default: %d)"), DEFAULT_MAX_UPLOAD_TARGET));
 
 #ifdef ENABLE_WALLET
@@ -413,6 +444,7 @@ std::string HelpMessage(HelpMessageMode mode)
 #if ENABLE_ZMQ
     strUsage += HelpMessageGroup(_("ZeroMQ notification options:"));
     strUsage += HelpMessageOpt("-zmqpubhashblock=<address>", _("Enable publish hash block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubhashinvalidtemplate=<address>", _("Enable publish hash of the previous block of invalid block templates in <address>"));
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
@@ -482,6 +514,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-mempoolreplacement", strprintf(_("Enable transaction replacement in the memory pool (default: %u)"), DEFAULT_ENABLE_REPLACEMENT));
 
     strUsage += HelpMessageGroup(_("Block creation options:"));
+    strUsage += HelpMessageOpt("-asynctemplatecheck", strprintf(_("Return block templates before checking their validity and check them in the background, notifying long polls and ZMQ subscribers of invalid ones (default: %u)"), DEFAULT_ASYNC_TEMPLATE_CHECK));
     strUsage += HelpMessageOpt("-blockmaxweight=<n>", strprintf(_("Set maximum BIP141 block weight (default: %d)"), DEFAULT_BLOCK_MAX_WEIGHT));
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
@@ -584,7 +617,7 @@ void CleanupBlockRevFiles()
     // Remove the rev files immediately and insert the blk file paths into an
     // ordered map keyed by block file index.
     LogPrintf("Removing unusable blk?????.dat and rev?????.dat files for -reindex with -prune\n");
-    boost::filesystem::path blocksdir = GetDataDir() / "blocks";
+    boost::filesystem::path blocksdir = GetBlocksDir();
     for (boost::filesystem::directory_iterator it(blocksdir); it != boost::filesystem::directory_iterator(); it++) {
         if (is_regular_file(*it) &&
             it->path().filename().string().length() == 12 &&
@@ -802,6 +835,7 @@ namespace { // Variables internal to initialization process only
     int nUserMaxConnections;
     int nFD;
     ServiceFlags nLocalServices = NODE_NETWORK;
+    SocketEventsMode socketEventsMode = DEFAULT_SOCKETEVENTS;
 
 }
 
@@ -887,8 +921,41 @@ bool AppInitParameterInteraction()
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-spentindex", DEFAULT_SPENTINDEX))
+            return InitError(_("Prune mode is incompatible with -spentindex."));
+    }
+
+    // parse and validate enabled filter types
+    std::string blockfilterindex_value = GetArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+    if (blockfilterindex_value == "" || blockfilterindex_value == "1") {
+        g_enabled_filter_types.insert(BLOCK_FILTER_BASIC);
+    } else if (blockfilterindex_value != "0") {
+        const std::vector<std::string>& names = mapMultiArgs.at("-blockfilterindex");
+        for (const std::string& name : names) {
+            BlockFilterType filter_type;
+            if (!BlockFilterTypeByName(name, filter_type)) {
+                return InitError(strprintf(_("Unknown -blockfilterindex value %s."), name));
+            }
+            g_enabled_filter_types.insert(filter_type);
+        }
     }
 
+    if (!g_enabled_filter_types.empty() && GetArg("-prune", 0))
+        return InitError(_("Prune mode is incompatible with -blockfilterindex."));
+
+    // Signal NODE_COMPACT_FILTERS if peerblockfilters and basic filters index are both enabled.
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (g_enabled_filter_types.count(BLOCK_FILTER_BASIC) != 1) {
+            return InitError(_("Cannot set -peerblockfilters without -blockfilterindex."));
+        }
+
+        nLocalServices = ServiceFlags(nLocalServices | NODE_COMPACT_FILTERS);
+    }
+
+    // Signal NODE_TXRECON if transactions may be announced through set reconciliation.
+    if (GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION))
+        nLocalServices = ServiceFlags(nLocalServices | NODE_TXRECON);
+
     // Make sure enough file descriptors are available
     int nBind = std::max(
             (mapMultiArgs.count("-bind") ? mapMultiArgs.at("-bind").size() : 0) +
@@ -896,8 +963,13 @@ bool AppInitParameterInteraction()
     nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
+    std::string strSocketEvents = GetArg("-socketevents", GetSocketEventsModeName(DEFAULT_SOCKETEVENTS));
+    if (!ParseSocketEventsMode(strSocketEvents, socketEventsMode))
+        return InitError(strprintf(_("Invalid -socketevents ('%s'), must be one of: %s"), strSocketEvents, GetSupportedSocketEventsModes()));
+
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
+    if (socketEventsMode == SOCKETEVENTS_SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, (int)(FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS - MAX_ADDNODE_CONNECTIONS)), 0);
     nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS + MAX_ADDNODE_CONNECTIONS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -942,6 +1014,7 @@ bool AppInitParameterInteraction()
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fBlockCompression = GetBoolArg("-blockcompression", DEFAULT_BLOCKCOMPRESSION);
 
     hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
     if (!hashAssumeValid.IsNull())
@@ -1027,6 +1100,7 @@ bool AppInitParameterInteraction()
         if (!ParseMoney(GetArg("-blockmintxfee", ""), n))
             return InitError(AmountErrMsg("blockmintxfee", GetArg("-blockmintxfee", "")));
     }
+    fAsyncTemplateCheck = GetBoolArg("-asynctemplatecheck", DEFAULT_ASYNC_TEMPLATE_CHECK);
 
     // Feerate used to define dust.  Shouldn't be changed lightly as old
     // implementations may inadvertently create non-standard transactions
@@ -1194,6 +1268,9 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
     threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
 
+    if (fAsyncTemplateCheck)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "tmplcheck", &ThreadCheckBlockTemplates));
+
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
      * that the server is there and will be ready later).  Warmup mode will
@@ -1378,6 +1455,9 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     fReindex = GetBoolArg("-reindex", false);
     bool fReindexChainState = GetBoolArg("-reindex-chainstate", false);
 
+    if (GetBlocksDir().empty())
+        return InitError(strprintf(_("Specified blocks directory \"%s\" does not exist."), GetArg("-blocksdir", "")));
+
     // Upgrading to 0.8; hard-link the old blknnnn.dat files into /blocks/
     boost::filesystem::path blocksDir = GetDataDir() / "blocks";
     if (!boost::filesystem::exists(blocksDir))
@@ -1410,8 +1490,19 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
     int64_t nBlockTreeDBCache = nTotalCache / 8;
-    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    nBlockTreeDBCache = std::min(nBlockTreeDBCache, nMaxBlockDBCache << 20);
     nTotalCache -= nBlockTreeDBCache;
+    int64_t nTxIndexCache = std::min(nTotalCache / 8, GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxIndexCache << 20 : 0);
+    nTotalCache -= nTxIndexCache;
+    int64_t nSpentIndexCache = std::min(nTotalCache / 8, GetBoolArg("-spentindex", DEFAULT_SPENTINDEX) ? nMaxIndexCache << 20 : 0);
+    nTotalCache -= nSpentIndexCache;
+    int64_t nFilterIndexCache = 0;
+    if (!g_enabled_filter_types.empty()) {
+        size_t nTypes = g_enabled_filter_types.size();
+        nFilterIndexCache = std::min(nTotalCache / 8, nMaxIndexCache << 20);
+        nTotalCache -= nFilterIndexCache;
+        nFilterIndexCache /= nTypes;
+    }
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
     nTotalCache -= nCoinDBCache;
@@ -1419,6 +1510,16 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nMempoolSizeMax = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexCache * (1.0 / 1024 / 1024));
+    }
+    if (GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)) {
+        LogPrintf("* Using %.1fMiB for spent index database\n", nSpentIndexCache * (1.0 / 1024 / 1024));
+    }
+    for (BlockFilterType filter_type : g_enabled_filter_types) {
+        LogPrintf("* Using %.1fMiB for %s block filter index database\n",
+                  nFilterIndexCache * (1.0 / 1024 / 1024), BlockFilterTypeName(filter_type));
+    }
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set (plus up to %.1fMiB of unused mempool space)\n", nCoinCacheUsage * (1.0 / 1024 / 1024), nMempoolSizeMax * (1.0 / 1024 / 1024));
 
@@ -1466,12 +1567,6 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
-                    break;
-                }
-
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1549,6 +1644,22 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    // ********************************************************* Step 7a: start indexers
+    // Indexes are built in the background from the blocks on disk, so they
+    // can be enabled or disabled at any time without reindexing the chain.
+    if (GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
+        g_txindex = std::unique_ptr<TxIndex>(new TxIndex(nTxIndexCache, false, fReindex));
+        g_txindex->Start();
+    }
+    if (GetBoolArg("-spentindex", DEFAULT_SPENTINDEX)) {
+        g_spentindex = std::unique_ptr<SpentIndex>(new SpentIndex(nSpentIndexCache, false, fReindex));
+        g_spentindex->Start();
+    }
+    for (BlockFilterType filter_type : g_enabled_filter_types) {
+        InitBlockFilterIndex(filter_type, nFilterIndexCache, false, fReindex);
+        GetBlockFilterIndex(filter_type)->Start();
+    }
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1651,10 +1762,20 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     connOptions.nMaxOutboundTimeframe = nMaxOutboundTimeframe;
     connOptions.nMaxOutboundLimit = nMaxOutboundLimit;
+    connOptions.socketEventsMode = socketEventsMode;
+
+    // -msghandlerthreads=0 means autodetect, like -par
+    connOptions.nMsgHandlerThreads = GetMsgHandlerThreads(GetArg("-msghandlerthreads", DEFAULT_MSGHANDLER_THREADS));
+    LogPrintf("Using %u threads for message handling\n", connOptions.nMsgHandlerThreads);
 
     if (!connman.Start(scheduler, strNodeError, connOptions))
         return InitError(strNodeError);
 
+    // With parallel script verification, also check the scripts of loose
+    // transactions from peers in parallel, outside of cs_main
+    for (int i = 0; i < nScriptCheckThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "txverify", boost::function<void()>(boost::bind(&ThreadTxVerify, &connman))));
+
     // ********************************************************* Step 12: finished
 
     SetRPCWarmupFinished();
@@ -27,6 +27,7 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -47,6 +48,18 @@ uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 uint64_t nLastBlockWeight = 0;
 
+bool fAsyncTemplateCheck = DEFAULT_ASYNC_TEMPLATE_CHECK;
+std::atomic<unsigned int> nBlockTemplatesInvalidated(0);
+
+// Latest block template waiting for ThreadCheckBlockTemplates
+static boost::mutex csTemplateCheck;
+static boost::condition_variable condTemplateCheck;
+static CBlock blockTemplateCheck;
+static bool fTemplateCheckPending = false;
+// Set when a template failed the asynchronous check; CreateNewBlock then
+// checks synchronously until a template passes again.
+static std::atomic<bool> fTemplateCheckFailed(false);
+
 class ScoreCompare
 {
 public:
@@ -74,7 +87,7 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 }
 
 BlockAssembler::BlockAssembler(const CChainParams& _chainparams)
-    : chainparams(_chainparams)
+    : chainparams(_chainparams), fMempoolIncluded(false)
 {
     // Block resource limits
     // If neither -blockmaxsize or -blockmaxweight is given, limit to DEFAULT_BLOCK_MAX_*
@@ -182,18 +195,11 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     nLastBlockTx = nBlockTx;
     nLastBlockSize = nBlockSize;
     nLastBlockWeight = nBlockWeight;
+    fMempoolIncluded = (nBlockTx == mempool.mapTx.size());
 
     // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
+    coinbaseScript = scriptPubKeyIn;
+    CreateCoinbase(pindexPrev);
 
     uint64_t nSerializeSize = GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
     LogPrintf("CreateNewBlock(): total size: %u block weight: %u txs: %u fees: %ld sigops %d\n", nSerializeSize, GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
@@ -204,11 +210,14 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
 
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
-
-    CValidationState state;
-    if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
-        throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+    if (fAsyncTemplateCheck && !fTemplateCheckFailed) {
+        QueueBlockTemplateCheck(*pblock);
+    } else {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+            throw std::runtime_error(strprintf("%s: TestBlockValidity failed: %s", __func__, FormatStateMessage(state)));
+        }
+        fTemplateCheckFailed = false;
     }
     int64_t nTime2 = GetTimeMicros();
 
@@ -217,6 +226,188 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     return std::move(pblocktemplate);
 }
 
+void BlockAssembler::CreateCoinbase(const CBlockIndex* pindexPrev)
+{
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = coinbaseScript;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+    pblocktemplate->vTxFees[0] = -nFees;
+    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
+}
+
+bool BlockAssembler::UpdateNewBlock(std::unique_ptr<CBlockTemplate>& ptemplate, const std::vector<uint256>& vNewTx)
+{
+    LOCK2(cs_main, mempool.cs);
+    if (!ptemplate || !fMempoolIncluded)
+        return false;
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    if (ptemplate->block.hashPrevBlock != pindexPrev->GetBlockHash())
+        return false;
+
+    // Check all transactions before touching the template. The new
+    // transactions arrived in an order in which parents precede children.
+    std::vector<CTxMemPool::txiter> vEntries;
+    CTxMemPool::setEntries setNew;
+    uint64_t nNewWeight = nBlockWeight;
+    uint64_t nNewSize = nBlockSize;
+    int64_t nNewSigOpsCost = nBlockSigOpsCost;
+    BOOST_FOREACH(const uint256& hash, vNewTx) {
+        CTxMemPool::txiter it = mempool.mapTx.find(hash);
+        if (it == mempool.mapTx.end())
+            return false;
+        BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(it)) {
+            if (!inBlock.count(parent) && !setNew.count(parent))
+                return false;
+        }
+        // All parents are in the block by now, so the package is just this
+        // transaction; apply the same fee filter as addPackageTxs.
+        if (it->GetModifiedFee() < blockMinFeeRate.GetFee(it->GetTxSize()))
+            return false;
+        CTxMemPool::setEntries package;
+        package.insert(it);
+        if (!TestPackageTransactions(package))
+            return false;
+        nNewWeight += WITNESS_SCALE_FACTOR * it->GetTxSize();
+        nNewSigOpsCost += it->GetSigOpCost();
+        if (nNewWeight >= nBlockMaxWeight || nNewSigOpsCost >= MAX_BLOCK_SIGOPS_COST)
+            return false;
+        if (fNeedSizeAccounting) {
+            nNewSize += ::GetSerializeSize(it->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
+            if (nNewSize >= nBlockMaxSize)
+                return false;
+        }
+        vEntries.push_back(it);
+        setNew.insert(it);
+    }
+
+    pblocktemplate = std::move(ptemplate);
+    pblock = &pblocktemplate->block;
+    BOOST_FOREACH(CTxMemPool::txiter it, vEntries)
+        AddToBlock(it);
+    CreateCoinbase(pindexPrev);
+    ptemplate = std::move(pblocktemplate);
+    if (fAsyncTemplateCheck && !fTemplateCheckFailed) {
+        QueueBlockTemplateCheck(ptemplate->block);
+    } else {
+        CValidationState state;
+        if (!TestBlockValidity(state, chainparams, ptemplate->block, pindexPrev, false, false)) {
+            LogPrintf("%s: TestBlockValidity failed: %s\n", __func__, FormatStateMessage(state));
+            // The template was already modified, make sure it is rebuilt
+            ptemplate.reset();
+            return false;
+        }
+        fTemplateCheckFailed = false;
+    }
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    nLastBlockWeight = nBlockWeight;
+    return true;
+}
+
+BlockTemplateCache::BlockTemplateCache(const CChainParams& _chainparams)
+    : chainparams(_chainparams), assembler(_chainparams), pindexPrev(NULL), fSupportsSegwit(true), nTransactionsUpdated(0), nTimeBuilt(0), nInvalidated(0)
+{
+    connEntryAdded = mempool.NotifyEntryAdded.connect(boost::bind(&BlockTemplateCache::TransactionAddedToMempool, this, _1));
+}
+
+void BlockTemplateCache::TransactionAddedToMempool(CTransactionRef tx)
+{
+    LOCK(cs_added);
+    vAdded.push_back(tx->GetHash());
+}
+
+std::unique_ptr<CBlockTemplate> BlockTemplateCache::Get(bool fSupportsSegwitIn, unsigned int& nTransactionsUpdatedOut)
+{
+    AssertLockHeld(cs_main);
+    LOCK(mempool.cs);
+
+    std::vector<uint256> vNewTx;
+    {
+        LOCK(cs_added);
+        vNewTx.swap(vAdded);
+    }
+
+    unsigned int nTransactionsUpdatedNow = mempool.GetTransactionsUpdated();
+    unsigned int nInvalidatedNow = nBlockTemplatesInvalidated;
+    bool fRebuild = !pblocktemplate || pindexPrev != chainActive.Tip() || fSupportsSegwit != fSupportsSegwitIn || nInvalidated != nInvalidatedNow;
+    if (!fRebuild && nTransactionsUpdatedNow != nTransactionsUpdated) {
+        // Additions are the only changes if the counter moved by exactly
+        // their number; anything else (removals, fee deltas) needs a rebuild.
+        if (nTransactionsUpdated + vNewTx.size() == nTransactionsUpdatedNow && assembler.UpdateNewBlock(pblocktemplate, vNewTx)) {
+            nTransactionsUpdated = nTransactionsUpdatedNow;
+        } else if (!pblocktemplate || GetTime() - nTimeBuilt > BLOCK_TEMPLATE_REBUILD_INTERVAL) {
+            fRebuild = true;
+        }
+    }
+
+    if (fRebuild) {
+        // Clear pindexPrev so the next call makes a new block, despite any failures from here on
+        pindexPrev = NULL;
+        nTransactionsUpdated = nTransactionsUpdatedNow;
+        nTimeBuilt = GetTime();
+        nInvalidated = nInvalidatedNow;
+        fSupportsSegwit = fSupportsSegwitIn;
+
+        CScript scriptDummy = CScript() << OP_TRUE;
+        pblocktemplate = assembler.CreateNewBlock(scriptDummy, fSupportsSegwit);
+        if (!pblocktemplate)
+            return nullptr;
+        pindexPrev = chainActive.Tip();
+    }
+
+    nTransactionsUpdatedOut = nTransactionsUpdated;
+    return std::unique_ptr<CBlockTemplate>(new CBlockTemplate(*pblocktemplate));
+}
+
+void QueueBlockTemplateCheck(const CBlock& block)
+{
+    boost::unique_lock<boost::mutex> lock(csTemplateCheck);
+    blockTemplateCheck = block;
+    fTemplateCheckPending = true;
+    condTemplateCheck.notify_one();
+}
+
+void ThreadCheckBlockTemplates()
+{
+    while (true) {
+        CBlock block;
+        {
+            boost::unique_lock<boost::mutex> lock(csTemplateCheck);
+            while (!fTemplateCheckPending)
+                condTemplateCheck.wait(lock);
+            std::swap(block, blockTemplateCheck);
+            fTemplateCheckPending = false;
+        }
+
+        CValidationState state;
+        {
+            LOCK(cs_main);
+            CBlockIndex* pindexPrev = chainActive.Tip();
+            // Templates on an old tip are replaced anyway
+            if (block.hashPrevBlock != pindexPrev->GetBlockHash())
+                continue;
+            if (TestBlockValidity(state, Params(), block, pindexPrev, false, false))
+                continue;
+        }
+
+        LogPrintf("%s: block template on %s is invalid: %s\n", __func__, block.hashPrevBlock.ToString(), FormatStateMessage(state));
+        fTemplateCheckFailed = true;
+        ++nBlockTemplatesInvalidated;
+        GetMainSignals().BlockTemplateInvalid(block, state);
+        {
+            boost::unique_lock<boost::mutex> lock(csBestBlock);
+            cvBlockChange.notify_all();
+        }
+    }
+}
+
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
     BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
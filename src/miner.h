@@ -7,8 +7,11 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "script/script.h"
+#include "sync.h"
 #include "txmempool.h"
 
+#include <atomic>
 #include <stdint.h>
 #include <memory>
 #include "boost/multi_index_container.hpp"
@@ -23,6 +26,15 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Minimum time between rebuilds of the cached block template for mempool changes that can not be applied in place (seconds) */
+static const int64_t BLOCK_TEMPLATE_REBUILD_INTERVAL = 5;
+/** Default for -asynctemplatecheck */
+static const bool DEFAULT_ASYNC_TEMPLATE_CHECK = false;
+
+/** Whether CreateNewBlock leaves TestBlockValidity to ThreadCheckBlockTemplates */
+extern bool fAsyncTemplateCheck;
+/** Number of block templates ThreadCheckBlockTemplates found to be invalid */
+extern std::atomic<unsigned int> nBlockTemplatesInvalidated;
 
 struct CBlockTemplate
 {
@@ -162,10 +174,22 @@ private:
     int lastFewTxs;
     bool blockFinished;
 
+    // State kept for UpdateNewBlock
+    CScript coinbaseScript;
+    bool fMempoolIncluded;
+
 public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+    /** Add the given transactions, which entered the mempool since the template
+      * was returned by the last CreateNewBlock call on this assembler, to it in
+      * place. This is only done while the template includes the whole mempool,
+      * and each transaction passes the limits CreateNewBlock applies. Returns
+      * false if the template has to be rebuilt instead: it is left untouched
+      * when a transaction does not fit, and discarded (ptemplate reset) when
+      * the updated block fails TestBlockValidity. */
+    bool UpdateNewBlock(std::unique_ptr<CBlockTemplate>& ptemplate, const std::vector<uint256>& vNewTx);
 
 private:
     // utility functions
@@ -173,6 +197,8 @@ private:
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    /** Create the coinbase transaction paying the fees collected so far */
+    void CreateCoinbase(const CBlockIndex* pindexPrev);
 
     // Methods for how to add transactions to a block.
     /** Add transactions based on tx "priority" */
@@ -209,6 +235,48 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Long-lived block template for getblocktemplate. Transactions entering the
+ * mempool are added to the template in place while it includes the whole
+ * mempool; other mempool changes cause a rebuild at most every
+ * BLOCK_TEMPLATE_REBUILD_INTERVAL seconds, and a new tip always does.
+ */
+class BlockTemplateCache
+{
+private:
+    const CChainParams& chainparams;
+    BlockAssembler assembler;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    bool fSupportsSegwit;
+    //! Value of mempool.GetTransactionsUpdated() the template reflects
+    unsigned int nTransactionsUpdated;
+    int64_t nTimeBuilt;
+    //! Value of nBlockTemplatesInvalidated when the template was built
+    unsigned int nInvalidated;
+
+    CCriticalSection cs_added;
+    //! Transactions that entered the mempool since the template was built or updated
+    std::vector<uint256> vAdded;
+    boost::signals2::scoped_connection connEntryAdded;
+
+    void TransactionAddedToMempool(CTransactionRef tx);
+
+public:
+    BlockTemplateCache(const CChainParams& chainparams);
+
+    /** Return a copy of the up to date template on the current tip, and the
+      * mempool update counter it reflects. Requires cs_main. */
+    std::unique_ptr<CBlockTemplate> Get(bool fSupportsSegwit, unsigned int& nTransactionsUpdatedOut);
+};
+
+/** Queue a block template for ThreadCheckBlockTemplates, replacing any not yet checked one */
+void QueueBlockTemplateCheck(const CBlock& block);
+/** Run TestBlockValidity on queued block templates. Invalid ones are
+  * announced through the BlockTemplateInvalid signal and wake up
+  * getblocktemplate long polls. */
+void ThreadCheckBlockTemplates();
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
@@ -38,6 +38,10 @@
 
 #include <math.h>
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 // Dump addresses to peers.dat and banlist.dat every 15 minutes (900s)
 #define DUMP_ADDRESSES_INTERVAL 900
 
@@ -61,6 +65,24 @@
 
 const static std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
+/** Longest time the socket handler waits for socket events, which is also how
+ *  often it gets around to disconnecting peers and checking for timeouts */
+static const int SELECT_TIMEOUT_MILLISECONDS = 50;
+/** Most socket events taken from epoll in one go; the rest wait for the next round */
+static const int MAX_EPOLL_EVENTS = 1024;
+/** Most buffers handed to one send call, two for each message */
+#ifdef WIN32
+static const int MAX_SEND_BUFFERS = 1;
+#else
+static const int MAX_SEND_BUFFERS = 64;
+#endif
+/** Smallest message payload received into a pooled buffer */
+static const unsigned int MIN_POOLED_RECV_BUFFER_SIZE = 64 * 1024;
+/** Largest payload buffer kept for reuse; bigger ones are freed */
+static const unsigned int MAX_POOLED_RECV_BUFFER_SIZE = 1024 * 1024;
+/** Most payload buffers kept for reuse */
+static const size_t MAX_RECV_BUFFER_POOL = 8;
+
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
 //
@@ -80,6 +102,82 @@ limitedmap<uint256, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
 static CNodeSignals g_signals;
 CNodeSignals& GetNodeSignals() { return g_signals; }
 
+// Payload buffers of large received messages, reused by later ones so that
+// blocks don't need a fresh allocation (zeroed again on free) each
+static CCriticalSection cs_recvBufferPool;
+static std::vector<CSerializeData> vRecvBufferPool;
+
+static void TakeRecvBuffer(CSerializeData& vch)
+{
+    LOCK(cs_recvBufferPool);
+    if (!vRecvBufferPool.empty()) {
+        vch.swap(vRecvBufferPool.back());
+        vRecvBufferPool.pop_back();
+    }
+}
+
+static void ReleaseRecvBuffer(CSerializeData& vch)
+{
+    if (vch.capacity() < MIN_POOLED_RECV_BUFFER_SIZE || vch.capacity() > MAX_POOLED_RECV_BUFFER_SIZE)
+        return;
+    vch.clear();
+    LOCK(cs_recvBufferPool);
+    if (vRecvBufferPool.size() < MAX_RECV_BUFFER_POOL) {
+        vRecvBufferPool.emplace_back();
+        vRecvBufferPool.back().swap(vch);
+    }
+}
+
+bool ParseSocketEventsMode(const std::string& str, SocketEventsMode& mode)
+{
+    if (str == "select") {
+        mode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef USE_POLL
+    if (str == "poll") {
+        mode = SOCKETEVENTS_POLL;
+        return true;
+    }
+#endif
+#ifdef USE_EPOLL
+    if (str == "epoll") {
+        mode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string GetSocketEventsModeName(SocketEventsMode mode)
+{
+    switch (mode) {
+    case SOCKETEVENTS_SELECT: return "select";
+    case SOCKETEVENTS_POLL: return "poll";
+    case SOCKETEVENTS_EPOLL: return "epoll";
+    }
+    return "";
+}
+
+int GetMsgHandlerThreads(int nThreads)
+{
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    return std::max(1, std::min(nThreads, MAX_MSGHANDLER_THREADS));
+}
+
+std::string GetSupportedSocketEventsModes()
+{
+    std::string strModes = "select";
+#ifdef USE_POLL
+    strModes += ", poll";
+#endif
+#ifdef USE_EPOLL
+    strModes += ", epoll";
+#endif
+    return strModes;
+}
+
 void CConnman::AddOneShot(const std::string& strDest)
 {
     LOCK(cs_vOneShots);
@@ -361,7 +459,7 @@ CNode* CConnman::ConnectNode(CAddress addrConnect, const char *pszDest, bool fCo
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -691,7 +789,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
         // get current incomplete message, or create a new one
         if (vRecvMsg.empty() ||
             vRecvMsg.back().complete())
-            vRecvMsg.push_back(CNetMessage(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION));
+            vRecvMsg.emplace_back(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
 
         CNetMessage& msg = vRecvMsg.back();
 
@@ -731,6 +829,14 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+char* CNode::GetRecvPayloadBuffer(unsigned int nMinSize, unsigned int& nSize)
+{
+    LOCK(cs_vRecv);
+    if (vRecvMsg.empty() || !vRecvMsg.back().in_data || vRecvMsg.back().complete())
+        return NULL;
+    return vRecvMsg.back().GetDataBuffer(nMinSize, nSize);
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -789,23 +895,52 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+CNetMessage::~CNetMessage()
+{
+    CSerializeData vch;
+    vRecv.swap(vch);
+    ReleaseRecvBuffer(vch);
+}
+
+void CNetMessage::AllocateData(unsigned int nEnd)
+{
+    if (vRecv.empty() && hdr.nMessageSize >= MIN_POOLED_RECV_BUFFER_SIZE) {
+        // Large payloads start out in a pooled buffer
+        CSerializeData vch;
+        TakeRecvBuffer(vch);
+        vRecv.swap(vch);
+    }
+    if (vRecv.size() < nEnd) {
+        // Allocate up to 256 KiB ahead, but never more than the total message size.
+        vRecv.resize(std::min(hdr.nMessageSize, nEnd + 256 * 1024));
+    }
+}
+
 int CNetMessage::readData(const char *pch, unsigned int nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
+    AllocateData(nDataPos + nCopy);
 
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Bytes received through GetDataBuffer are already in place
+    if (pch != &vRecv[nDataPos])
+        memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+char* CNetMessage::GetDataBuffer(unsigned int nMinSize, unsigned int& nSize)
+{
+    if (hdr.nMessageSize - nDataPos < std::max(nMinSize, 1u))
+        return NULL;
+    AllocateData(nDataPos + std::max(nMinSize, 1u));
+    nSize = vRecv.size() - nDataPos;
+    return &vRecv[nDataPos];
+}
+
 const uint256& CNetMessage::GetMessageHash() const
 {
     assert(complete());
@@ -822,6 +957,26 @@ const uint256& CNetMessage::GetMessageHash() const
 
 
 
+/** Send the buffers in order, in one call where the platform allows it */
+static int SendBuffers(SOCKET hSocket, const char* const* vpch, const size_t* vSize, int nBuffers)
+{
+#ifdef WIN32
+    assert(nBuffers == 1);
+    return send(hSocket, vpch[0], vSize[0], MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    struct iovec iov[MAX_SEND_BUFFERS];
+    for (int i = 0; i < nBuffers; i++) {
+        iov[i].iov_base = const_cast<char*>(vpch[i]);
+        iov[i].iov_len = vSize[i];
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nBuffers;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+
 // requires LOCK(cs_vSend)
 size_t CConnman::SocketSendData(CNode *pnode) const
 {
@@ -829,27 +984,59 @@ size_t CConnman::SocketSendData(CNode *pnode) const
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        // Offer as many queued messages as fit in one send, as their headers
+        // and payloads, from where the last send stopped
+        const char* vpch[MAX_SEND_BUFFERS];
+        size_t vSize[MAX_SEND_BUFFERS];
+        int nBuffers = 0;
+        size_t nOffered = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (auto jt = it; jt != pnode->vSendMsg.end() && nBuffers < MAX_SEND_BUFFERS; ++jt) {
+            assert(jt->size() > nOffset);
+            if (nOffset < CMessageHeader::HEADER_SIZE) {
+                vpch[nBuffers] = reinterpret_cast<const char*>(jt->header) + nOffset;
+                vSize[nBuffers++] = CMessageHeader::HEADER_SIZE - nOffset;
+                nOffset = 0;
+            } else {
+                nOffset -= CMessageHeader::HEADER_SIZE;
+            }
+            const std::vector<unsigned char>& payload = jt->payload();
+            if (nBuffers < MAX_SEND_BUFFERS && payload.size() > nOffset) {
+                vpch[nBuffers] = reinterpret_cast<const char*>(payload.data()) + nOffset;
+                vSize[nBuffers++] = payload.size() - nOffset;
+            }
+            nOffset = 0;
+        }
+        for (int i = 0; i < nBuffers; i++)
+            nOffered += vSize[i];
+
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            nBytes = SendBuffers(pnode->hSocket, vpch, vSize, nBuffers);
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            // Drop the messages that are now sent in full
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                size_t nRest = it->size() - pnode->nSendOffset;
+                if (nLeft < nRest) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRest;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= it->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nOffered) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -1055,7 +1242,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (socketEventsMode == SOCKETEVENTS_SELECT && !IsSelectableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1104,6 +1291,236 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+bool CConnman::GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        recv_set.insert(hListenSocket.socket);
+    }
+
+    bool fRecvPending = false;
+    LOCK(cs_vNodes);
+    BOOST_FOREACH(CNode* pnode, vNodes)
+    {
+        // Implement the following logic:
+        // * If there is data to send, select() for sending data. As this only
+        //   happens when optimistic write failed, we choose to first drain the
+        //   write buffer in this case before receiving more. This avoids
+        //   needlessly queueing received data, if the remote peer is not themselves
+        //   receiving data. This means properly utilizing TCP flow control signalling.
+        // * Otherwise, if there is space left in the receive buffer, select() for
+        //   receiving data.
+        // * Hand off all complete messages to the processor, to be handled without
+        //   blocking here.
+
+        bool select_recv = !pnode->fPauseRecv;
+        bool select_send;
+        {
+            LOCK(pnode->cs_vSend);
+            select_send = !pnode->vSendMsg.empty();
+        }
+        pnode->fSendInterest = select_send;
+
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+
+        error_set.insert(pnode->hSocket);
+        if (select_send) {
+            send_set.insert(pnode->hSocket);
+            continue;
+        }
+        if (select_recv) {
+            recv_set.insert(pnode->hSocket);
+            fRecvPending |= pnode->fRecvReady;
+        }
+    }
+
+    return fRecvPending;
+}
+
+void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+#ifdef USE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL)
+        return SocketEventsEpoll(recv_set, send_set, error_set);
+#endif
+#ifdef USE_POLL
+    if (socketEventsMode == SOCKETEVENTS_POLL)
+        return SocketEventsPoll(recv_set, send_set, error_set);
+#endif
+    SocketEventsSelect(recv_set, send_set, error_set);
+}
+
+void CConnman::SocketEventsSelect(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    bool fRecvPending = GenerateSelectSet(recv_select_set, send_select_set, error_select_set);
+
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = fRecvPending ? 0 : SELECT_TIMEOUT_MILLISECONDS * 1000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+
+    BOOST_FOREACH(SOCKET hSocket, recv_select_set) {
+        FD_SET(hSocket, &fdsetRecv);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, send_select_set) {
+        FD_SET(hSocket, &fdsetSend);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, error_select_set) {
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = std::max(hSocketMax, hSocket);
+    }
+    bool have_fds = !recv_select_set.empty() || !error_select_set.empty();
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    if (interruptNet)
+        return;
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            recv_set = recv_select_set;
+        }
+        interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        return;
+    }
+
+    BOOST_FOREACH(SOCKET hSocket, recv_select_set) {
+        if (FD_ISSET(hSocket, &fdsetRecv))
+            recv_set.insert(hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, send_select_set) {
+        if (FD_ISSET(hSocket, &fdsetSend))
+            send_set.insert(hSocket);
+    }
+    BOOST_FOREACH(SOCKET hSocket, error_select_set) {
+        if (FD_ISSET(hSocket, &fdsetError))
+            error_set.insert(hSocket);
+    }
+}
+
+#ifdef USE_POLL
+void CConnman::SocketEventsPoll(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    std::set<SOCKET> recv_select_set, send_select_set, error_select_set;
+    bool fRecvPending = GenerateSelectSet(recv_select_set, send_select_set, error_select_set);
+
+    std::map<SOCKET, struct pollfd> pollfds;
+    BOOST_FOREACH(SOCKET hSocket, recv_select_set) {
+        pollfds[hSocket].fd = hSocket;
+        pollfds[hSocket].events |= POLLIN;
+    }
+    BOOST_FOREACH(SOCKET hSocket, send_select_set) {
+        pollfds[hSocket].fd = hSocket;
+        pollfds[hSocket].events |= POLLOUT;
+    }
+    BOOST_FOREACH(SOCKET hSocket, error_select_set) {
+        // POLLERR and POLLHUP are always reported
+        pollfds[hSocket].fd = hSocket;
+    }
+
+    std::vector<struct pollfd> vpollfds;
+    vpollfds.reserve(pollfds.size());
+    for (std::map<SOCKET, struct pollfd>::const_iterator it = pollfds.begin(); it != pollfds.end(); ++it)
+        vpollfds.push_back(it->second);
+
+    if (poll(vpollfds.data(), vpollfds.size(), fRecvPending ? 0 : SELECT_TIMEOUT_MILLISECONDS) < 0) {
+        if (errno != EINTR) {
+            LogPrintf("socket poll error %s\n", NetworkErrorString(errno));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+    if (interruptNet)
+        return;
+
+    BOOST_FOREACH(const struct pollfd& pollfd, vpollfds) {
+        if (pollfd.revents & POLLIN)
+            recv_set.insert(pollfd.fd);
+        if (pollfd.revents & POLLOUT)
+            send_set.insert(pollfd.fd);
+        if (pollfd.revents & (POLLERR | POLLHUP))
+            error_set.insert(pollfd.fd);
+    }
+}
+#endif
+
+#ifdef USE_EPOLL
+void CConnman::SocketEventsEpoll(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set)
+{
+    // Sockets stay registered until they are closed. Reads are edge-triggered,
+    // so a node is only reported readable when new data arrives and is then
+    // read until it would block. Write interest is only added while there is
+    // data left to send, and taken away again once it is sent.
+    bool fRecvPending = false;
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
+            bool select_send;
+            {
+                LOCK(pnode->cs_vSend);
+                select_send = !pnode->vSendMsg.empty();
+            }
+            pnode->fSendInterest = select_send;
+            if (pnode->fRecvReady && !select_send && !pnode->fPauseRecv)
+                fRecvPending = true;
+
+            LOCK(pnode->cs_hSocket);
+            if (pnode->hSocket == INVALID_SOCKET)
+                continue;
+
+            uint32_t nEvents = EPOLLIN | EPOLLRDHUP | EPOLLET | (select_send ? EPOLLOUT : 0);
+            if (nEvents == pnode->nEpollEvents)
+                continue;
+            struct epoll_event event = {};
+            event.events = nEvents;
+            event.data.fd = pnode->hSocket;
+            if (epoll_ctl(epollfd, pnode->nEpollEvents ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, pnode->hSocket, &event) == 0) {
+                pnode->nEpollEvents = nEvents;
+            } else {
+                LogPrintf("epoll_ctl failed for peer=%d: %s\n", pnode->id, NetworkErrorString(errno));
+                pnode->fDisconnect = true;
+            }
+        }
+    }
+
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, fRecvPending ? 0 : SELECT_TIMEOUT_MILLISECONDS);
+    if (nEvents < 0) {
+        if (errno != EINTR) {
+            LogPrintf("socket epoll error %s\n", NetworkErrorString(errno));
+            interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+        }
+        return;
+    }
+
+    for (int i = 0; i < nEvents; i++) {
+        SOCKET hSocket = events[i].data.fd;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+            recv_set.insert(hSocket);
+        if (events[i].events & EPOLLOUT)
+            send_set.insert(hSocket);
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            error_set.insert(hSocket);
+    }
+}
+#endif
+
 void CConnman::ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
@@ -1170,94 +1587,17 @@ void CConnman::ThreadSocketHandler()
                 clientInterface->NotifyNumConnectionsChanged(nPrevNodeCount);
         }
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is space left in the receive buffer, select() for
-                //   receiving data.
-                // * Hand off all complete messages to the processor, to be handled without
-                //   blocking here.
-
-                bool select_recv = !pnode->fPauseRecv;
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
-
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
-                }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        std::set<SOCKET> recv_set, send_set, error_set;
+        SocketEvents(recv_set, send_set, error_set);
         if (interruptNet)
             return;
 
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            if (!interruptNet.sleep_for(std::chrono::milliseconds(timeout.tv_usec/1000)))
-                return;
-        }
-
         //
         // Accept new connections
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && recv_set.count(hListenSocket.socket) > 0)
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1288,27 +1628,42 @@ void CConnman::ThreadSocketHandler()
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
+                recvSet = recv_set.count(pnode->hSocket) > 0;
+                sendSet = send_set.count(pnode->hSocket) > 0;
+                errorSet = error_set.count(pnode->hSocket) > 0;
             }
+            // Remember readiness until the socket has been read dry, as epoll
+            // only reports new data once. Reading waits, as when selecting,
+            // until pending data has been sent and the process queue has room.
             if (recvSet || errorSet)
+                pnode->fRecvReady = true;
+            if (errorSet || (pnode->fRecvReady && !pnode->fSendInterest && !pnode->fPauseRecv))
             {
                 {
                     {
                         // typical socket buffer is 8K-64K
                         char pchBuf[0x10000];
+                        // Large payloads are received straight into their message
+                        unsigned int nBufSize = 0;
+                        char* pchRecv = pnode->GetRecvPayloadBuffer(sizeof(pchBuf), nBufSize);
+                        if (pchRecv == NULL) {
+                            pchRecv = pchBuf;
+                            nBufSize = sizeof(pchBuf);
+                        }
                         int nBytes = 0;
                         {
                             LOCK(pnode->cs_hSocket);
                             if (pnode->hSocket == INVALID_SOCKET)
                                 continue;
-                            nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                            nBytes = recv(pnode->hSocket, pchRecv, nBufSize, MSG_DONTWAIT);
                         }
+                        // Unless the buffer was filled, the socket has been read dry
+                        if (nBytes < (int)nBufSize)
+                            pnode->fRecvReady = false;
                         if (nBytes > 0)
                         {
                             bool notify = false;
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
+                            if (!pnode->ReceiveMsgBytes(pchRecv, nBytes, notify))
                                 pnode->CloseSocketDisconnect();
                             RecordBytesRecv(nBytes);
                             if (notify) {
@@ -1969,7 +2324,7 @@ bool CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
     return true;
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread)
 {
     while (!flagInterruptMsgProc)
     {
@@ -1984,22 +2339,34 @@ void CConnman::ThreadMessageHandler()
 
         bool fMoreWork = false;
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        // A peer is handled by one thread at a time, which keeps its messages
+        // in order. Threads start their pass at different peers so that they
+        // don't all queue up behind the first one.
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[(i + nThread) % vNodesCopy.size()];
             if (pnode->fDisconnect)
                 continue;
 
+            bool fClaimed = false;
+            if (!pnode->fMsgProcClaimed.compare_exchange_strong(fClaimed, true))
+                continue;
+
+            CorkSend(pnode, true);
+
             // Receive messages
             bool fMoreNodeWork = GetNodeSignals().ProcessMessages(pnode, *this, flagInterruptMsgProc);
             fMoreWork |= (fMoreNodeWork && !pnode->fPauseSend);
-            if (flagInterruptMsgProc)
-                return;
 
             // Send messages
-            {
+            if (!flagInterruptMsgProc) {
                 LOCK(pnode->cs_sendProcessing);
                 GetNodeSignals().SendMessages(pnode, *this, flagInterruptMsgProc);
             }
+
+            // Send what was queued above in as few calls as possible
+            CorkSend(pnode, false);
+            pnode->fMsgProcClaimed = false;
             if (flagInterruptMsgProc)
                 return;
         }
@@ -2209,6 +2576,11 @@ CConnman::CConnman(uint64_t nSeed0In, uint64_t nSeed1In) : nSeed0(nSeed0In), nSe
     nBestHeight = 0;
     clientInterface = NULL;
     flagInterruptMsgProc = false;
+    socketEventsMode = DEFAULT_SOCKETEVENTS;
+    nMsgHandlerThreads = DEFAULT_MSGHANDLER_THREADS;
+#ifdef USE_EPOLL
+    epollfd = -1;
+#endif
 }
 
 NodeId CConnman::GetNewNodeId()
@@ -2236,6 +2608,30 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
     nMaxOutboundLimit = connOptions.nMaxOutboundLimit;
     nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
 
+    nMsgHandlerThreads = std::max(1, std::min(connOptions.nMsgHandlerThreads, MAX_MSGHANDLER_THREADS));
+
+    socketEventsMode = connOptions.socketEventsMode;
+    LogPrintf("Using %s for socket events\n", GetSocketEventsModeName(socketEventsMode));
+#ifdef USE_EPOLL
+    if (socketEventsMode == SOCKETEVENTS_EPOLL) {
+        epollfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epollfd == -1) {
+            strNodeError = strprintf(_("Failed to create epoll instance: %s"), NetworkErrorString(errno));
+            return false;
+        }
+        // Listening sockets are level-triggered, one connection being accepted per round
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+            struct epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.fd = hListenSocket.socket;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+                strNodeError = strprintf(_("Failed to register listening socket with epoll: %s"), NetworkErrorString(errno));
+                return false;
+            }
+        }
+    }
+#endif
+
     SetBestHeight(connOptions.nBestHeight);
 
     clientInterface = connOptions.uiInterface;
@@ -2313,7 +2709,8 @@ bool CConnman::Start(CScheduler& scheduler, std::string& strNodeError, Options c
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMsgHandlerThreads; i++)
+        threadMessageHandlers.push_back(std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i))));
 
     // Dump network addresses
     scheduler.scheduleEvery(boost::bind(&CConnman::DumpData, this), DUMP_ADDRESSES_INTERVAL);
@@ -2362,8 +2759,11 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    BOOST_FOREACH(std::thread& thread, threadMessageHandlers) {
+        if (thread.joinable())
+            thread.join();
+    }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2397,6 +2797,12 @@ void CConnman::Stop()
     vNodes.clear();
     vNodesDisconnected.clear();
     vhListenSocket.clear();
+#ifdef USE_EPOLL
+    if (epollfd != -1) {
+        close(epollfd);
+        epollfd = -1;
+    }
+#endif
     delete semOutbound;
     semOutbound = NULL;
     delete semAddnode;
@@ -2681,6 +3087,8 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
+    fSendCorked = false;
+    fCorkedSend = false;
     hashContinue = uint256();
     nStartingHeight = -1;
     filterInventoryKnown.reset();
@@ -2703,8 +3111,12 @@ CNode::CNode(NodeId idIn, ServiceFlags nLocalServicesIn, int nMyStartingHeightIn
     minFeeFilter = 0;
     lastSentFeeFilter = 0;
     nextSendTimeFeeFilter = 0;
+    fMsgProcClaimed = false;
     fPauseRecv = false;
     fPauseSend = false;
+    fRecvReady = false;
+    fSendInterest = false;
+    nEpollEvents = 0;
     nProcessQueueSize = 0;
 
     BOOST_FOREACH(const std::string &msg, getAllNetMessageTypes())
@@ -2766,17 +3178,18 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
 
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    size_t nMessageSize = msg.shared ? msg.shared->data.size() : msg.data.size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint("net", "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->id);
 
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
+    CSendMsg sendMsg;
+    // A shared payload comes with its hash
+    uint256 hash = msg.shared ? msg.shared->hash : Hash(msg.data.data(), msg.data.data() + nMessageSize);
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
-
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    hdr.Write(sendMsg.header);
+    sendMsg.data = std::move(msg.data);
+    sendMsg.shared = std::move(msg.shared);
 
     size_t nBytesSent = 0;
     {
@@ -2789,13 +3202,32 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(std::move(sendMsg));
+
+        // If write queue empty, attempt "optimistic write", unless the
+        // message handler is still queuing messages for this peer; it
+        // sends them together when done
+        if (optimisticSend == true) {
+            if (pnode->fSendCorked)
+                pnode->fCorkedSend = true;
+            else
+                nBytesSent = SocketSendData(pnode);
+        }
+    }
+    if (nBytesSent)
+        RecordBytesSent(nBytesSent);
+}
 
-        // If write queue empty, attempt "optimistic write"
-        if (optimisticSend == true)
+void CConnman::CorkSend(CNode* pnode, bool fCork)
+{
+    size_t nBytesSent = 0;
+    {
+        LOCK(pnode->cs_vSend);
+        pnode->fSendCorked = fCork;
+        if (!fCork && pnode->fCorkedSend) {
+            pnode->fCorkedSend = false;
             nBytesSent = SocketSendData(pnode);
+        }
     }
     if (nBytesSent)
         RecordBytesSent(nBytesSent);
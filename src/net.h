@@ -86,9 +86,40 @@ static const bool DEFAULT_BLOCKSONLY = false;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -msghandlerthreads default */
+static const int DEFAULT_MSGHANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHANDLER_THREADS = 16;
+
+/** Number of message handler threads for -msghandlerthreads=nThreads, where 0
+ *  means one per core and a negative value leaves that many cores free */
+int GetMsgHandlerThreads(int nThreads);
 
 static const ServiceFlags REQUIRED_SERVICES = NODE_NETWORK;
 
+/** How the socket handler waits for its sockets to become ready */
+enum SocketEventsMode {
+    SOCKETEVENTS_SELECT, //!< select(), limited to FD_SETSIZE sockets
+    SOCKETEVENTS_POLL,   //!< poll(), still asking about every socket on every wait
+    SOCKETEVENTS_EPOLL,  //!< epoll, with sockets registered once and woken on changes only
+};
+
+/** -socketevents default */
+#if defined(USE_EPOLL)
+static const SocketEventsMode DEFAULT_SOCKETEVENTS = SOCKETEVENTS_EPOLL;
+#elif defined(USE_POLL)
+static const SocketEventsMode DEFAULT_SOCKETEVENTS = SOCKETEVENTS_POLL;
+#else
+static const SocketEventsMode DEFAULT_SOCKETEVENTS = SOCKETEVENTS_SELECT;
+#endif
+
+/** Parse a -socketevents value; fails for modes not available on this platform */
+bool ParseSocketEventsMode(const std::string& str, SocketEventsMode& mode);
+/** The -socketevents value for a mode */
+std::string GetSocketEventsModeName(SocketEventsMode mode);
+/** The -socketevents values available on this platform, comma separated */
+std::string GetSupportedSocketEventsModes();
+
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
@@ -106,6 +137,15 @@ class CTransaction;
 class CNodeStats;
 class CClientUIInterface;
 
+/** A message payload serialized once for several peers, with the hash its
+ *  header checksum is taken from */
+struct CSharedNetMsgPayload
+{
+    std::vector<unsigned char> data;
+    uint256 hash;
+};
+typedef std::shared_ptr<const CSharedNetMsgPayload> CSharedNetMsgPayloadRef;
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -117,6 +157,8 @@ struct CSerializedNetMsg
 
     std::vector<unsigned char> data;
     std::string command;
+    //! Payload shared with other messages, used instead of data if set
+    CSharedNetMsgPayloadRef shared;
 };
 
 
@@ -145,6 +187,8 @@ public:
         unsigned int nReceiveFloodSize = 0;
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
+        SocketEventsMode socketEventsMode = DEFAULT_SOCKETEVENTS;
+        int nMsgHandlerThreads = DEFAULT_MSGHANDLER_THREADS;
     };
     CConnman(uint64_t seed0, uint64_t seed1);
     ~CConnman();
@@ -160,6 +204,9 @@ public:
     bool ForNode(NodeId id, std::function<bool(CNode* pnode)> func);
 
     void PushMessage(CNode* pnode, CSerializedNetMsg&& msg);
+    /** While a peer is corked, messages pushed to it are only queued;
+     *  uncorking sends them together. */
+    void CorkSend(CNode* pnode, bool fCork);
 
     template<typename Callable>
     void ForEachNode(Callable&& func)
@@ -297,8 +344,22 @@ private:
     void ThreadOpenAddedConnections();
     void ProcessOneShot();
     void ThreadOpenConnections();
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
     void AcceptConnection(const ListenSocket& hListenSocket);
+
+    /** Fill the sets with the sockets select() or poll() should wait on.
+     *  Returns whether a node already has data waiting to be read. */
+    bool GenerateSelectSet(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+    /** Wait for listening and node sockets to become ready, for up to
+     *  SELECT_TIMEOUT_MILLISECONDS, and return those that did. */
+    void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+    void SocketEventsSelect(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#ifdef USE_POLL
+    void SocketEventsPoll(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#endif
+#ifdef USE_EPOLL
+    void SocketEventsEpoll(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
+#endif
     void ThreadSocketHandler();
     void ThreadDNSAddressSeed();
 
@@ -356,6 +417,11 @@ private:
     unsigned int nReceiveFloodSize;
 
     std::vector<ListenSocket> vhListenSocket;
+    SocketEventsMode socketEventsMode;
+    int nMsgHandlerThreads;
+#ifdef USE_EPOLL
+    int epollfd; //!< Sockets registered for SOCKETEVENTS_EPOLL, or -1
+#endif
     std::atomic<bool> fNetworkActive;
     banmap_t setBanned;
     CCriticalSection cs_setBanned;
@@ -402,7 +468,9 @@ private:
     std::thread threadSocketHandler;
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
+
+    friend struct CConnmanTest;
 };
 extern std::unique_ptr<CConnman> g_connman;
 void Discover(boost::thread_group& threadGroup);
@@ -514,10 +582,23 @@ public:
 
 
 
+/** A message queued for sending: its serialized header and its payload */
+struct CSendMsg
+{
+    unsigned char header[CMessageHeader::HEADER_SIZE];
+    std::vector<unsigned char> data;
+    CSharedNetMsgPayloadRef shared;
+
+    const std::vector<unsigned char>& payload() const { return shared ? shared->data : data; }
+    size_t size() const { return CMessageHeader::HEADER_SIZE + payload().size(); }
+};
+
 class CNetMessage {
 private:
     mutable CHash256 hasher;
     mutable uint256 data_hash;
+
+    void AllocateData(unsigned int nEnd);
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
@@ -538,6 +619,8 @@ public:
         nTime = 0;
     }
 
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -555,6 +638,11 @@ public:
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    /** Make room for the next payload bytes and return where they go, so
+     *  that they can be received in place and passed to readData. Returns
+     *  NULL if less than nMinSize bytes of the payload are left. */
+    char* GetDataBuffer(unsigned int nMinSize, unsigned int& nSize);
 };
 
 
@@ -570,7 +658,9 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<std::vector<unsigned char>> vSendMsg;
+    std::deque<CSendMsg> vSendMsg;
+    bool fSendCorked; // queue pushed messages for the message handler to send together (protected by cs_vSend)
+    bool fCorkedSend; // a send was left to the message handler (protected by cs_vSend)
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -580,6 +670,7 @@ public:
     size_t nProcessQueueSize;
 
     CCriticalSection cs_sendProcessing;
+    std::atomic_bool fMsgProcClaimed; //!< A message handler thread is processing this peer's messages
 
     std::deque<CInv> vRecvGetData;
     uint64_t nRecvBytes;
@@ -620,6 +711,11 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv;
     std::atomic_bool fPauseSend;
+
+    // Only used by the socket handler thread
+    bool fRecvReady; //!< The socket was reported readable and has not been read until it would block since
+    bool fSendInterest; //!< There was data left to send when the socket handler last waited for events
+    uint32_t nEpollEvents; //!< Events the socket is registered for with epoll, 0 if it is not
 protected:
 
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -630,6 +726,9 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    // Other peers' message handler threads push addresses to relay, so
+    // vAddrToSend and addrKnown are protected by cs_addrSend
+    CCriticalSection cs_addrSend;
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
     bool fGetAddr;
@@ -721,6 +820,9 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    /** Buffer in the payload of the message being received to receive at
+     *  least nMinSize bytes into, or NULL. Only for the socket handler thread. */
+    char* GetRecvPayloadBuffer(unsigned int nMinSize, unsigned int& nSize);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -752,6 +854,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_addrSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -760,6 +863,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_addrSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.rand32() % vAddrToSend.size()] = _addr;
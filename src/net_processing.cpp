@@ -8,9 +8,11 @@
 #include "addrman.h"
 #include "arith_uint256.h"
 #include "blockencodings.h"
+#include "blockfilter.h"
 #include "chainparams.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "index/blockfilterindex.h"
 #include "init.h"
 #include "validation.h"
 #include "merkleblock.h"
@@ -22,6 +24,7 @@
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "random.h"
+#include "sketch.h"
 #include "tinyformat.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -56,12 +59,35 @@ struct COrphanTx {
 std::map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);
 std::map<COutPoint, std::set<std::map<uint256, COrphanTx>::iterator, IteratorComparator>> mapOrphanTransactionsByPrev GUARDED_BY(cs_main);
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+static void ErasePendingTransactionsFor(NodeId nodeid);
+static void AnswerEarlyRelayedBlockRequests(const CBlock& block, CConnman& connman, const std::shared_ptr<const CBlock>& pblockKeep = nullptr) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 static size_t vExtraTxnForCompactIt = 0;
 static std::vector<std::pair<uint256, CTransactionRef>> vExtraTxnForCompact GUARDED_BY(cs_main);
 
 static const uint64_t RANDOMIZER_ID_ADDRESS_RELAY = 0x3cac0035b5866b90ULL; // SHA256("main address relay")[0:8]
 
+/** Maximum number of compact filters that may be requested with one getcfilters. See BIP 157. */
+static const uint32_t MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of cf hashes that may be requested with one getcfheaders. See BIP 157. */
+static const uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+/** Interval between compact filter checkpoints. See BIP 157. */
+static const int CFCHECKPT_INTERVAL = 1000;
+/** Total payload size of the serialized blocks and transactions kept for sending to more peers */
+static const size_t MAX_PAYLOAD_CACHE_SIZE = 16 * 1000 * 1000;
+/** Average delay (in seconds) between reconciliations we request from each outbound reconciling peer */
+static const int RECON_REQUEST_INTERVAL = 8;
+/** Time (in seconds) after which we give up on a reconciliation we requested, and announce its set with inv */
+static const int RECON_RESPONSE_TIMEOUT = 60;
+/** Number of outbound reconciling peers we keep flooding transactions to */
+static const int RECON_FLOOD_OUTBOUND_PEERS = 2;
+/** Maximum number of transactions waiting to be reconciled with a peer; a full set is announced with inv instead */
+static const size_t MAX_RECON_SET_SIZE = 3000;
+/** Maximum capacity of a sketch we send or accept; larger differences fall back to announcing the whole set */
+static const size_t MAX_SKETCH_CAPACITY = 128;
+/** Number of early relayed cmpctblocks for which we hold back getblocktxn requests until we have the block */
+static const size_t MAX_EARLY_RELAYED_BLOCKS = 3;
+
 // Internal stuff
 namespace {
     /** Number of nodes with fSyncStarted. */
@@ -111,12 +137,28 @@ namespace {
     /** Stack of nodes which we have set to announce using compact blocks */
     std::list<NodeId> lNodesAnnouncingHeaderAndIDs;
 
+    /** Blocks we relayed as cmpctblock to whitelisted peers before we had them (-whitelistcmpctrelay). Protected by cs_main. */
+    struct EarlyRelayedBlock {
+        uint256 hash;
+        std::shared_ptr<const CBlock> pblock;                                     //!< Set once reconstructed, until stored.
+        std::vector<std::pair<NodeId, BlockTransactionsRequest> > vRequests;     //!< getblocktxn requests received before that.
+    };
+    std::list<EarlyRelayedBlock> lEarlyRelayedBlocks;
+
     /** Number of preferable block download peers. */
     int nPreferredDownload = 0;
 
     /** Number of peers from which we're downloading blocks. */
     int nPeersWithValidatedDownloads = 0;
 
+    /** Number of outbound reconciling peers we flood transactions to. */
+    int nReconFloodPeers = 0;
+
+    /** The block with the most work announced to us since initial block download, and when
+     *  it was first announced (in microseconds). Protected by cs_main. */
+    const CBlockIndex *pindexBestAnnounced = NULL;
+    int64_t nBestAnnouncedTime = 0;
+
     /** Relay map, protected by cs_main. */
     typedef std::map<uint256, CTransactionRef> MapRelay;
     MapRelay mapRelay;
@@ -175,6 +217,19 @@ struct CNodeState {
     int64_t nDownloadingSince;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Moving average of the time (in microseconds) this peer took to deliver each requested block, or 0 if unknown.
+    int64_t nBlockDownloadTime;
+    //! Moving average of the rate (in bytes per second) at which this peer delivered requested blocks.
+    int64_t nBlockDownloadRate;
+    //! Number of blocks in flight from this peer that were requested again from a faster peer.
+    int nBlocksRerequested;
+    //! The last block this peer announced that was measured for nBlockAnnounceDelay.
+    const CBlockIndex *pindexLastAnnounceMeasured;
+    //! Moving average of how long (in microseconds) after the first announcement of a new best block this peer announced it.
+    int64_t nBlockAnnounceDelay;
+    //! Number of new best blocks this peer announced, and how many of them it announced first.
+    int nBlocksAnnounced;
+    int nBlocksAnnouncedFirst;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
     //! Whether this peer wants invs or headers (when possible) for block announcements.
@@ -187,6 +242,8 @@ struct CNodeState {
       * but is used as a flag to "lock in" the version of compact blocks (fWantsCmpctWitness) we send.
       */
     bool fProvidesHeaderAndIDs;
+    //! Whether we asked this whitelisted peer to announce using cmpctblocks outside the BIP152 limit of 3 (-whitelistcmpctrelay).
+    bool fWhitelistCmpctRelay;
     //! Whether this peer can give us witnesses
     bool fHaveWitness;
     //! Whether this peer wants witnesses in cmpctblocks/blocktxns
@@ -196,6 +253,28 @@ struct CNodeState {
      * otherwise: whether this peer sends non-witnesses in cmpctblocks/blocktxns.
      */
     bool fSupportsDesiredCmpctVersion;
+    //! Our salt for short transaction ids sent in sendrecon, or 0 if we did not offer reconciliation.
+    uint64_t nReconSalt;
+    //! Whether transactions are announced to this peer through set reconciliation (NODE_TXRECON).
+    bool fReconcile;
+    //! Whether we flood transactions to this reconciling peer anyway.
+    bool fReconFlood;
+    //! SipHash keys for short transaction ids, derived from both salts.
+    uint64_t nReconKey0;
+    uint64_t nReconKey1;
+    //! Transactions to announce to this peer at the next reconciliation.
+    std::set<uint256> setReconTx;
+    //! The transactions of the reconciliation in progress, by short id.
+    std::map<uint32_t, uint256> mapReconSnapshot;
+    //! Whether a reconciliation is in progress (we requested it, or sent our sketch).
+    bool fReconInProgress;
+    //! When to request the next reconciliation, and when we requested the one in progress (in
+    //! microseconds, following mock time), if this is an outbound peer.
+    int64_t nNextReconRequest;
+    int64_t nReconRequestTime;
+    //! Number of finished reconciliations, and of those that could not be decoded.
+    int nReconciliations;
+    int nReconFailures;
 
     CNodeState(CAddress addrIn, std::string addrNameIn) : address(addrIn), name(addrNameIn) {
         fCurrentlyConnected = false;
@@ -211,13 +290,31 @@ struct CNodeState {
         nDownloadingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        nBlockDownloadTime = 0;
+        nBlockDownloadRate = 0;
+        nBlocksRerequested = 0;
+        pindexLastAnnounceMeasured = NULL;
+        nBlockAnnounceDelay = 0;
+        nBlocksAnnounced = 0;
+        nBlocksAnnouncedFirst = 0;
         fPreferredDownload = false;
         fPreferHeaders = false;
         fPreferHeaderAndIDs = false;
         fProvidesHeaderAndIDs = false;
+        fWhitelistCmpctRelay = false;
         fHaveWitness = false;
         fWantsCmpctWitness = false;
         fSupportsDesiredCmpctVersion = false;
+        nReconSalt = 0;
+        fReconcile = false;
+        fReconFlood = false;
+        nReconKey0 = 0;
+        nReconKey1 = 0;
+        fReconInProgress = false;
+        nNextReconRequest = 0;
+        nReconRequestTime = 0;
+        nReconciliations = 0;
+        nReconFailures = 0;
     }
 };
 
@@ -290,9 +387,11 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
         mapBlocksInFlight.erase(entry.hash);
     }
     EraseOrphansFor(nodeid);
+    ErasePendingTransactionsFor(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
     nPeersWithValidatedDownloads -= (state->nBlocksInFlightValidHeaders != 0);
     assert(nPeersWithValidatedDownloads >= 0);
+    nReconFloodPeers -= state->fReconFlood;
 
     mapNodeState.erase(nodeid);
 
@@ -301,6 +400,7 @@ void FinalizeNode(NodeId nodeid, bool& fUpdateConnectionTime) {
         assert(mapBlocksInFlight.empty());
         assert(nPreferredDownload == 0);
         assert(nPeersWithValidatedDownloads == 0);
+        assert(nReconFloodPeers == 0);
     }
 }
 
@@ -318,7 +418,7 @@ bool MarkBlockAsReceived(const uint256& hash) {
         }
         if (state->vBlocksInFlight.begin() == itInFlight->second.second) {
             // First block on the queue was received, update the start download time for the next one
-            state->nDownloadingSince = std::max(state->nDownloadingSince, GetTimeMicros());
+            state->nDownloadingSince = std::max(state->nDownloadingSince, GetMockableTimeMicros());
         }
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
@@ -329,6 +429,48 @@ bool MarkBlockAsReceived(const uint256& hash) {
     return false;
 }
 
+// Requires cs_main.
+// Update the download speed of the peer a requested block was received from. Must be called
+// before MarkBlockAsReceived. Only the block at the front of the peer's queue is measured, as
+// the ones behind it were waiting for it to arrive.
+void UpdateBlockDownloadSpeed(NodeId nodeid, const uint256& hash, unsigned int nSize) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    if (state->vBlocksInFlight.begin() != itInFlight->second.second)
+        return;
+    int64_t nTime = std::max<int64_t>(GetMockableTimeMicros() - state->nDownloadingSince, 1);
+    int64_t nRate = (int64_t)nSize * 1000000 / nTime;
+    if (state->nBlockDownloadTime == 0) {
+        state->nBlockDownloadTime = nTime;
+        state->nBlockDownloadRate = nRate;
+    } else {
+        // Exponential moving average with a weight of 1/8 for the new sample.
+        state->nBlockDownloadTime += (nTime - state->nBlockDownloadTime) / 8;
+        state->nBlockDownloadRate += (nRate - state->nBlockDownloadRate) / 8;
+    }
+}
+
+// Requires cs_main.
+int GetMaxBlocksInTransit(const CNodeState *state) {
+    return ::GetMaxBlocksInTransit(state->nBlockDownloadTime);
+}
+
+// Requires cs_main.
+// Whether a block that is in flight from another peer and holds up the download window should
+// be requested again from nodeid, because that peer is expected to deliver it much sooner.
+bool ShouldRerequestBlock(NodeId nodeid, const uint256& hash) {
+    std::map<uint256, std::pair<NodeId, std::list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    assert(itInFlight != mapBlocksInFlight.end());
+    const CNodeState *stateOther = State(itInFlight->second.first);
+    // Blocks further back in the other peer's queue are not being downloaded yet.
+    if (stateOther->vBlocksInFlight.begin() != itInFlight->second.second)
+        return false;
+    int64_t nWaiting = GetMockableTimeMicros() - stateOther->nDownloadingSince;
+    return ::ShouldRerequestBlock(State(nodeid)->nBlockDownloadTime, stateOther->nBlockDownloadTime, nWaiting);
+}
+
 // Requires cs_main.
 // returns false, still setting pit, if the block was already in flight from the same peer
 // pit will only be valid as long as the same cs_main lock is being held
@@ -352,7 +494,7 @@ bool MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     state->nBlocksInFlightValidHeaders += it->fValidatedHeaders;
     if (state->nBlocksInFlight == 1) {
         // We're starting a block download (batch) from this peer.
-        state->nDownloadingSince = GetTimeMicros();
+        state->nDownloadingSince = GetMockableTimeMicros();
     }
     if (state->nBlocksInFlightValidHeaders == 1 && pindex != NULL) {
         nPeersWithValidatedDownloads++;
@@ -378,6 +520,30 @@ void ProcessBlockAvailability(NodeId nodeid) {
     }
 }
 
+/** Measure how long after the first announcement of the best block we have heard of a peer announced it too. */
+void UpdateBlockAnnounceDelay(CNodeState *state, const CBlockIndex *pindex) {
+    if (state->pindexLastAnnounceMeasured == pindex || IsInitialBlockDownload())
+        return;
+    int64_t nNow = GetTimeMicros();
+    int64_t nDelay = 0;
+    if (pindexBestAnnounced == NULL || pindex->nChainWork > pindexBestAnnounced->nChainWork) {
+        pindexBestAnnounced = pindex;
+        nBestAnnouncedTime = nNow;
+        state->nBlocksAnnouncedFirst++;
+    } else if (pindex == pindexBestAnnounced) {
+        nDelay = nNow - nBestAnnouncedTime;
+    } else {
+        return;
+    }
+    state->pindexLastAnnounceMeasured = pindex;
+    if (state->nBlocksAnnounced++ == 0) {
+        state->nBlockAnnounceDelay = nDelay;
+    } else {
+        // Exponential moving average with a weight of 1/8 for the new sample.
+        state->nBlockAnnounceDelay += (nDelay - state->nBlockAnnounceDelay) / 8;
+    }
+}
+
 /** Update tracking information about which blocks a peer is assumed to have. */
 void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
     CNodeState *state = State(nodeid);
@@ -390,6 +556,7 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
         // An actually better block was announced.
         if (state->pindexBestKnownBlock == NULL || it->second->nChainWork >= state->pindexBestKnownBlock->nChainWork)
             state->pindexBestKnownBlock = it->second;
+        UpdateBlockAnnounceDelay(state, it->second);
     } else {
         // An unknown block was announced; just assume that the latest one is the best one.
         state->hashLastUnknownBlock = hash;
@@ -411,9 +578,19 @@ void MaybeSetPeerAsAnnouncingHeaderAndIDs(NodeId nodeid, CConnman& connman) {
                 return;
             }
         }
-        connman.ForNode(nodeid, [&connman](CNode* pfrom){
+        connman.ForNode(nodeid, [&connman, nodestate](CNode* pfrom){
             bool fAnnounceUsingCMPCTBLOCK = false;
             uint64_t nCMPCTBLOCKVersion = (pfrom->GetLocalServices() & NODE_WITNESS) ? 2 : 1;
+            if (pfrom->fWhitelisted && GetBoolArg("-whitelistcmpctrelay", DEFAULT_WHITELISTCMPCTRELAY)) {
+                // Whitelisted peers all announce using compact encodings, on top of
+                // the 3 others below.
+                if (!nodestate->fWhitelistCmpctRelay) {
+                    fAnnounceUsingCMPCTBLOCK = true;
+                    connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
+                    nodestate->fWhitelistCmpctRelay = true;
+                }
+                return true;
+            }
             if (lNodesAnnouncingHeaderAndIDs.size() >= 3) {
                 // As per BIP152, we only get 3 of our peers to announce
                 // blocks using compact encodings.
@@ -549,6 +726,18 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                if (waitingfor != nodeid && ShouldRerequestBlock(nodeid, pindex->GetBlockHash())) {
+                    // It is holding up the download window and this peer is much faster, so
+                    // fetch it from here instead of waiting for the other peer to stall.
+                    LogPrint("net", "Re-requesting slow block %s (%d) from peer=%d instead of peer=%d\n",
+                        pindex->GetBlockHash().ToString(), pindex->nHeight, nodeid, waitingfor);
+                    State(waitingfor)->nBlocksRerequested++;
+                    waitingfor = nodeid;
+                    vBlocks.push_back(pindex);
+                    if (vBlocks.size() == count) {
+                        return;
+                    }
+                }
             }
         }
     }
@@ -556,6 +745,23 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
 
 } // anon namespace
 
+int GetMaxBlocksInTransit(int64_t nBlockDownloadTime) {
+    if (nBlockDownloadTime == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    int64_t nBlocks = BLOCK_DOWNLOAD_QUEUE_TARGET / nBlockDownloadTime;
+    return std::max<int64_t>(MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, std::min<int64_t>(MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER, nBlocks));
+}
+
+bool ShouldRerequestBlock(int64_t nBlockDownloadTime, int64_t nOtherDownloadTime, int64_t nWaiting) {
+    if (nBlockDownloadTime == 0)
+        return false;
+    if (nWaiting < 1000000 * BLOCK_REREQUEST_TIMEOUT)
+        return false;
+    if (nWaiting < BLOCK_REREQUEST_SPEEDUP * nBlockDownloadTime)
+        return false;
+    return nOtherDownloadTime == 0 || nOtherDownloadTime > BLOCK_REREQUEST_SPEEDUP * nBlockDownloadTime;
+}
+
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
     LOCK(cs_main);
     CNodeState *state = State(nodeid);
@@ -568,6 +774,15 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.nMaxBlocksInTransit = GetMaxBlocksInTransit(state);
+    stats.nBlockDownloadTime = state->nBlockDownloadTime;
+    stats.nBlockDownloadRate = state->nBlockDownloadRate;
+    stats.nBlocksRerequested = state->nBlocksRerequested;
+    stats.nBlockAnnounceDelay = state->nBlocksAnnounced ? state->nBlockAnnounceDelay : -1;
+    stats.nBlocksAnnouncedFirst = state->nBlocksAnnouncedFirst;
+    stats.fTxReconciliation = state->fReconcile;
+    stats.nReconciliations = state->nReconciliations;
+    stats.nReconFailures = state->nReconFailures;
     return true;
 }
 
@@ -706,6 +921,94 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRE
     return nEvicted;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Transaction verification threads
+//
+
+namespace {
+/** A loose transaction from a peer, checked by ThreadTxVerify before it is
+ *  handed to AcceptToMemoryPool */
+struct PendingTx
+{
+    CTransactionRef tx;
+    bool fChecked;
+
+    PendingTx(const CTransactionRef& txIn) : tx(txIn), fChecked(false) {}
+};
+
+boost::mutex mutexPendingTx;
+boost::condition_variable condPendingTx;
+/** Transactions waiting for a verification thread, oldest first */
+std::deque<std::shared_ptr<PendingTx> > queuePendingTx;
+/** Transactions being checked or waiting to be accepted, per peer in the order they arrived */
+std::map<NodeId, std::deque<std::shared_ptr<PendingTx> > > mapPendingTx;
+std::atomic<int> nTxVerifyThreads(0);
+} // anon namespace
+
+bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
+/** Hand a transaction from a peer to the verification threads. Returns
+ *  false if there are none and the transaction has to be processed now. */
+static bool QueueTransactionCheck(CNode* pfrom, const CTransactionRef& ptx)
+{
+    if (nTxVerifyThreads == 0)
+        return false;
+
+    std::shared_ptr<PendingTx> pending = std::make_shared<PendingTx>(ptx);
+    {
+        // Transactions we already have or rejected are not worth checking,
+        // but still keep their place in the peer's queue
+        LOCK(cs_main);
+        pending->fChecked = AlreadyHave(CInv(MSG_TX, ptx->GetHash()));
+    }
+    boost::unique_lock<boost::mutex> lock(mutexPendingTx);
+    mapPendingTx[pfrom->GetId()].push_back(pending);
+    if (!pending->fChecked) {
+        queuePendingTx.push_back(pending);
+        condPendingTx.notify_one();
+    }
+    return true;
+}
+
+static size_t CountPendingTransactions(NodeId nodeid)
+{
+    boost::unique_lock<boost::mutex> lock(mutexPendingTx);
+    std::map<NodeId, std::deque<std::shared_ptr<PendingTx> > >::const_iterator it = mapPendingTx.find(nodeid);
+    return it == mapPendingTx.end() ? 0 : it->second.size();
+}
+
+static void ErasePendingTransactionsFor(NodeId nodeid)
+{
+    boost::unique_lock<boost::mutex> lock(mutexPendingTx);
+    mapPendingTx.erase(nodeid);
+}
+
+void ThreadTxVerify(CConnman* connman)
+{
+    ++nTxVerifyThreads;
+    while (true) {
+        std::shared_ptr<PendingTx> pending;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexPendingTx);
+            while (queuePendingTx.empty())
+                condPendingTx.wait(lock);
+            pending = queuePendingTx.front();
+            queuePendingTx.pop_front();
+        }
+
+        // The outcome only warms the signature cache; the transaction is
+        // accepted or rejected by the message handler either way.
+        PreVerifyTransaction(mempool, pending->tx);
+
+        {
+            boost::unique_lock<boost::mutex> lock(mutexPendingTx);
+            pending->fChecked = true;
+        }
+        connman->WakeMessageHandler();
+    }
+}
+
 // Requires cs_main.
 void Misbehaving(NodeId pnode, int howmuch)
 {
@@ -776,12 +1079,71 @@ static std::shared_ptr<const CBlock> most_recent_block;
 static std::shared_ptr<const CBlockHeaderAndShortTxIDs> most_recent_compact_block;
 static uint256 most_recent_block_hash;
 
+namespace {
+/** Serialized payloads of the blocks, compact blocks and transactions sent
+ *  most recently, by object hash, command and serialization version, so that
+ *  one sent to many peers is serialized and hashed only once. The oldest are
+ *  dropped first. */
+class CPayloadCache
+{
+    typedef std::tuple<uint256, std::string, int> Key;
+
+    CCriticalSection cs;
+    std::map<Key, CSharedNetMsgPayloadRef> mapPayloads;
+    std::deque<Key> queueKeys;
+    size_t nTotalSize;
+
+public:
+    CPayloadCache() : nTotalSize(0) {}
+
+    CSharedNetMsgPayloadRef Find(const uint256& hash, const std::string& strCommand, const CNetMsgMaker& msgMaker, int nFlags)
+    {
+        LOCK(cs);
+        std::map<Key, CSharedNetMsgPayloadRef>::const_iterator it = mapPayloads.find(Key(hash, strCommand, msgMaker.GetVersion() | nFlags));
+        return it == mapPayloads.end() ? nullptr : it->second;
+    }
+
+    void Add(const uint256& hash, const std::string& strCommand, const CNetMsgMaker& msgMaker, int nFlags, const CSharedNetMsgPayloadRef& payload)
+    {
+        LOCK(cs);
+        Key key(hash, strCommand, msgMaker.GetVersion() | nFlags);
+        if (!mapPayloads.emplace(key, payload).second)
+            return;
+        queueKeys.push_back(key);
+        nTotalSize += payload->data.size();
+        while (nTotalSize > MAX_PAYLOAD_CACHE_SIZE && queueKeys.size() > 1) {
+            std::map<Key, CSharedNetMsgPayloadRef>::iterator it = mapPayloads.find(queueKeys.front());
+            nTotalSize -= it->second->data.size();
+            mapPayloads.erase(it);
+            queueKeys.pop_front();
+        }
+    }
+};
+CPayloadCache payloadCache;
+} // anon namespace
+
+/** Make a block, compact block or transaction message, with the payload
+ *  already serialized for another peer if there is one. Transactions go by
+ *  their witness hash, as the same txid may come with another witness. */
+template <typename T>
+static CSerializedNetMsg MakeCachedMsg(const CNetMsgMaker& msgMaker, int nFlags, const std::string& strCommand, const uint256& hash, const T& obj)
+{
+    CSharedNetMsgPayloadRef payload = payloadCache.Find(hash, strCommand, msgMaker, nFlags);
+    if (!payload) {
+        payload = msgMaker.MakePayload(nFlags, obj);
+        payloadCache.Add(hash, strCommand, msgMaker, nFlags, payload);
+    }
+    return msgMaker.MakeShared(strCommand, payload);
+}
+
 void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std::shared_ptr<const CBlock>& pblock) {
     std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs> (*pblock, true);
     const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
 
     LOCK(cs_main);
 
+    AnswerEarlyRelayedBlockRequests(*pblock, *connman);
+
     static int nHighestFastAnnounce = 0;
     if (pindex->nHeight <= nHighestFastAnnounce)
         return;
@@ -798,7 +1160,6 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
     }
 
     connman->ForEachNode([this, &pcmpctblock, pindex, &msgMaker, fWitnessEnabled, &hashBlock](CNode* pnode) {
-        // TODO: Avoid the repeated-serialization here
         if (pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
             return;
         ProcessBlockAvailability(pnode->GetId());
@@ -810,12 +1171,55 @@ void PeerLogicValidation::NewPoWValidBlock(const CBlockIndex *pindex, const std:
 
             LogPrint("net", "%s sending header-and-ids %s to peer=%d\n", "PeerLogicValidation::NewPoWValidBlock",
                     hashBlock.ToString(), pnode->id);
-            connman->PushMessage(pnode, msgMaker.Make(NetMsgType::CMPCTBLOCK, *pcmpctblock));
+            connman->PushMessage(pnode, MakeCachedMsg(msgMaker, 0, NetMsgType::CMPCTBLOCK, hashBlock, *pcmpctblock));
             state.pindexBestHeaderSent = pindex;
         }
     });
 }
 
+static std::list<EarlyRelayedBlock>::iterator FindEarlyRelayedBlock(const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    for (std::list<EarlyRelayedBlock>::iterator it = lEarlyRelayedBlocks.begin(); it != lEarlyRelayedBlocks.end(); ++it) {
+        if (it->hash == hash)
+            return it;
+    }
+    return lEarlyRelayedBlocks.end();
+}
+
+// Requires cs_main.
+// Forward a cmpctblock received from a whitelisted peer to the other whitelisted peers that
+// want them, before it has been reconstructed or validated (-whitelistcmpctrelay).
+static void RelayCmpctBlockToWhitelistedPeers(const CBlockIndex *pindex, const CBlockHeaderAndShortTxIDs& cmpctblock, bool fWitness, NodeId nodeFrom, CConnman& connman) {
+    bool fWitnessEnabled = IsWitnessEnabled(pindex->pprev, Params().GetConsensus());
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CSharedNetMsgPayloadRef payload;
+
+    connman.ForEachNode([&](CNode* pnode) {
+        if (!pnode->fWhitelisted || pnode->GetId() == nodeFrom || pnode->nVersion < INVALID_CB_NO_BAN_VERSION || pnode->fDisconnect)
+            return;
+        ProcessBlockAvailability(pnode->GetId());
+        CNodeState &state = *State(pnode->GetId());
+        if (state.fPreferHeaderAndIDs && (!fWitnessEnabled || state.fWantsCmpctWitness == fWitness) &&
+                !PeerHasHeader(&state, pindex) && PeerHasHeader(&state, pindex->pprev)) {
+            LogPrint("net", "relaying header-and-ids %s from peer=%d to peer=%d\n", pindex->GetBlockHash().ToString(), nodeFrom, pnode->id);
+            if (!payload)
+                payload = msgMaker.MakePayload(0, cmpctblock);
+            connman.PushMessage(pnode, msgMaker.MakeShared(NetMsgType::CMPCTBLOCK, payload));
+            state.pindexBestHeaderSent = pindex;
+        }
+    });
+
+    // Peers that miss transactions will ask us for them before we have the block
+    // ourselves; remember to answer them once we do.
+    if (payload && FindEarlyRelayedBlock(pindex->GetBlockHash()) == lEarlyRelayedBlocks.end()) {
+        EarlyRelayedBlock block;
+        block.hash = pindex->GetBlockHash();
+        lEarlyRelayedBlocks.push_back(block);
+        if (lEarlyRelayedBlocks.size() > MAX_EARLY_RELAYED_BLOCKS)
+            lEarlyRelayedBlocks.pop_front();
+    }
+}
+
 void PeerLogicValidation::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) {
     const int nNewHeight = pindexNew->nHeight;
     connman->SetBestHeight(nNewHeight);
@@ -878,6 +1282,16 @@ void PeerLogicValidation::BlockChecked(const CBlock& block, const CValidationSta
     }
     if (it != mapBlockSource.end())
         mapBlockSource.erase(it);
+
+    // Blocks we relayed early are done with either way; peers asking for the
+    // transactions of an invalid block are left to time out.
+    if (state.IsValid())
+        AnswerEarlyRelayedBlockRequests(block, *connman);
+    else {
+        std::list<EarlyRelayedBlock>::iterator itEarly = FindEarlyRelayedBlock(hash);
+        if (itEarly != lEarlyRelayedBlocks.end())
+            lEarlyRelayedBlocks.erase(itEarly);
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1034,14 +1448,24 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
+                    // Send block from disk, unless it is the one just relayed
+                    std::shared_ptr<const CBlock> pblock;
+                    {
+                        LOCK(cs_most_recent_block);
+                        if (most_recent_block_hash == inv.hash)
+                            pblock = most_recent_block;
+                    }
+                    if (!pblock) {
+                        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+                        if (!ReadBlockFromDisk(*pblockRead, (*mi).second, consensusParams))
+                            assert(!"cannot load block from disk");
+                        pblock = pblockRead;
+                    }
+                    const CBlock& block = *pblock;
                     if (inv.type == MSG_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block));
+                        connman.PushMessage(pfrom, MakeCachedMsg(msgMaker, SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, inv.hash, block));
                     else if (inv.type == MSG_WITNESS_BLOCK)
-                        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::BLOCK, block));
+                        connman.PushMessage(pfrom, MakeCachedMsg(msgMaker, 0, NetMsgType::BLOCK, inv.hash, block));
                     else if (inv.type == MSG_FILTERED_BLOCK)
                     {
                         bool sendMerkleBlock = false;
@@ -1077,10 +1501,16 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                         bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
                         int nSendFlags = fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
                         if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
-                            connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                            // Peers may all be sent the same compact block (and nonce)
+                            CSharedNetMsgPayloadRef payload = payloadCache.Find(inv.hash, NetMsgType::CMPCTBLOCK, msgMaker, nSendFlags);
+                            if (payload) {
+                                connman.PushMessage(pfrom, msgMaker.MakeShared(NetMsgType::CMPCTBLOCK, payload));
+                            } else {
+                                CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
+                                connman.PushMessage(pfrom, MakeCachedMsg(msgMaker, nSendFlags, NetMsgType::CMPCTBLOCK, inv.hash, cmpctblock));
+                            }
                         } else
-                            connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCK, block));
+                            connman.PushMessage(pfrom, MakeCachedMsg(msgMaker, nSendFlags, NetMsgType::BLOCK, inv.hash, block));
                     }
 
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
@@ -1103,14 +1533,14 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 auto mi = mapRelay.find(inv.hash);
                 int nSendFlags = (inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0);
                 if (mi != mapRelay.end()) {
-                    connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *mi->second));
+                    connman.PushMessage(pfrom, MakeCachedMsg(msgMaker, nSendFlags, NetMsgType::TX, mi->second->GetWitnessHash(), *mi->second));
                     push = true;
                 } else if (pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
                     // To protect privacy, do not answer getdata using the mempool when
                     // that TX couldn't have been INVed in reply to a MEMPOOL request.
                     if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
-                        connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::TX, *txinfo.tx));
+                        connman.PushMessage(pfrom, MakeCachedMsg(msgMaker, nSendFlags, NetMsgType::TX, txinfo.tx->GetWitnessHash(), *txinfo.tx));
                         push = true;
                     }
                 }
@@ -1166,6 +1596,589 @@ inline void static SendBlockTransactions(const CBlock& block, const BlockTransac
     connman.PushMessage(pfrom, msgMaker.Make(nSendFlags, NetMsgType::BLOCKTXN, resp));
 }
 
+// Answer the getblocktxn requests we held back for a block we relayed before having it. Until the
+// block is stored (and found by the getblocktxn handler), keep pblockKeep to answer later requests.
+static void AnswerEarlyRelayedBlockRequests(const CBlock& block, CConnman& connman, const std::shared_ptr<const CBlock>& pblockKeep)
+{
+    std::list<EarlyRelayedBlock>::iterator it = FindEarlyRelayedBlock(block.GetHash());
+    if (it == lEarlyRelayedBlocks.end())
+        return;
+    for (const std::pair<NodeId, BlockTransactionsRequest>& request : it->vRequests) {
+        connman.ForNode(request.first, [&block, &request, &connman](CNode* pnode) {
+            SendBlockTransactions(block, request.second, pnode, connman);
+            return true;
+        });
+    }
+    if (pblockKeep) {
+        it->pblock = pblockKeep;
+        it->vRequests.clear();
+    } else {
+        lEarlyRelayedBlocks.erase(it);
+    }
+}
+
+/**
+ * Validate that a compact block filter request is for a filter type we serve
+ * and a range of blocks on our active chain; otherwise disconnect the peer.
+ *
+ * @param[in]   pfrom           The peer that we received the request from
+ * @param[in]   filter_type     The filter type the request is for. Must be basic filters.
+ * @param[in]   start_height    The start height for the request
+ * @param[in]   stop_hash       The stop_hash for the request
+ * @param[in]   max_height_diff The maximum number of items permitted to request, as specified in BIP 157
+ * @param[out]  stop_index      The CBlockIndex for the stop_hash block, if the request can be serviced.
+ * @param[out]  filter_index    The filter index, if the request can be serviced.
+ * @return                      True if the request can be serviced.
+ */
+static bool PrepareBlockFilterRequest(CNode* pfrom, BlockFilterType filter_type,
+                                      uint32_t start_height, const uint256& stop_hash, uint32_t max_height_diff,
+                                      const CBlockIndex*& stop_index, BlockFilterIndex*& filter_index)
+{
+    bool fSupported = filter_type == BLOCK_FILTER_BASIC && (pfrom->GetLocalServices() & NODE_COMPACT_FILTERS);
+    if (!fSupported) {
+        LogPrint("net", "peer %d requested unsupported block filter type: %d\n", pfrom->id, static_cast<uint8_t>(filter_type));
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    {
+        LOCK(cs_main);
+        BlockMap::iterator mi = mapBlockIndex.find(stop_hash);
+
+        // Only serve filters for blocks on the active chain.
+        if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) {
+            LogPrint("net", "peer %d requested invalid block hash: %s\n", pfrom->id, stop_hash.ToString());
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        stop_index = mi->second;
+    }
+
+    uint32_t stop_height = stop_index->nHeight;
+    if (start_height > stop_height) {
+        LogPrint("net", "peer %d sent invalid getcfilters/getcfheaders with start height %d and stop height %d\n",
+                 pfrom->id, start_height, stop_height);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (stop_height - start_height >= max_height_diff) {
+        LogPrint("net", "peer %d requested too many cfilters/cfheaders: %d / %d\n",
+                 pfrom->id, stop_height - start_height + 1, max_height_diff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+
+    filter_index = GetBlockFilterIndex(filter_type);
+    if (!filter_index) {
+        LogPrint("net", "Filter index for supported type %s not found\n", BlockFilterTypeName(filter_type));
+        return false;
+    }
+
+    return true;
+}
+
+/** Handle a getcfilters request: send one cfilter message per block in the requested range. */
+static void ProcessGetCFilters(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, start_height, stop_hash,
+                                   MAX_GETCFILTERS_SIZE, stop_index, filter_index)) {
+        return;
+    }
+
+    std::vector<BlockFilter> filters;
+    if (!filter_index->LookupFilterRange(start_height, stop_index, filters)) {
+        LogPrint("net", "Failed to find block filter in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(filter_type), start_height, stop_hash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    for (const BlockFilter& filter : filters) {
+        connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFILTER, filter));
+    }
+}
+
+/** Handle a getcfheaders request: reply with the header preceding the range and the filter hashes in it. */
+static void ProcessGetCFHeaders(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t filter_type_ser;
+    uint32_t start_height;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> start_height >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, start_height, stop_hash,
+                                   MAX_GETCFHEADERS_SIZE, stop_index, filter_index)) {
+        return;
+    }
+
+    uint256 prev_header;
+    if (start_height > 0) {
+        const CBlockIndex* const prev_block = stop_index->GetAncestor(static_cast<int>(start_height - 1));
+        if (!filter_index->LookupFilterHeader(prev_block, prev_header)) {
+            LogPrint("net", "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(filter_type), prev_block->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    std::vector<uint256> filter_hashes;
+    if (!filter_index->LookupFilterHashRange(start_height, stop_index, filter_hashes)) {
+        LogPrint("net", "Failed to find block filter hashes in index: filter_type=%s, start_height=%d, stop_hash=%s\n",
+                 BlockFilterTypeName(filter_type), start_height, stop_hash.ToString());
+        return;
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFHEADERS,
+                                             filter_type_ser,
+                                             stop_index->GetBlockHash(),
+                                             prev_header,
+                                             filter_hashes));
+}
+
+/** Handle a getcfcheckpt request: reply with the filter headers at every CFCHECKPT_INTERVAL blocks. */
+static void ProcessGetCFCheckPt(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint8_t filter_type_ser;
+    uint256 stop_hash;
+
+    vRecv >> filter_type_ser >> stop_hash;
+
+    const BlockFilterType filter_type = static_cast<BlockFilterType>(filter_type_ser);
+
+    const CBlockIndex* stop_index;
+    BlockFilterIndex* filter_index;
+    if (!PrepareBlockFilterRequest(pfrom, filter_type, /*start_height=*/0, stop_hash,
+                                   /*max_height_diff=*/std::numeric_limits<uint32_t>::max(),
+                                   stop_index, filter_index)) {
+        return;
+    }
+
+    std::vector<uint256> headers(stop_index->nHeight / CFCHECKPT_INTERVAL);
+
+    // Populate headers.
+    const CBlockIndex* block_index = stop_index;
+    for (int i = headers.size() - 1; i >= 0; i--) {
+        int height = (i + 1) * CFCHECKPT_INTERVAL;
+        block_index = block_index->GetAncestor(height);
+
+        if (!filter_index->LookupFilterHeader(block_index, headers[i])) {
+            LogPrint("net", "Failed to find block filter header in index: filter_type=%s, block_hash=%s\n",
+                     BlockFilterTypeName(filter_type), block_index->GetBlockHash().ToString());
+            return;
+        }
+    }
+
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::CFCHECKPT,
+                                             filter_type_ser,
+                                             stop_index->GetBlockHash(),
+                                             headers));
+}
+
+/** Short id of a transaction in reconciliations with a peer. Never zero, which cannot be added to a sketch. Requires cs_main. */
+static uint32_t GetReconShortId(const CNodeState* state, const uint256& hash)
+{
+    return 1 + (uint32_t)(SipHashUint256(state->nReconKey0, state->nReconKey1, hash) % 0xffffffff);
+}
+
+/**
+ * Capacity of the sketch to reconcile sets of the given sizes: the difference
+ * in size, plus a quarter of the smaller set for the transactions only one
+ * side has seen yet.
+ */
+static size_t EstimateSketchCapacity(size_t nLocalSize, size_t nRemoteSize)
+{
+    size_t nDifference = nLocalSize > nRemoteSize ? nLocalSize - nRemoteSize : nRemoteSize - nLocalSize;
+    return nDifference + std::min(nLocalSize, nRemoteSize) / 4 + 1;
+}
+
+/** Move the transactions waiting to be reconciled with a peer into a new reconciliation. Requires cs_main. */
+static void StartReconciliation(CNodeState* state)
+{
+    state->mapReconSnapshot.clear();
+    BOOST_FOREACH(const uint256& hash, state->setReconTx)
+        state->mapReconSnapshot[GetReconShortId(state, hash)] = hash;
+    state->setReconTx.clear();
+    state->fReconInProgress = true;
+}
+
+/**
+ * Finish the reconciliation in progress with a peer: announce the transactions
+ * with the given short ids, or all of them if the sketches could not be
+ * decoded. A short id we do not know means the difference was decoded
+ * wrongly, which is handled like a failure. Requires cs_main.
+ */
+static void FinishReconciliation(CNode* pto, CNodeState* state, bool fSuccess, const std::vector<uint32_t>& vShortIds, CConnman& connman)
+{
+    std::vector<CInv> vInv;
+    if (fSuccess) {
+        BOOST_FOREACH(uint32_t nShortId, vShortIds) {
+            std::map<uint32_t, uint256>::const_iterator it = state->mapReconSnapshot.find(nShortId);
+            if (it == state->mapReconSnapshot.end()) {
+                LogPrint("net", "unknown short id %08x in reconciliation with peer=%d\n", nShortId, pto->id);
+                fSuccess = false;
+                vInv.clear();
+                break;
+            }
+            if (mempool.exists(it->second))
+                vInv.push_back(CInv(MSG_TX, it->second));
+        }
+    }
+    if (fSuccess) {
+        state->nReconciliations++;
+    } else {
+        BOOST_FOREACH(const PAIRTYPE(uint32_t, uint256)& entry, state->mapReconSnapshot) {
+            if (mempool.exists(entry.second))
+                vInv.push_back(CInv(MSG_TX, entry.second));
+        }
+        state->nReconFailures++;
+    }
+    if (!vInv.empty())
+        connman.PushMessage(pto, CNetMsgMaker(pto->GetSendVersion()).Make(NetMsgType::INV, vInv));
+    state->mapReconSnapshot.clear();
+    state->fReconInProgress = false;
+}
+
+/** Handle a sendrecon: reconcile transactions with the peer if we offered it as well. */
+static void ProcessSendRecon(CNode* pfrom, CDataStream& vRecv)
+{
+    uint64_t nSalt;
+    vRecv >> nSalt;
+
+    LOCK(cs_main);
+    CNodeState* state = State(pfrom->GetId());
+    if (state->nReconSalt == 0 || state->fReconcile) {
+        LogPrint("net", "ignoring sendrecon from peer=%d\n", pfrom->id);
+        return;
+    }
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << std::min(nSalt, state->nReconSalt) << std::max(nSalt, state->nReconSalt);
+    uint256 hashSalt = ss.GetHash();
+    state->nReconKey0 = hashSalt.GetUint64(0);
+    state->nReconKey1 = hashSalt.GetUint64(1);
+    state->fReconcile = true;
+
+    // We request the reconciliations with outbound peers, and keep flooding
+    // to a few of them so that transactions still propagate quickly.
+    if (!pfrom->fInbound) {
+        if (nReconFloodPeers < RECON_FLOOD_OUTBOUND_PEERS) {
+            state->fReconFlood = true;
+            nReconFloodPeers++;
+        }
+        state->nNextReconRequest = PoissonNextSend(GetMockableTimeMicros(), RECON_REQUEST_INTERVAL);
+    }
+    LogPrint("net", "reconciling transactions with peer=%d%s\n", pfrom->id, state->fReconFlood ? " (flooding)" : "");
+}
+
+/** Handle a reqrecon from an inbound reconciling peer: reply with the sketch of the transactions we want to announce to it. */
+static void ProcessReqRecon(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    uint16_t nRemoteSize;
+    vRecv >> nRemoteSize;
+
+    LOCK(cs_main);
+    CNodeState* state = State(pfrom->GetId());
+    if (!state->fReconcile || !pfrom->fInbound) {
+        LogPrint("net", "ignoring reqrecon from peer=%d\n", pfrom->id);
+        return;
+    }
+
+    // The peer never concluded the previous reconciliation, announce that set normally
+    if (state->fReconInProgress)
+        FinishReconciliation(pfrom, state, false, std::vector<uint32_t>(), connman);
+
+    StartReconciliation(state);
+    size_t nCapacity = EstimateSketchCapacity(state->mapReconSnapshot.size(), nRemoteSize);
+    CSketch sketch;
+    if (nCapacity <= MAX_SKETCH_CAPACITY) {
+        sketch = CSketch(nCapacity);
+        BOOST_FOREACH(const PAIRTYPE(uint32_t, uint256)& entry, state->mapReconSnapshot)
+            sketch.Add(entry.first);
+    }
+    connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::SKETCH, sketch));
+}
+
+/**
+ * Handle the sketch of an outbound reconciling peer: decode the difference
+ * with our own set, ask for the transactions we are missing and announce
+ * the ones the peer is missing.
+ */
+static void ProcessSketch(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    CSketch remoteSketch;
+    vRecv >> remoteSketch;
+
+    LOCK(cs_main);
+    CNodeState* state = State(pfrom->GetId());
+    if (!state->fReconcile || pfrom->fInbound || !state->fReconInProgress) {
+        LogPrint("net", "ignoring unrequested sketch from peer=%d\n", pfrom->id);
+        return;
+    }
+    if (remoteSketch.GetCapacity() > MAX_SKETCH_CAPACITY) {
+        Misbehaving(pfrom->GetId(), 20);
+        LogPrintf("sketch capacity = %u from peer=%d\n", remoteSketch.GetCapacity(), pfrom->id);
+        remoteSketch = CSketch();
+    }
+
+    // An empty sketch means the peer's set differs too much from ours
+    std::vector<uint32_t> vDifference;
+    bool fSuccess = false;
+    if (remoteSketch.GetCapacity() > 0) {
+        CSketch sketch(remoteSketch.GetCapacity());
+        BOOST_FOREACH(const PAIRTYPE(uint32_t, uint256)& entry, state->mapReconSnapshot)
+            sketch.Add(entry.first);
+        sketch.Merge(remoteSketch);
+        fSuccess = sketch.Decode(vDifference);
+    }
+
+    std::vector<uint32_t> vRequest, vAnnounce;
+    BOOST_FOREACH(uint32_t nShortId, vDifference) {
+        if (state->mapReconSnapshot.count(nShortId))
+            vAnnounce.push_back(nShortId);
+        else
+            vRequest.push_back(nShortId);
+    }
+    LogPrint("net", "reconciled %u transactions with peer=%d: %s, requesting %u, announcing %u\n", state->mapReconSnapshot.size(), pfrom->id,
+        fSuccess ? "success" : "failure", vRequest.size(), vAnnounce.size());
+    connman.PushMessage(pfrom, CNetMsgMaker(pfrom->GetSendVersion()).Make(NetMsgType::RECONCILDIFF, fSuccess, vRequest));
+    FinishReconciliation(pfrom, state, fSuccess, vAnnounce, connman);
+}
+
+/** Handle a reconcildiff from an inbound reconciling peer: announce the transactions it is missing. */
+static void ProcessReconcilDiff(CNode* pfrom, CDataStream& vRecv, CConnman& connman)
+{
+    bool fSuccess;
+    std::vector<uint32_t> vRequest;
+    vRecv >> fSuccess >> vRequest;
+
+    LOCK(cs_main);
+    CNodeState* state = State(pfrom->GetId());
+    if (!state->fReconcile || !pfrom->fInbound || !state->fReconInProgress) {
+        LogPrint("net", "ignoring unrequested reconcildiff from peer=%d\n", pfrom->id);
+        return;
+    }
+    if (vRequest.size() > MAX_SKETCH_CAPACITY) {
+        Misbehaving(pfrom->GetId(), 20);
+        LogPrintf("reconcildiff size = %u from peer=%d\n", vRequest.size(), pfrom->id);
+        return;
+    }
+    FinishReconciliation(pfrom, state, fSuccess, vRequest, connman);
+}
+
+/** Try to accept a loose transaction from a peer to the memory pool, relay
+ *  it and resolve orphans depending on it, or handle its rejection */
+void static ProcessTransaction(CNode* pfrom, const CTransactionRef& ptx, const CChainParams& chainparams, CConnman& connman)
+{
+    const CTransaction& tx = *ptx;
+    const CNetMsgMaker msgMaker(pfrom->GetSendVersion());
+    CInv inv(MSG_TX, tx.GetHash());
+    std::deque<COutPoint> vWorkQueue;
+    std::vector<uint256> vEraseQueue;
+
+    LOCK(cs_main);
+
+    bool fMissingInputs = false;
+    CValidationState state;
+
+    pfrom->setAskFor.erase(inv.hash);
+    mapAlreadyAskedFor.erase(inv.hash);
+
+    std::list<CTransactionRef> lRemovedTxn;
+
+    if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, &lRemovedTxn)) {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx, connman);
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            vWorkQueue.emplace_back(inv.hash, i);
+        }
+
+        pfrom->nLastTXTime = GetTime();
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
+            pfrom->id,
+            tx.GetHash().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this one
+        std::set<NodeId> setMisbehaving;
+        while (!vWorkQueue.empty()) {
+            auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
+            vWorkQueue.pop_front();
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            for (auto mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end();
+                 ++mi)
+            {
+                const CTransactionRef& porphanTx = (*mi)->second.tx;
+                const CTransaction& orphanTx = *porphanTx;
+                const uint256& orphanHash = orphanTx.GetHash();
+                NodeId fromPeer = (*mi)->second.fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx, connman);
+                    for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
+                        vWorkQueue.emplace_back(orphanHash, i);
+                    }
+                    vEraseQueue.push_back(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    vEraseQueue.push_back(orphanHash);
+                    if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
+                        // Do not use rejection cache for witness transactions or
+                        // witness-stripped transactions, as they can have been malleated.
+                        // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+                        assert(recentRejects);
+                        recentRejects->insert(orphanHash);
+                    }
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        BOOST_FOREACH(uint256 hash, vEraseQueue)
+            EraseOrphanTx(hash);
+    }
+    else if (fMissingInputs)
+    {
+        bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (recentRejects->contains(txin.prevout.hash)) {
+                fRejectedParents = true;
+                break;
+            }
+        }
+        if (!fRejectedParents) {
+            uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
+                pfrom->AddInventoryKnown(_inv);
+                if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
+            }
+            AddOrphanTx(ptx, pfrom->GetId());
+
+            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+            if (nEvicted > 0)
+                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+        } else {
+            LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
+            // We will continue to reject this tx since it has rejected
+            // parents so avoid re-requesting it from other peers.
+            recentRejects->insert(tx.GetHash());
+        }
+    } else {
+        if (!tx.HasWitness() && !state.CorruptionPossible()) {
+            // Do not use rejection cache for witness transactions or
+            // witness-stripped transactions, as they can have been malleated.
+            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
+            assert(recentRejects);
+            recentRejects->insert(tx.GetHash());
+            if (RecursiveDynamicUsage(*ptx) < 100000) {
+                AddToCompactExtraTransactions(ptx);
+            }
+        } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
+            AddToCompactExtraTransactions(ptx);
+        }
+
+        if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                RelayTransaction(tx, connman);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
+            }
+        }
+    }
+
+    for (const CTransactionRef& removedTx : lRemovedTxn)
+        AddToCompactExtraTransactions(removedTx);
+
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
+            pfrom->id,
+            FormatStateMessage(state));
+        if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, std::string(NetMsgType::TX), (unsigned char)state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
+        if (nDoS > 0) {
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
+/** Process the peer's transactions the verification threads are done with,
+ *  in the order they arrived. Returns whether any are still being checked. */
+static bool ProcessCheckedTransactions(CNode* pfrom, const CChainParams& chainparams, CConnman& connman)
+{
+    while (true) {
+        CTransactionRef ptx;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexPendingTx);
+            std::map<NodeId, std::deque<std::shared_ptr<PendingTx> > >::iterator it = mapPendingTx.find(pfrom->GetId());
+            if (it == mapPendingTx.end())
+                return false;
+            if (!it->second.front()->fChecked)
+                return true;
+            ptx = it->second.front()->tx;
+            it->second.pop_front();
+            if (it->second.empty())
+                mapPendingTx.erase(it);
+        }
+        ProcessTransaction(pfrom, ptx, chainparams, connman);
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CChainParams& chainparams, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
@@ -1422,6 +2435,23 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             nCMPCTBLOCKVersion = 1;
             connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDCMPCT, fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion));
         }
+        bool fRelayTxes;
+        {
+            LOCK(pfrom->cs_filter);
+            fRelayTxes = pfrom->fRelayTxes;
+        }
+        if ((pfrom->GetLocalServices() & NODE_TXRECON) && (pfrom->nServices & NODE_TXRECON) && fRelayTxes) {
+            // Offer to reconcile transactions, which starts once the peer offered it too
+            uint64_t nSalt = 0;
+            while (nSalt == 0) {
+                GetRandBytes((unsigned char*)&nSalt, sizeof(nSalt));
+            }
+            {
+                LOCK(cs_main);
+                State(pfrom->GetId())->nReconSalt = nSalt;
+            }
+            connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::SENDRECON, nSalt));
+        }
         pfrom->fSuccessfullyConnected = true;
     }
 
@@ -1506,6 +2536,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 else
                     State(pfrom->GetId())->fSupportsDesiredCmpctVersion = (nCMPCTBLOCKVersion == 1);
             }
+            if (pfrom->fWhitelisted && GetBoolArg("-whitelistcmpctrelay", DEFAULT_WHITELISTCMPCTRELAY))
+                MaybeSetPeerAsAnnouncingHeaderAndIDs(pfrom->GetId(), connman);
         }
     }
 
@@ -1681,6 +2713,17 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
 
         BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
         if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            std::list<EarlyRelayedBlock>::iterator itEarly = FindEarlyRelayedBlock(req.blockhash);
+            if (itEarly != lEarlyRelayedBlocks.end() && pfrom->fWhitelisted) {
+                // We relayed this block before having it (-whitelistcmpctrelay)
+                if (itEarly->pblock) {
+                    SendBlockTransactions(*itEarly->pblock, req, pfrom, connman);
+                } else {
+                    LogPrint("net", "Peer %d sent us a getblocktxn for a block we relayed early, answering once we have it\n", pfrom->id);
+                    itEarly->vRequests.push_back(std::make_pair(pfrom->GetId(), req));
+                }
+                return true;
+            }
             LogPrintf("Peer %d sent us a getblocktxn for a block we don't have", pfrom->id);
             return true;
         }
@@ -1777,8 +2820,6 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
-        std::deque<COutPoint> vWorkQueue;
-        std::vector<uint256> vEraseQueue;
         CTransactionRef ptx;
         vRecv >> ptx;
         const CTransaction& tx = *ptx;
@@ -1786,169 +2827,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        LOCK(cs_main);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
-        pfrom->setAskFor.erase(inv.hash);
-        mapAlreadyAskedFor.erase(inv.hash);
-
-        std::list<CTransactionRef> lRemovedTxn;
-
-        if (!AlreadyHave(inv) && AcceptToMemoryPool(mempool, state, ptx, true, &fMissingInputs, &lRemovedTxn)) {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx, connman);
-            for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                vWorkQueue.emplace_back(inv.hash, i);
-            }
-
-            pfrom->nLastTXTime = GetTime();
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->id,
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            std::set<NodeId> setMisbehaving;
-            while (!vWorkQueue.empty()) {
-                auto itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue.front());
-                vWorkQueue.pop_front();
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (auto mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const CTransactionRef& porphanTx = (*mi)->second.tx;
-                    const CTransaction& orphanTx = *porphanTx;
-                    const uint256& orphanHash = orphanTx.GetHash();
-                    NodeId fromPeer = (*mi)->second.fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, porphanTx, true, &fMissingInputs2, &lRemovedTxn)) {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx, connman);
-                        for (unsigned int i = 0; i < orphanTx.vout.size(); i++) {
-                            vWorkQueue.emplace_back(orphanHash, i);
-                        }
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        if (!orphanTx.HasWitness() && !stateDummy.CorruptionPossible()) {
-                            // Do not use rejection cache for witness transactions or
-                            // witness-stripped transactions, as they can have been malleated.
-                            // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                            assert(recentRejects);
-                            recentRejects->insert(orphanHash);
-                        }
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
-
-            BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        else if (fMissingInputs)
-        {
-            bool fRejectedParents = false; // It may be the case that the orphans parents have all been rejected
-            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                if (recentRejects->contains(txin.prevout.hash)) {
-                    fRejectedParents = true;
-                    break;
-                }
-            }
-            if (!fRejectedParents) {
-                uint32_t nFetchFlags = GetFetchFlags(pfrom, chainActive.Tip(), chainparams.GetConsensus());
-                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
-                    CInv _inv(MSG_TX | nFetchFlags, txin.prevout.hash);
-                    pfrom->AddInventoryKnown(_inv);
-                    if (!AlreadyHave(_inv)) pfrom->AskFor(_inv);
-                }
-                AddOrphanTx(ptx, pfrom->GetId());
-
-                // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-                unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-                unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-                if (nEvicted > 0)
-                    LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-            } else {
-                LogPrint("mempool", "not keeping orphan with rejected parents %s\n",tx.GetHash().ToString());
-                // We will continue to reject this tx since it has rejected
-                // parents so avoid re-requesting it from other peers.
-                recentRejects->insert(tx.GetHash());
-            }
-        } else {
-            if (!tx.HasWitness() && !state.CorruptionPossible()) {
-                // Do not use rejection cache for witness transactions or
-                // witness-stripped transactions, as they can have been malleated.
-                // See https://github.com/bitcoin/bitcoin/issues/8279 for details.
-                assert(recentRejects);
-                recentRejects->insert(tx.GetHash());
-                if (RecursiveDynamicUsage(*ptx) < 100000) {
-                    AddToCompactExtraTransactions(ptx);
-                }
-            } else if (tx.HasWitness() && RecursiveDynamicUsage(*ptx) < 100000) {
-                AddToCompactExtraTransactions(ptx);
-            }
-
-            if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx, connman);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s)\n", tx.GetHash().ToString(), pfrom->id, FormatStateMessage(state));
-                }
-            }
-        }
-
-        for (const CTransactionRef& removedTx : lRemovedTxn)
-            AddToCompactExtraTransactions(removedTx);
-
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempoolrej", "%s from peer=%d was not accepted: %s\n", tx.GetHash().ToString(),
-                pfrom->id,
-                FormatStateMessage(state));
-            if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
-                connman.PushMessage(pfrom, msgMaker.Make(NetMsgType::REJECT, strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash));
-            if (nDoS > 0) {
-                Misbehaving(pfrom->GetId(), nDoS);
-            }
-        }
+        if (!QueueTransactionCheck(pfrom, ptx))
+            ProcessTransaction(pfrom, ptx, chainparams, connman);
     }
 
 
@@ -2023,12 +2903,19 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             return true;
         }
 
+        CNodeState *nodestate = State(pfrom->GetId());
+
+        if (pfrom->fWhitelisted && nodestate->fSupportsDesiredCmpctVersion && GetBoolArg("-whitelistcmpctrelay", DEFAULT_WHITELISTCMPCTRELAY) &&
+                !IsInitialBlockDownload()) {
+            // The header is valid and has more work than our tip, which is all we
+            // check before passing a new block on within a set of trusted peers.
+            RelayCmpctBlockToWhitelistedPeers(pindex, cmpctblock, (pfrom->GetLocalServices() & NODE_WITNESS) != 0, pfrom->GetId(), connman);
+        }
+
         // If we're not close to tip yet, give up and let parallel block fetch work its magic
         if (!fAlreadyInFlight && !CanDirectFetch(chainparams.GetConsensus()))
             return true;
 
-        CNodeState *nodestate = State(pfrom->GetId());
-
         if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus()) && !nodestate->fSupportsDesiredCmpctVersion) {
             // Don't bother trying to process compact blocks from v1 peers
             // after segwit activates.
@@ -2097,6 +2984,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 status = tempBlock.FillBlock(*pblock, dummy);
                 if (status == READ_STATUS_OK) {
                     fBlockReconstructed = true;
+                    AnswerEarlyRelayedBlockRequests(*pblock, connman, pblock);
                 }
             }
         } else {
@@ -2197,6 +3085,8 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 // updated, reject messages go out, etc.
                 MarkBlockAsReceived(resp.blockhash); // it is now an empty pointer
                 fBlockRead = true;
+                if (status == READ_STATUS_OK)
+                    AnswerEarlyRelayedBlockRequests(*pblock, connman, pblock);
                 // mapBlockSource is only used for sending reject messages and DoS scores,
                 // so the race between here and cs_main in ProcessNewBlock is fine.
                 // BIP 152 permits peers to relay compact blocks after validating
@@ -2368,6 +3258,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        unsigned int nBlockSize = vRecv.size();
         vRecv >> *pblock;
 
         LogPrint("net", "received block %s peer=%d\n", pblock->GetHash().ToString(), pfrom->id);
@@ -2382,6 +3273,7 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
             LOCK(cs_main);
             // Also always process if we requested the block explicitly, as we may
             // need it even though it is not a candidate for a new best tip.
+            UpdateBlockDownloadSpeed(pfrom->GetId(), hash, nBlockSize);
             forceProcessing |= MarkBlockAsReceived(hash);
             // mapBlockSource is only used for sending reject messages and DoS scores,
             // so the race between here and cs_main in ProcessNewBlock is fine.
@@ -2414,7 +3306,10 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_addrSend);
+            pfrom->vAddrToSend.clear();
+        }
         std::vector<CAddress> vAddr = connman.GetAddresses();
         FastRandomContext insecure_rand;
         BOOST_FOREACH(const CAddress &addr, vAddr)
@@ -2591,6 +3486,34 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         }
     }
 
+    else if (strCommand == NetMsgType::GETCFILTERS) {
+        ProcessGetCFilters(pfrom, vRecv, connman);
+    }
+
+    else if (strCommand == NetMsgType::GETCFHEADERS) {
+        ProcessGetCFHeaders(pfrom, vRecv, connman);
+    }
+
+    else if (strCommand == NetMsgType::GETCFCHECKPT) {
+        ProcessGetCFCheckPt(pfrom, vRecv, connman);
+    }
+
+    else if (strCommand == NetMsgType::SENDRECON) {
+        ProcessSendRecon(pfrom, vRecv);
+    }
+
+    else if (strCommand == NetMsgType::REQRECON) {
+        ProcessReqRecon(pfrom, vRecv, connman);
+    }
+
+    else if (strCommand == NetMsgType::SKETCH) {
+        ProcessSketch(pfrom, vRecv, connman);
+    }
+
+    else if (strCommand == NetMsgType::RECONCILDIFF) {
+        ProcessReconcilDiff(pfrom, vRecv, connman);
+    }
+
     else if (strCommand == NetMsgType::NOTFOUND) {
         // We do not care about the NOTFOUND message, but logging an Unknown Command
         // message would be undesirable as we transmit it ourselves.
@@ -2636,6 +3559,16 @@ static bool SendRejectsAndCheckIfBanned(CNode* pnode, CConnman& connman)
     return false;
 }
 
+/** Messages whose successful processing doesn't need cs_main */
+static bool IsMessageWithoutMainLock(const std::string& strCommand)
+{
+    return strCommand == NetMsgType::PING ||
+           strCommand == NetMsgType::PONG ||
+           strCommand == NetMsgType::ADDR ||
+           strCommand == NetMsgType::GETADDR ||
+           strCommand == NetMsgType::FEEFILTER;
+}
+
 bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interruptMsgProc)
 {
     const CChainParams& chainparams = Params();
@@ -2658,6 +3591,12 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return true;
 
+    // Transactions from the peer still being checked hold back its later
+    // messages, except further transactions
+    bool fPendingTx = ProcessCheckedTransactions(pfrom, chainparams, connman);
+    if (pfrom->fDisconnect)
+        return false;
+
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->fPauseSend)
             return false;
@@ -2667,6 +3606,8 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             LOCK(pfrom->cs_vProcessMsg);
             if (pfrom->vProcessMsg.empty())
                 return false;
+            if (fPendingTx && (pfrom->vProcessMsg.front().hdr.GetCommand() != NetMsgType::TX || CountPendingTransactions(pfrom->GetId()) >= MAX_PEER_PENDING_TX))
+                return false;
             // Just take one message
             msgs.splice(msgs.begin(), pfrom->vProcessMsg, pfrom->vProcessMsg.begin());
             pfrom->nProcessQueueSize -= msgs.front().vRecv.size() + CMessageHeader::HEADER_SIZE;
@@ -2750,6 +3691,12 @@ bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& i
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
         }
 
+        // These don't take cs_main unless they fail, so other message handler
+        // threads are not held up for them; rejects and bans queued in the
+        // meantime are sent by SendMessages.
+        if (fRet && IsMessageWithoutMainLock(strCommand))
+            return fMoreWork;
+
         LOCK(cs_main);
         SendRejectsAndCheckIfBanned(pfrom, connman);
 
@@ -2833,6 +3780,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         //
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
+            LOCK(pto->cs_addrSend);
             std::vector<CAddress> vAddr;
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
@@ -2964,16 +3912,21 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                             vHeaders.front().GetHash().ToString(), pto->id);
 
                     int nSendFlags = state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS;
+                    const uint256 hashBlock = pBestIndex->GetBlockHash();
 
+                    CSharedNetMsgPayloadRef payload = payloadCache.Find(hashBlock, NetMsgType::CMPCTBLOCK, msgMaker, nSendFlags);
                     bool fGotBlockFromCache = false;
-                    {
+                    if (payload) {
+                        connman.PushMessage(pto, msgMaker.MakeShared(NetMsgType::CMPCTBLOCK, payload));
+                        fGotBlockFromCache = true;
+                    } else {
                         LOCK(cs_most_recent_block);
-                        if (most_recent_block_hash == pBestIndex->GetBlockHash()) {
+                        if (most_recent_block_hash == hashBlock) {
                             if (state.fWantsCmpctWitness)
-                                connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, *most_recent_compact_block));
+                                connman.PushMessage(pto, MakeCachedMsg(msgMaker, nSendFlags, NetMsgType::CMPCTBLOCK, hashBlock, *most_recent_compact_block));
                             else {
                                 CBlockHeaderAndShortTxIDs cmpctblock(*most_recent_block, state.fWantsCmpctWitness);
-                                connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                                connman.PushMessage(pto, MakeCachedMsg(msgMaker, nSendFlags, NetMsgType::CMPCTBLOCK, hashBlock, cmpctblock));
                             }
                             fGotBlockFromCache = true;
                         }
@@ -2983,7 +3936,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         bool ret = ReadBlockFromDisk(block, pBestIndex, consensusParams);
                         assert(ret);
                         CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
-                        connman.PushMessage(pto, msgMaker.Make(nSendFlags, NetMsgType::CMPCTBLOCK, cmpctblock));
+                        connman.PushMessage(pto, MakeCachedMsg(msgMaker, nSendFlags, NetMsgType::CMPCTBLOCK, hashBlock, cmpctblock));
                     }
                     state.pindexBestHeaderSent = pBestIndex;
                 } else if (state.fPreferHeaders) {
@@ -3137,9 +4090,25 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
                         continue;
                     }
                     if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
-                    // Send
-                    vInv.push_back(CInv(MSG_TX, hash));
-                    nRelayedTransactions++;
+                    // Send, or leave it to the next reconciliation
+                    if (state.fReconcile && !state.fReconFlood) {
+                        state.setReconTx.insert(hash);
+                        // Too many for a sketch, and the peer may never ask: announce them all
+                        if (state.setReconTx.size() >= MAX_RECON_SET_SIZE) {
+                            BOOST_FOREACH(const uint256& hashRecon, state.setReconTx) {
+                                vInv.push_back(CInv(MSG_TX, hashRecon));
+                                if (vInv.size() == MAX_INV_SZ) {
+                                    connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
+                                    vInv.clear();
+                                }
+                            }
+                            nRelayedTransactions += state.setReconTx.size();
+                            state.setReconTx.clear();
+                        }
+                    } else {
+                        vInv.push_back(CInv(MSG_TX, hash));
+                        nRelayedTransactions++;
+                    }
                     {
                         // Expire old relay messages
                         while (!vRelayExpiration.empty() && vRelayExpiration.front().first < nNow)
@@ -3164,9 +4133,27 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         if (!vInv.empty())
             connman.PushMessage(pto, msgMaker.Make(NetMsgType::INV, vInv));
 
-        // Detect whether we're stalling
-        nNow = GetTimeMicros();
-        if (state.nStallingSince && state.nStallingSince < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+        //
+        // Message: reqrecon
+        //
+        if (state.fReconcile && !pto->fInbound) {
+            int64_t nReconNow = GetMockableTimeMicros();
+            // The peer never sent its sketch, announce that set normally
+            if (state.fReconInProgress && state.nReconRequestTime < nReconNow - RECON_RESPONSE_TIMEOUT * 1000000LL) {
+                LogPrint("net", "reconciliation with peer=%d timed out\n", pto->id);
+                FinishReconciliation(pto, &state, false, std::vector<uint32_t>(), connman);
+            }
+            if (!state.fReconInProgress && state.nNextReconRequest < nReconNow) {
+                StartReconciliation(&state);
+                connman.PushMessage(pto, msgMaker.Make(NetMsgType::REQRECON, (uint16_t)state.mapReconSnapshot.size()));
+                state.nReconRequestTime = nReconNow;
+                state.nNextReconRequest = PoissonNextSend(nReconNow, RECON_REQUEST_INTERVAL);
+            }
+        }
+
+        // Detect whether we're stalling. Block download times follow mock time.
+        int64_t nDownloadNow = GetMockableTimeMicros();
+        if (state.nStallingSince && state.nStallingSince < nDownloadNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
             // Stalling only triggers when the block download window cannot move. During normal steady state,
             // the download window should be much larger than the to-be-downloaded set of blocks, so disconnection
             // should only happen during initial block download.
@@ -3182,7 +4169,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         if (state.vBlocksInFlight.size() > 0) {
             QueuedBlock &queuedBlock = state.vBlocksInFlight.front();
             int nOtherPeersWithValidatedDownloads = nPeersWithValidatedDownloads - (state.nBlocksInFlightValidHeaders > 0);
-            if (nNow > state.nDownloadingSince + consensusParams.nPowTargetSpacing * (BLOCK_DOWNLOAD_TIMEOUT_BASE + BLOCK_DOWNLOAD_TIMEOUT_PER_PEER * nOtherPeersWithValidatedDownloads)) {
+            if (nDownloadNow > state.nDownloadingSince + consensusParams.nPowTargetSpacing * (BLOCK_DOWNLOAD_TIMEOUT_BASE + BLOCK_DOWNLOAD_TIMEOUT_PER_PEER * nOtherPeersWithValidatedDownloads)) {
                 LogPrintf("Timeout downloading block %s from peer=%d, disconnecting\n", queuedBlock.hash.ToString(), pto->id);
                 pto->fDisconnect = true;
                 return true;
@@ -3193,10 +4180,11 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         // Message: getdata (blocks)
         //
         std::vector<CInv> vGetData;
-        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nMaxBlocksInTransit = GetMaxBlocksInTransit(&state);
+        if (!pto->fClient && (fFetch || !IsInitialBlockDownload()) && state.nBlocksInFlight < nMaxBlocksInTransit) {
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindNextBlocksToDownload(pto->GetId(), nMaxBlocksInTransit - state.nBlocksInFlight, vToDownload, staller, consensusParams);
             BOOST_FOREACH(const CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
@@ -3206,7 +4194,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
             }
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
-                    State(staller)->nStallingSince = nNow;
+                    State(staller)->nStallingSince = nDownloadNow;
                     LogPrint("net", "Stall started peer=%d\n", staller);
                 }
             }
@@ -3215,6 +4203,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
         //
         // Message: getdata (non-blocks)
         //
+        nNow = GetTimeMicros();
         while (!pto->mapAskFor.empty() && (*pto->mapAskFor.begin()).first <= nNow)
         {
             const CInv& inv = (*pto->mapAskFor.begin()).second;
@@ -17,6 +17,8 @@ static const int64_t ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 static const int64_t ORPHAN_TX_EXPIRE_INTERVAL = 5 * 60;
 /** Default number of orphan+recently-replaced txn to keep around for block reconstruction */
 static const unsigned int DEFAULT_BLOCK_RECONSTRUCTION_EXTRA_TXN = 100;
+/** Maximum number of transactions from one peer waiting for a verification thread */
+static const unsigned int MAX_PEER_PENDING_TX = 100;
 
 /** Register with a network node to receive its signals */
 void RegisterNodeSignals(CNodeSignals& nodeSignals);
@@ -41,13 +43,34 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    int nMaxBlocksInTransit;
+    int64_t nBlockDownloadTime;
+    int64_t nBlockDownloadRate;
+    int nBlocksRerequested;
+    int64_t nBlockAnnounceDelay;
+    int nBlocksAnnouncedFirst;
+    bool fTxReconciliation;
+    int nReconciliations;
+    int nReconFailures;
 };
 
+/** Number of blocks to keep in flight from a peer that takes nBlockDownloadTime microseconds to
+ *  deliver a block: enough to keep it busy for BLOCK_DOWNLOAD_QUEUE_TARGET once that is measured. */
+int GetMaxBlocksInTransit(int64_t nBlockDownloadTime);
+/** Whether a block that has been downloading for nWaiting microseconds from a peer taking
+ *  nOtherDownloadTime per block should be requested again from a peer taking nBlockDownloadTime,
+ *  which is expected to deliver it much sooner. Download times are 0 until measured. */
+bool ShouldRerequestBlock(int64_t nBlockDownloadTime, int64_t nOtherDownloadTime, int64_t nWaiting);
+
 /** Get statistics from node state */
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 /** Increase a node's misbehavior score. */
 void Misbehaving(NodeId nodeid, int howmuch);
 
+/** Check the scripts of transactions received from peers without holding
+ *  cs_main, before the message handler accepts them to the mempool */
+void ThreadTxVerify(CConnman* connman);
+
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom, CConnman& connman, const std::atomic<bool>& interrupt);
 /**
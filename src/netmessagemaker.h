@@ -29,6 +29,26 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    /** Serialize a payload once, to be sent to several peers with MakeShared */
+    template <typename... Args>
+    CSharedNetMsgPayloadRef MakePayload(int nFlags, Args&&... args) const
+    {
+        std::shared_ptr<CSharedNetMsgPayload> payload = std::make_shared<CSharedNetMsgPayload>();
+        CVectorWriter{ SER_NETWORK, nFlags | nVersion, payload->data, 0, std::forward<Args>(args)... };
+        payload->hash = Hash(payload->data.begin(), payload->data.end());
+        return payload;
+    }
+
+    CSerializedNetMsg MakeShared(std::string sCommand, CSharedNetMsgPayloadRef payload) const
+    {
+        CSerializedNetMsg msg;
+        msg.command = std::move(sCommand);
+        msg.shared = std::move(payload);
+        return msg;
+    }
+
+    int GetVersion() const { return nVersion; }
+
 private:
     const int nVersion;
 };
@@ -17,37 +17,47 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay)
 {
     decay = _decay;
+    scale = 1;
     for (unsigned int i = 0; i < defaultBuckets.size(); i++) {
         buckets.push_back(defaultBuckets[i]);
         bucketMap[defaultBuckets[i]] = i;
     }
     confAvg.resize(maxConfirms);
-    curBlockConf.resize(maxConfirms);
     unconfTxs.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
         confAvg[i].resize(buckets.size());
-        curBlockConf[i].resize(buckets.size());
         unconfTxs[i].resize(buckets.size());
     }
 
     oldUnconfTxs.resize(buckets.size());
-    curBlockTxCt.resize(buckets.size());
     txCtAvg.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
     avg.resize(buckets.size());
 }
 
-// Zero out the data for the current block
 void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
         oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
         unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
-        for (unsigned int i = 0; i < curBlockConf.size(); i++)
-            curBlockConf[i][j] = 0;
-        curBlockTxCt[j] = 0;
-        curBlockVal[j] = 0;
     }
+
+    // Decaying every average by decay is the same as counting everything
+    // recorded from now on 1/decay times as much. Renormalize well before
+    // the scale could lose precision or overflow.
+    scale /= decay;
+    if (scale > 1e100)
+        Normalize();
+}
+
+void TxConfirmStats::Normalize()
+{
+    for (unsigned int j = 0; j < buckets.size(); j++) {
+        for (unsigned int i = 0; i < confAvg.size(); i++)
+            confAvg[i][j] /= scale;
+        avg[j] /= scale;
+        txCtAvg[j] /= scale;
+    }
+    scale = 1;
 }
 
 
@@ -57,21 +67,11 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     if (blocksToConfirm < 1)
         return;
     unsigned int bucketindex = bucketMap.lower_bound(val)->second;
-    for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
-        curBlockConf[i - 1][bucketindex]++;
-    }
-    curBlockTxCt[bucketindex]++;
-    curBlockVal[bucketindex] += val;
-}
-
-void TxConfirmStats::UpdateMovingAverages()
-{
-    for (unsigned int j = 0; j < buckets.size(); j++) {
-        for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+    for (size_t i = blocksToConfirm; i <= confAvg.size(); i++) {
+        confAvg[i - 1][bucketindex] += scale;
     }
+    txCtAvg[bucketindex] += scale;
+    avg[bucketindex] += val * scale;
 }
 
 // returns -1 on error conditions
@@ -109,8 +109,8 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     // Start counting from highest(default) or lowest feerate transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
+        nConf += confAvg[confTarget - 1][bucket] / scale;
+        totalNum += txCtAvg[bucket] / scale;
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
             extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
         extraNum += oldUnconfTxs[bucket];
@@ -148,6 +148,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     // Find the bucket with the median transaction and then report the average feerate from that bucket
     // This is a compromise between finding the median which we can't since we don't save all tx's
     // and reporting the average which is less accurate
+    // (The scale of the moving averages cancels out here, so they are used as stored.)
     unsigned int minBucket = bestNearBucket < bestFarBucket ? bestNearBucket : bestFarBucket;
     unsigned int maxBucket = bestNearBucket > bestFarBucket ? bestNearBucket : bestFarBucket;
     for (unsigned int j = minBucket; j <= maxBucket; j++) {
@@ -175,6 +176,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    Normalize();
     fileout << decay;
     fileout << buckets;
     fileout << avg;
@@ -217,21 +219,15 @@ void TxConfirmStats::Read(CAutoFile& filein)
     // Now that we've processed the entire feerate estimate data file and not
     // thrown any errors, we can copy it to our data structures
     decay = fileDecay;
+    scale = 1;
     buckets = fileBuckets;
     avg = fileAvg;
     confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
     bucketMap.clear();
 
-    // Resize the current block variables which aren't stored in the data file
+    // Resize the mempool counts which aren't stored in the data file
     // to match the number of confirms and buckets
-    curBlockConf.resize(maxConfirms);
-    for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
-    }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
-
     unconfTxs.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
         unconfTxs[i].resize(buckets.size());
@@ -292,6 +288,7 @@ bool CBlockPolicyEstimator::removeTx(uint256 hash)
     if (pos != mapMemPoolTxs.end()) {
         feeStats.removeTx(pos->second.blockHeight, nBestSeenHeight, pos->second.bucketIndex);
         mapMemPoolTxs.erase(hash);
+        mapEstimateCache.clear();
         return true;
     } else {
         return false;
@@ -342,6 +339,7 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
 
     mapMemPoolTxs[hash].blockHeight = txHeight;
     mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+    mapEstimateCache.clear();
 }
 
 bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry)
@@ -370,7 +368,7 @@ bool CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
 }
 
 void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
-                                         std::vector<const CTxMemPoolEntry*>& entries)
+                                         const std::vector<const CTxMemPoolEntry*>& entries)
 {
     if (nBlockHeight <= nBestSeenHeight) {
         // Ignore side chains and re-orgs; assuming they are random
@@ -386,18 +384,17 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     // of unconfirmed txs to remove from tracking.
     nBestSeenHeight = nBlockHeight;
 
-    // Clear the current block state and update unconfirmed circular buffer
+    // Decay the moving averages and update unconfirmed circular buffer
     feeStats.ClearCurrent(nBlockHeight);
 
     unsigned int countedTxs = 0;
-    // Repopulate the current block states
+    // Add the block's transactions to the moving averages
     for (unsigned int i = 0; i < entries.size(); i++) {
         if (processBlockTx(nBlockHeight, entries[i]))
             countedTxs++;
     }
 
-    // Update all exponential averages with the current block state
-    feeStats.UpdateMovingAverages();
+    mapEstimateCache.clear();
 
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u of %u txs in block, since last block %u of %u tracked, new mempool map size %u\n",
              countedTxs, entries.size(), trackedTxs, trackedTxs + untrackedTxs, mapMemPoolTxs.size());
@@ -413,7 +410,7 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     if (confTarget <= 1 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    double median = EstimateMedianVal(confTarget, MIN_SUCCESS_PCT);
 
     if (median < 0)
         return CFeeRate(0);
@@ -421,25 +418,43 @@ CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
     return CFeeRate(median);
 }
 
-CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
+double CBlockPolicyEstimator::EstimateMedianVal(int confTarget, double successThreshold)
 {
-    if (answerFoundAtTarget)
-        *answerFoundAtTarget = confTarget;
-    // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
-        return CFeeRate(0);
+    std::pair<int, double> key(confTarget, successThreshold);
+    std::map<std::pair<int, double>, double>::const_iterator it = mapEstimateCache.find(key);
+    if (it != mapEstimateCache.end())
+        return it->second;
+
+    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, successThreshold, true, nBestSeenHeight);
+    mapEstimateCache[key] = median;
+    return median;
+}
 
+double CBlockPolicyEstimator::EstimateSmartMedianVal(int confTarget, double successThreshold, int *answerFoundAtTarget)
+{
     // It's not possible to get reasonable estimates for confTarget of 1
     if (confTarget == 1)
         confTarget = 2;
 
     double median = -1;
     while (median < 0 && (unsigned int)confTarget <= feeStats.GetMaxConfirms()) {
-        median = feeStats.EstimateMedianVal(confTarget++, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+        median = EstimateMedianVal(confTarget++, successThreshold);
     }
 
     if (answerFoundAtTarget)
         *answerFoundAtTarget = confTarget - 1;
+    return median;
+}
+
+CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool)
+{
+    if (answerFoundAtTarget)
+        *answerFoundAtTarget = confTarget;
+    // Return failure if trying to analyze a target we're not tracking
+    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
+        return CFeeRate(0);
+
+    double median = EstimateSmartMedianVal(confTarget, MIN_SUCCESS_PCT, answerFoundAtTarget);
 
     // If mempool is limiting txs , return at least the min feerate from the mempool
     CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
@@ -452,6 +467,21 @@ CFeeRate CBlockPolicyEstimator::estimateSmartFee(int confTarget, int *answerFoun
     return CFeeRate(median);
 }
 
+std::vector<std::pair<CFeeRate, int> > CBlockPolicyEstimator::estimateSmartFeeCurve(double successThreshold, const CTxMemPool& pool)
+{
+    std::vector<std::pair<CFeeRate, int> > curve;
+    curve.reserve(feeStats.GetMaxConfirms());
+    CAmount minPoolFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFeePerK();
+    for (unsigned int confTarget = 1; confTarget <= feeStats.GetMaxConfirms(); confTarget++) {
+        int answerFoundAtTarget;
+        double median = EstimateSmartMedianVal(confTarget, successThreshold, &answerFoundAtTarget);
+        if (minPoolFee > 0 && minPoolFee > median)
+            median = minPoolFee;
+        curve.push_back(std::make_pair(CFeeRate(median < 0 ? 0 : median), answerFoundAtTarget));
+    }
+    return curve;
+}
+
 double CBlockPolicyEstimator::estimatePriority(int confTarget)
 {
     return -1;
@@ -482,6 +512,7 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein, int nFileVersion)
     filein >> nFileBestSeenHeight;
     feeStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+    mapEstimateCache.clear();
     if (nFileVersion < 139900) {
         TxConfirmStats priStats;
         priStats.Read(filein);
@@ -78,26 +78,26 @@ private:
     // Count the total # of txs in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> txCtAvg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<int> curBlockTxCt;
 
     // Count the total # of txs confirmed within Y blocks in each bucket
     // Track the historical moving average of theses totals over blocks
     std::vector<std::vector<double> > confAvg; // confAvg[Y][X]
-    // and calculate the totals for the current block to update the moving averages
-    std::vector<std::vector<int> > curBlockConf; // curBlockConf[Y][X]
 
     // Sum the total feerate of all tx's in each bucket
     // Track the historical moving average of this total over blocks
     std::vector<double> avg;
-    // and calculate the total for the current block to update the moving average
-    std::vector<double> curBlockVal;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg feerate per bucket
 
     double decay;
 
+    // The moving averages above are kept multiplied by decay^-n, n being the
+    // number of blocks since they were last normalized. Decaying them for a new
+    // block is then just a change of scale, and a block's data points are added
+    // straight in, scaled up, instead of touching every average every block.
+    double scale;
+
     // Mempool counts of outstanding transactions
     // For each bucket X, track the number of transactions in the mempool
     // that are unconfirmed for each possible confirmation value Y
@@ -105,6 +105,9 @@ private:
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    /** Fold the pending scale into the moving averages */
+    void Normalize();
+
 public:
     /**
      * Initialize the data structures.  This is called by BlockPolicyEstimator's
@@ -115,11 +118,14 @@ public:
      */
     void Initialize(std::vector<double>& defaultBuckets, unsigned int maxConfirms, double decay);
 
-    /** Clear the state of the curBlock variables to start counting for the new block */
+    /**
+     * Start counting for a new block: decay the historical moving averages and
+     * clear the unconfirmed counts of the slot the new block height reuses.
+     */
     void ClearCurrent(unsigned int nBlockHeight);
 
     /**
-     * Record a new transaction data point in the current block stats
+     * Record a new transaction data point in the moving averages
      * @param blocksToConfirm the number of blocks it took this transaction to confirm
      * @param val the feerate of the transaction
      * @warning blocksToConfirm is 1-based and has to be >= 1
@@ -133,10 +139,6 @@ public:
     void removeTx(unsigned int entryHeight, unsigned int nBestSeenHeight,
                   unsigned int bucketIndex);
 
-    /** Update our estimates by decaying our historical moving average and updating
-        with the data gathered from the current block */
-    void UpdateMovingAverages();
-
     /**
      * Calculate a feerate estimate.  Find the lowest value bucket (or range of buckets
      * to make sure we have enough data points) whose transactions still have sufficient likelihood
@@ -152,7 +154,7 @@ public:
                              double minSuccess, bool requireGreater, unsigned int nBlockHeight);
 
     /** Return the max number of confirms we're tracking */
-    unsigned int GetMaxConfirms() { return confAvg.size(); }
+    unsigned int GetMaxConfirms() const { return confAvg.size(); }
 
     /** Write state of estimation data to a file*/
     void Write(CAutoFile& fileout);
@@ -203,7 +205,7 @@ public:
 
     /** Process all the transactions that have been included in a block */
     void processBlock(unsigned int nBlockHeight,
-                      std::vector<const CTxMemPoolEntry*>& entries);
+                      const std::vector<const CTxMemPoolEntry*>& entries);
 
     /** Process a transaction confirmed in a block*/
     bool processBlockTx(unsigned int nBlockHeight, const CTxMemPoolEntry* entry);
@@ -223,6 +225,13 @@ public:
      */
     CFeeRate estimateSmartFee(int confTarget, int *answerFoundAtTarget, const CTxMemPool& pool);
 
+    /** Answer estimateSmartFee for every target from 1 to the highest one
+     *  tracked, requiring successThreshold of the transactions at a feerate to
+     *  have confirmed in time rather than MIN_SUCCESS_PCT. Entry i is the
+     *  feerate for target i + 1 and the target it was found at.
+     */
+    std::vector<std::pair<CFeeRate, int> > estimateSmartFeeCurve(double successThreshold, const CTxMemPool& pool);
+
     /** Return a priority estimate.
      *  DEPRECATED
      *  Returns -1
@@ -261,6 +270,17 @@ private:
 
     unsigned int trackedTxs;
     unsigned int untrackedTxs;
+
+    /** Estimates by (confTarget, success threshold), valid until the next
+     *  block is processed or a tracked mempool transaction comes or goes. */
+    std::map<std::pair<int, double>, double> mapEstimateCache;
+
+    /** feeStats.EstimateMedianVal for the current height, from the cache if possible */
+    double EstimateMedianVal(int confTarget, double successThreshold);
+
+    /** Return the feerate for the lowest target at or above confTarget with an
+     *  answer, or -1 if there is none, setting answerFoundAtTarget to it */
+    double EstimateSmartMedianVal(int confTarget, double successThreshold, int *answerFoundAtTarget);
 };
 
 class FeeFilterRounder
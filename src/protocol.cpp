@@ -5,6 +5,7 @@
 
 #include "protocol.h"
 
+#include "crypto/common.h"
 #include "util.h"
 #include "utilstrencodings.h"
 
@@ -39,6 +40,16 @@ const char *SENDCMPCT="sendcmpct";
 const char *CMPCTBLOCK="cmpctblock";
 const char *GETBLOCKTXN="getblocktxn";
 const char *BLOCKTXN="blocktxn";
+const char *GETCFILTERS="getcfilters";
+const char *CFILTER="cfilter";
+const char *GETCFHEADERS="getcfheaders";
+const char *CFHEADERS="cfheaders";
+const char *GETCFCHECKPT="getcfcheckpt";
+const char *CFCHECKPT="cfcheckpt";
+const char *SENDRECON="sendrecon";
+const char *REQRECON="reqrecon";
+const char *SKETCH="sketch";
+const char *RECONCILDIFF="reconcildiff";
 };
 
 /** All known message types. Keep this in the same order as the list of
@@ -71,6 +82,16 @@ const static std::string allNetMessageTypes[] = {
     NetMsgType::CMPCTBLOCK,
     NetMsgType::GETBLOCKTXN,
     NetMsgType::BLOCKTXN,
+    NetMsgType::GETCFILTERS,
+    NetMsgType::CFILTER,
+    NetMsgType::GETCFHEADERS,
+    NetMsgType::CFHEADERS,
+    NetMsgType::GETCFCHECKPT,
+    NetMsgType::CFCHECKPT,
+    NetMsgType::SENDRECON,
+    NetMsgType::REQRECON,
+    NetMsgType::SKETCH,
+    NetMsgType::RECONCILDIFF,
 };
 const static std::vector<std::string> allNetMessageTypesVec(allNetMessageTypes, allNetMessageTypes+ARRAYLEN(allNetMessageTypes));
 
@@ -126,6 +147,14 @@ bool CMessageHeader::IsValid(const MessageStartChars& pchMessageStartIn) const
     return true;
 }
 
+void CMessageHeader::Write(unsigned char* pch) const
+{
+    memcpy(pch, pchMessageStart, MESSAGE_START_SIZE);
+    memcpy(pch + MESSAGE_START_SIZE, pchCommand, COMMAND_SIZE);
+    WriteLE32(pch + MESSAGE_SIZE_OFFSET, nMessageSize);
+    memcpy(pch + CHECKSUM_OFFSET, pchChecksum, CHECKSUM_SIZE);
+}
+
 
 
 CAddress::CAddress() : CService()
@@ -44,6 +44,8 @@ public:
 
     std::string GetCommand() const;
     bool IsValid(const MessageStartChars& messageStart) const;
+    //! Write the serialized header to pch, which has room for HEADER_SIZE bytes
+    void Write(unsigned char* pch) const;
 
     ADD_SERIALIZE_METHODS;
 
@@ -240,6 +242,66 @@ extern const char *GETBLOCKTXN;
  * @since protocol version 70014 as described by BIP 152
  */
 extern const char *BLOCKTXN;
+/**
+ * getcfilters requests compact filters for a range of blocks.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by
+ * BIP 157 & 158.
+ */
+extern const char *GETCFILTERS;
+/**
+ * cfilter is a response to a getcfilters request containing a single compact
+ * filter.
+ */
+extern const char *CFILTER;
+/**
+ * getcfheaders requests a compact filter header and the filter hashes for a
+ * range of blocks, which can then be used to reconstruct the filter headers
+ * for those blocks.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by
+ * BIP 157 & 158.
+ */
+extern const char *GETCFHEADERS;
+/**
+ * cfheaders is a response to a getcfheaders request containing a filter header
+ * and a vector of filter hashes for each subsequent block in the requested range.
+ */
+extern const char *CFHEADERS;
+/**
+ * getcfcheckpt requests evenly spaced compact filter headers, enabling
+ * parallelized download and validation of the headers between them.
+ * Only available with service bit NODE_COMPACT_FILTERS as described by
+ * BIP 157 & 158.
+ */
+extern const char *GETCFCHECKPT;
+/**
+ * cfcheckpt is a response to a getcfcheckpt request containing a vector of
+ * evenly spaced filter headers for blocks on the requested chain.
+ */
+extern const char *CFCHECKPT;
+/**
+ * Contains a 64-bit salt, sent after verack to peers signaling NODE_TXRECON
+ * when we offer it as well. Once both sides sent it, transactions are
+ * announced through set reconciliation instead of inv messages.
+ */
+extern const char *SENDRECON;
+/**
+ * Sent by the outbound side of a reconciling connection to start a round of
+ * set reconciliation. Contains the size of its reconciliation set.
+ * Peer should respond with "sketch" message.
+ */
+extern const char *REQRECON;
+/**
+ * Contains a CSketch of the transactions the sender wants to announce,
+ * in response to a "reqrecon" message. An empty sketch means the
+ * difference is too large and both sides announce their sets in full.
+ */
+extern const char *SKETCH;
+/**
+ * Concludes a round of set reconciliation: whether the sketch could be
+ * decoded, and the short ids of the transactions the sender is missing.
+ * Peer should announce those (or, on failure, all of its set) with "inv".
+ */
+extern const char *RECONCILDIFF;
 };
 
 /* Get a vector of all valid message types (see above) */
@@ -267,6 +329,13 @@ enum ServiceFlags : uint64_t {
     // NODE_XTHIN means the node supports Xtreme Thinblocks
     // If this is turned off then the node will not service nor make xthin requests
     NODE_XTHIN = (1 << 4),
+    // NODE_COMPACT_FILTERS means the node will service basic block filter
+    // requests. See BIP157 and BIP158 for details on how this is implemented.
+    NODE_COMPACT_FILTERS = (1 << 6),
+    // NODE_TXRECON means the node can announce transactions through set
+    // reconciliation (sendrecon/reqrecon/sketch/reconcildiff messages) rather
+    // than an inv for every transaction. This is an experimental bit.
+    NODE_TXRECON = (1 << 24),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
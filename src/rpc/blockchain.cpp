@@ -9,6 +9,7 @@
 #include "checkpoints.h"
 #include "coins.h"
 #include "consensus/validation.h"
+#include "index/spentindex.h"
 #include "validation.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
@@ -349,10 +350,8 @@ std::string EntryDescriptionString()
            "       ... ]\n";
 }
 
-void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+static void entryFieldsToJSON(UniValue &info, const CTxMemPoolEntry &e)
 {
-    AssertLockHeld(mempool.cs);
-
     info.push_back(Pair("size", (int)e.GetTxSize()));
     info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
     info.push_back(Pair("modifiedfee", ValueFromAmount(e.GetModifiedFee())));
@@ -366,14 +365,10 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
     info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
     info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
-    const CTransaction& tx = e.GetTx();
-    set<string> setDepends;
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
-    {
-        if (mempool.exists(txin.prevout.hash))
-            setDepends.insert(txin.prevout.hash.ToString());
-    }
+}
 
+static void dependsToJSON(UniValue &info, const set<string>& setDepends)
+{
     UniValue depends(UniValue::VARR);
     BOOST_FOREACH(const string& dep, setDepends)
     {
@@ -383,29 +378,50 @@ void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
     info.push_back(Pair("depends", depends));
 }
 
+void entryToJSON(UniValue &info, const CTxMemPoolEntry &e)
+{
+    AssertLockHeld(mempool.cs);
+
+    entryFieldsToJSON(info, e);
+    const CTransaction& tx = e.GetTx();
+    set<string> setDepends;
+    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    {
+        if (mempool.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+    dependsToJSON(info, setDepends);
+}
+
+void entryToJSON(UniValue &info, const CTxMemPoolSnapshot& snapshot, const CTxMemPoolSnapshot::Entry& entry)
+{
+    entryFieldsToJSON(info, entry.entry);
+    set<string> setDepends;
+    BOOST_FOREACH(size_t nParent, entry.vParents)
+        setDepends.insert(snapshot.vEntries[nParent].entry.GetTx().GetHash().ToString());
+    dependsToJSON(info, setDepends);
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
     if (fVerbose)
     {
-        LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
+        BOOST_FOREACH(const CTxMemPoolSnapshot::Entry& entry, snapshot->vEntries)
         {
-            const uint256& hash = e.GetTx().GetHash();
+            const uint256& hash = entry.entry.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
-            entryToJSON(info, e);
+            entryToJSON(info, *snapshot, entry);
             o.push_back(Pair(hash.ToString(), info));
         }
         return o;
     }
     else
     {
-        vector<uint256> vtxid;
-        mempool.queryHashes(vtxid);
-
         UniValue a(UniValue::VARR);
-        BOOST_FOREACH(const uint256& hash, vtxid)
-            a.push_back(hash.ToString());
+        BOOST_FOREACH(const CTxMemPoolSnapshot::Entry& entry, snapshot->vEntries)
+            a.push_back(entry.entry.GetTx().GetHash().ToString());
 
         return a;
     }
@@ -989,6 +1005,74 @@ UniValue gettxout(const JSONRPCRequest& request)
     return ret;
 }
 
+UniValue getspentinfo(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 2 || request.params.size() > 3)
+        throw runtime_error(
+            "getspentinfo \"txid\" n ( include_mempool )\n"
+            "\nReturns the input that spends a transaction output.\n"
+            "Confirmed spends require the spent index to be enabled (-spentindex).\n"
+            "\nArguments:\n"
+            "1. \"txid\"       (string, required) The transaction id\n"
+            "2. n              (numeric, required) vout number\n"
+            "3. include_mempool  (boolean, optional, default=true) Whether to include spends in the mempool\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\" : \"hash\",     (string) The id of the spending transaction\n"
+            "  \"index\" : n,         (numeric) The input index in the spending transaction\n"
+            "  \"height\" : n         (numeric) The height of the block that confirmed the spend, -1 if it is unconfirmed\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "\"txid\" 1")
+            + HelpExampleRpc("getspentinfo", "\"txid\", 1")
+        );
+
+    uint256 hash = ParseHashV(request.params[0], "parameter 1");
+    int n = request.params[1].get_int();
+    if (n < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid parameter, vout must be positive");
+    bool fMempool = true;
+    if (request.params.size() > 2)
+        fMempool = request.params[2].get_bool();
+
+    UniValue ret(UniValue::VOBJ);
+
+    if (fMempool) {
+        LOCK(mempool.cs);
+        auto it = mempool.mapNextTx.find(COutPoint(hash, n));
+        if (it != mempool.mapNextTx.end()) {
+            const CTransaction& tx = *it->second;
+            for (unsigned int i = 0; i < tx.vin.size(); i++) {
+                if (tx.vin[i].prevout == *it->first) {
+                    ret.push_back(Pair("txid", tx.GetHash().GetHex()));
+                    ret.push_back(Pair("index", (int)i));
+                    ret.push_back(Pair("height", -1));
+                    return ret;
+                }
+            }
+        }
+    }
+
+    if (!g_spentindex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Spent index not enabled. Use -spentindex to enable confirmed spend queries");
+
+    // Once the index has caught up, let it process the current tip so a
+    // spend in the latest block is not missed.
+    bool fSynced = g_spentindex->IsSynced() && g_spentindex->BlockUntilSyncedToCurrentChain();
+
+    CSpentIndexValue value;
+    if (!g_spentindex->FindSpent(CSpentIndexKey(hash, n), value)) {
+        if (!fSynced)
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info. Confirmed spends are still in the process of being indexed");
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+    }
+
+    ret.push_back(Pair("txid", value.txid.GetHex()));
+    ret.push_back(Pair("index", (int)value.inputIndex));
+    ret.push_back(Pair("height", value.blockHeight));
+    return ret;
+}
+
 UniValue verifychain(const JSONRPCRequest& request)
 {
     int nCheckLevel = GetArg("-checklevel", DEFAULT_CHECKLEVEL);
@@ -1437,6 +1521,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true,  {"txid"} },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true,  {} },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true,  {"verbose"} },
+    { "blockchain",         "getspentinfo",           &getspentinfo,           true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxout",               &gettxout,               true,  {"txid","n","include_mempool"} },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true,  {} },
     { "blockchain",         "pruneblockchain",        &pruneblockchain,        true,  {"height"} },
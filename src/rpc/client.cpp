@@ -89,9 +89,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "signrawtransaction", 1, "prevtxs" },
     { "signrawtransaction", 2, "privkeys" },
     { "sendrawtransaction", 1, "allowhighfees" },
+    { "submitpackage", 0, "hexstrings" },
+    { "submitpackage", 1, "allowhighfees" },
     { "fundrawtransaction", 1, "options" },
     { "gettxout", 1, "n" },
     { "gettxout", 2, "include_mempool" },
+    { "getspentinfo", 1, "n" },
+    { "getspentinfo", 2, "include_mempool" },
     { "gettxoutproof", 0, "txids" },
     { "lockunspent", 0, "unlock" },
     { "lockunspent", 1, "transactions" },
@@ -110,6 +114,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "estimatepriority", 0, "nblocks" },
     { "estimatesmartfee", 0, "nblocks" },
     { "estimatesmartpriority", 0, "nblocks" },
+    { "estimatefeecurve", 0, "threshold" },
     { "prioritisetransaction", 1, "priority_delta" },
     { "prioritisetransaction", 2, "fee_delta" },
     { "setban", 2, "bantime" },
@@ -15,6 +15,7 @@
 #include "validation.h"
 #include "miner.h"
 #include "net.h"
+#include "policy/fees.h"
 #include "pow.h"
 #include "rpc/server.h"
 #include "txmempool.h"
@@ -861,6 +862,8 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
             hashWatchedChain = chainActive.Tip()->GetBlockHash();
             nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
         }
+        // With -asynctemplatecheck, templates found invalid also end the wait
+        unsigned int nInvalidatedLP = nBlockTemplatesInvalidated;
 
         // Release the wallet and main lock while waiting
         LEAVE_CRITICAL_SECTION(cs_main);
@@ -868,7 +871,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
             checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
 
             boost::unique_lock<boost::mutex> lock(csBestBlock);
-            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
+            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && nBlockTemplatesInvalidated == nInvalidatedLP && IsRPCRunning())
             {
                 if (!cvBlockChange.timed_wait(lock, checktxtime))
                 {
@@ -893,34 +896,11 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     bool fSupportsSegwit = setClientRules.find(segwit_info.name) != setClientRules.end();
 
     // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static std::unique_ptr<CBlockTemplate> pblocktemplate;
-    // Cache whether the last invocation was with segwit support, to avoid returning
-    // a segwit-block to a non-segwit caller.
-    static bool fLastTemplateSupportsSegwit = true;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
-        fLastTemplateSupportsSegwit != fSupportsSegwit)
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = nullptr;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-        fLastTemplateSupportsSegwit = fSupportsSegwit;
-
-        // Create new block
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
+    static BlockTemplateCache templateCache(Params());
+    std::unique_ptr<CBlockTemplate> pblocktemplate = templateCache.Get(fSupportsSegwit, nTransactionsUpdatedLast);
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+    CBlockIndex* pindexPrev = chainActive.Tip();
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
@@ -1264,6 +1244,55 @@ UniValue estimatesmartfee(const JSONRPCRequest& request)
     return result;
 }
 
+UniValue estimatefeecurve(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() > 1)
+        throw runtime_error(
+            "estimatefeecurve ( threshold )\n"
+            "\nWARNING: This interface is unstable and may disappear or change!\n"
+            "\nReturns what estimatesmartfee would for every number of blocks the\n"
+            "estimator tracks, in one consistent answer.\n"
+            "\nArguments:\n"
+            "1. threshold   (numeric, optional, default=" + strprintf("%.2f", MIN_SUCCESS_PCT) + ") share of transactions at a\n"
+            "               feerate that must have confirmed within the target for it to count\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"target\" : n,       (numeric) number of blocks asked for\n"
+            "    \"feerate\" : x.x,    (numeric) estimate fee-per-kilobyte (in CREA)\n"
+            "    \"blocks\" : n        (numeric) block number where estimate was found\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\n"
+            "As with estimatesmartfee, feerate is negative where no estimate can be made\n"
+            "and never below the mempool reject fee.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("estimatefeecurve", "")
+            + HelpExampleCli("estimatefeecurve", "0.5")
+            );
+
+    RPCTypeCheck(request.params, boost::assign::list_of(UniValue::VNUM));
+
+    double threshold = MIN_SUCCESS_PCT;
+    if (request.params.size() > 0) {
+        threshold = request.params[0].get_real();
+        if (threshold <= 0 || threshold >= 1)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid threshold, must be between 0 and 1 (non-inclusive)");
+    }
+
+    std::vector<std::pair<CFeeRate, int> > curve = mempool.estimateSmartFeeCurve(threshold);
+    UniValue result(UniValue::VARR);
+    for (unsigned int i = 0; i < curve.size(); i++) {
+        UniValue entry(UniValue::VOBJ);
+        entry.push_back(Pair("target", (int)i + 1));
+        entry.push_back(Pair("feerate", curve[i].first == CFeeRate(0) ? -1.0 : ValueFromAmount(curve[i].first.GetFeePerK())));
+        entry.push_back(Pair("blocks", curve[i].second));
+        result.push_back(entry);
+    }
+    return result;
+}
+
 UniValue estimatesmartpriority(const JSONRPCRequest& request)
 {
     if (request.fHelp || request.params.size() != 1)
@@ -1317,6 +1346,7 @@ static const CRPCCommand commands[] =
     { "util",               "estimatepriority",       &estimatepriority,       true,  {"nblocks"} },
     { "util",               "estimatesmartfee",       &estimatesmartfee,       true,  {"nblocks"} },
     { "util",               "estimatesmartpriority",  &estimatesmartpriority,  true,  {"nblocks"} },
+    { "util",               "estimatefeecurve",       &estimatefeecurve,       true,  {"threshold"} },
 };
 
 void RegisterMiningRPCCommands(CRPCTable &t)
@@ -102,6 +102,15 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
             "    ],\n"
+            "    \"blockwindow\": n,          (numeric) The number of blocks we are willing to have in flight from this peer\n"
+            "    \"blockdownloadtime\": n,    (numeric) Average time in seconds the peer took to deliver each requested block (if measured)\n"
+            "    \"blockdownloadrate\": n,    (numeric) Average rate in bytes per second at which the peer delivered requested blocks (if measured)\n"
+            "    \"blocksrerequested\": n,    (numeric) The number of blocks in flight from this peer that were requested again from a faster peer\n"
+            "    \"blockannouncedelay\": n,   (numeric) Average time in seconds after the first announcement of a new best block the peer announced it (if any)\n"
+            "    \"blocksannouncedfirst\": n, (numeric) The number of new best blocks this peer announced to us before any other peer\n"
+            "    \"txreconciliation\": true|false, (boolean) Whether transactions are announced to this peer through set reconciliation\n"
+            "    \"reconciliations\": n,      (numeric) The number of reconciliations with this peer (if reconciling)\n"
+            "    \"reconciliationfailures\": n, (numeric) The number of those that fell back to announcing all transactions (if reconciling)\n"
             "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"					
             "    \"bytessent_per_msg\": {\n"
             "       \"addr\": n,              (numeric) The total bytes sent aggregated by message type\n"
@@ -166,6 +175,20 @@ UniValue getpeerinfo(const JSONRPCRequest& request)
                 heights.push_back(height);
             }
             obj.push_back(Pair("inflight", heights));
+            obj.push_back(Pair("blockwindow", statestats.nMaxBlocksInTransit));
+            if (statestats.nBlockDownloadTime > 0) {
+                obj.push_back(Pair("blockdownloadtime", statestats.nBlockDownloadTime / 1e6));
+                obj.push_back(Pair("blockdownloadrate", statestats.nBlockDownloadRate));
+            }
+            obj.push_back(Pair("blocksrerequested", statestats.nBlocksRerequested));
+            if (statestats.nBlockAnnounceDelay >= 0)
+                obj.push_back(Pair("blockannouncedelay", statestats.nBlockAnnounceDelay / 1e6));
+            obj.push_back(Pair("blocksannouncedfirst", statestats.nBlocksAnnouncedFirst));
+            obj.push_back(Pair("txreconciliation", statestats.fTxReconciliation));
+            if (statestats.fTxReconciliation) {
+                obj.push_back(Pair("reconciliations", statestats.nReconciliations));
+                obj.push_back(Pair("reconciliationfailures", statestats.nReconFailures));
+            }
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
 
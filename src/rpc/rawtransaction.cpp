@@ -8,6 +8,7 @@
 #include "coins.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "index/txindex.h"
 #include "init.h"
 #include "keystore.h"
 #include "validation.h"
@@ -221,10 +222,17 @@ UniValue getrawtransaction(const JSONRPCRequest& request)
 
     CTransactionRef tx;
     uint256 hashBlock;
-    if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, std::string(fTxIndex ? "No such mempool or blockchain transaction"
-            : "No such mempool transaction. Use -txindex to enable blockchain transaction queries") +
-            ". Use gettransaction for wallet transactions.");
+    if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true)) {
+        std::string errmsg;
+        if (!g_txindex) {
+            errmsg = "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
+        } else if (!g_txindex->IsSynced()) {
+            errmsg = "No such mempool or blockchain transaction. Blockchain transactions are still in the process of being indexed";
+        } else {
+            errmsg = "No such mempool or blockchain transaction";
+        }
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg + ". Use gettransaction for wallet transactions.");
+    }
 
 
     string strHex = EncodeHexTx(*tx, RPCSerializationFlags());
@@ -940,6 +948,88 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     return hashTx.GetHex();
 }
 
+UniValue submitpackage(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw runtime_error(
+            "submitpackage [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits a package of raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "The package must be a single child transaction preceded by its unconfirmed parents, ordered\n"
+            "so that parents come before their children, and may not replace memory pool transactions.\n"
+            "The package is accepted as a whole or not at all. If the child pays at least the feerate of\n"
+            "the package, the fee policy judges each parent by the higher of its own feerate and the\n"
+            "feerate of the package.\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The hex strings of the raw transactions, at most " + strprintf("%u", MAX_PACKAGE_COUNT) + "\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txids\" : [         (array of string) The transaction hashes in hex\n"
+            "    \"hex\", ...\n"
+            "  ],\n"
+            "  \"packagefeerate\" : x.xxxx  (numeric) The feerate in " + CURRENCY_UNIT + "/kB of the transactions that were not in the memory pool yet\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("submitpackage", "\"[\\\"signedparenthex\\\",\\\"signedchildhex\\\"]\"")
+            + HelpExampleRpc("submitpackage", "[\"signedparenthex\",\"signedchildhex\"]")
+        );
+
+    LOCK(cs_main);
+    RPCTypeCheck(request.params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+
+    const UniValue& hexstrings = request.params[0].get_array();
+    std::vector<CTransactionRef> package;
+    for (unsigned int idx = 0; idx < hexstrings.size(); idx++) {
+        CMutableTransaction mtx;
+        if (!hexstrings[idx].isStr() || !DecodeHexTx(mtx, hexstrings[idx].get_str()))
+            throw JSONRPCError(RPC_DESERIALIZATION_ERROR, strprintf("TX decode failed for transaction %u", idx));
+        package.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+
+    CAmount nMaxRawTxFee = maxTxFee;
+    if (request.params.size() > 1 && request.params[1].get_bool())
+        nMaxRawTxFee = 0;
+
+    BOOST_FOREACH(const CTransactionRef& tx, package) {
+        const CCoins* existingCoins = pcoinsTip->AccessCoins(tx->GetHash());
+        if (existingCoins && existingCoins->nHeight < 1000000000)
+            throw JSONRPCError(RPC_TRANSACTION_ALREADY_IN_CHAIN, strprintf("transaction %s already in block chain", tx->GetHash().GetHex()));
+    }
+
+    // push to local node and sync with wallets
+    CValidationState state;
+    bool fMissingInputs;
+    uint256 hashFailed;
+    CFeeRate packageFeeRate;
+    if (!AcceptPackageToMemoryPool(mempool, state, package, &fMissingInputs, &hashFailed, &packageFeeRate, nMaxRawTxFee)) {
+        if (state.IsInvalid()) {
+            throw JSONRPCError(RPC_TRANSACTION_REJECTED, strprintf("%s: %i: %s", hashFailed.GetHex(), state.GetRejectCode(), state.GetRejectReason()));
+        } else {
+            if (fMissingInputs) {
+                throw JSONRPCError(RPC_TRANSACTION_ERROR, strprintf("%s: Missing inputs", hashFailed.GetHex()));
+            }
+            throw JSONRPCError(RPC_TRANSACTION_ERROR, strprintf("%s: %s", hashFailed.GetHex(), state.GetRejectReason()));
+        }
+    }
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    UniValue txids(UniValue::VARR);
+    BOOST_FOREACH(const CTransactionRef& tx, package) {
+        CInv inv(MSG_TX, tx->GetHash());
+        g_connman->ForEachNode([&inv](CNode* pnode)
+        {
+            pnode->PushInventory(inv);
+        });
+        txids.push_back(tx->GetHash().GetHex());
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txids", txids));
+    result.push_back(Pair("packagefeerate", ValueFromAmount(packageFeeRate.GetFeePerK())));
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -948,6 +1038,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,  {"hexstring"} },
     { "rawtransactions",    "decodescript",           &decodescript,           true,  {"hexstring"} },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false, {"hexstring","allowhighfees"} },
+    { "rawtransactions",    "submitpackage",          &submitpackage,          false, {"hexstrings","allowhighfees"} },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false, {"hexstring","prevtxs","privkeys","sighashtype"} }, /* uses wallet if enabled */
 
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,  {"txids", "blockhash"} },
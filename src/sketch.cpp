@@ -0,0 +1,249 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sketch.h"
+
+#include <algorithm>
+
+namespace {
+
+/** A polynomial over GF(2^32), lowest degree coefficient first */
+typedef std::vector<uint32_t> Poly;
+
+/** Multiply in GF(2^32), represented as GF(2)[x] modulo x^32 + x^7 + x^3 + x^2 + 1 */
+uint32_t GFMul(uint32_t a, uint32_t b)
+{
+    // Carry-less multiplication, four bits of b at a time
+    uint64_t table[16];
+    table[0] = 0;
+    table[1] = a;
+    for (int i = 2; i < 16; i += 2) {
+        table[i] = table[i / 2] << 1;
+        table[i + 1] = table[i] ^ a;
+    }
+    uint64_t r = 0;
+    for (int i = 28; i >= 0; i -= 4) {
+        r = (r << 4) ^ table[(b >> i) & 15];
+    }
+
+    // Reduce with x^32 = x^7 + x^3 + x^2 + 1, including the few bits that
+    // are shifted past x^32 again by doing so
+    uint32_t h = r >> 32;
+    uint32_t t = h ^ (h >> 30) ^ (h >> 29) ^ (h >> 25);
+    return (uint32_t)r ^ t ^ (t << 2) ^ (t << 3) ^ (t << 7);
+}
+
+/** Invert a non-zero element, as a^(2^32 - 2) */
+uint32_t GFInv(uint32_t a)
+{
+    uint32_t r = 1;
+    for (int i = 0; i < 31; i++) {
+        a = GFMul(a, a);
+        r = GFMul(r, a);
+    }
+    return r;
+}
+
+void PolyTrim(Poly& p)
+{
+    while (!p.empty() && p.back() == 0)
+        p.pop_back();
+}
+
+void PolyMakeMonic(Poly& p)
+{
+    uint32_t inv = GFInv(p.back());
+    for (size_t i = 0; i < p.size(); i++)
+        p[i] = GFMul(p[i], inv);
+}
+
+/** Replace a with a modulo the monic polynomial m, and optionally store the quotient */
+void PolyDivMod(Poly& a, const Poly& m, Poly* pquot)
+{
+    const size_t dm = m.size() - 1;
+    if (pquot)
+        pquot->assign(a.size() > dm ? a.size() - dm : 0, 0);
+    while (a.size() > dm) {
+        uint32_t c = a.back();
+        size_t shift = a.size() - 1 - dm;
+        if (pquot)
+            (*pquot)[shift] = c;
+        if (c != 0) {
+            for (size_t i = 0; i < dm; i++)
+                a[shift + i] ^= GFMul(c, m[i]);
+        }
+        a.pop_back();
+    }
+    PolyTrim(a);
+}
+
+/** Replace p with p^2 modulo the monic polynomial m */
+void PolySqrMod(Poly& p, const Poly& m)
+{
+    // Squaring is linear in characteristic 2: (sum c_i x^i)^2 = sum c_i^2 x^2i
+    Poly r(p.empty() ? 0 : 2 * p.size() - 1, 0);
+    for (size_t i = 0; i < p.size(); i++)
+        r[2 * i] = GFMul(p[i], p[i]);
+    PolyDivMod(r, m, NULL);
+    p.swap(r);
+}
+
+/** The monic greatest common divisor of a and b, which must not both be zero */
+Poly PolyGcd(Poly a, Poly b)
+{
+    PolyTrim(a);
+    PolyTrim(b);
+    while (!b.empty()) {
+        PolyMakeMonic(b);
+        PolyDivMod(a, b, NULL);
+        a.swap(b);
+    }
+    PolyMakeMonic(a);
+    return a;
+}
+
+/**
+ * Find the shortest linear recurrence generating s (Berlekamp-Massey).
+ * Returns the connection polynomial 1 + c_1 x + ... + c_l x^l, and its length l.
+ */
+Poly BerlekampMassey(const std::vector<uint32_t>& s, size_t& l)
+{
+    Poly c(1, 1), b(1, 1);
+    uint32_t bInv = 1;
+    size_t m = 1;
+    l = 0;
+    for (size_t n = 0; n < s.size(); n++) {
+        uint32_t d = s[n];
+        for (size_t i = 1; i <= l && i < c.size(); i++)
+            d ^= GFMul(c[i], s[n - i]);
+        if (d == 0) {
+            m++;
+            continue;
+        }
+        uint32_t coef = GFMul(d, bInv);
+        Poly t;
+        bool fLengthen = 2 * l <= n;
+        if (fLengthen)
+            t = c;
+        if (c.size() < b.size() + m)
+            c.resize(b.size() + m, 0);
+        for (size_t i = 0; i < b.size(); i++)
+            c[i + m] ^= GFMul(coef, b[i]);
+        if (fLengthen) {
+            l = n + 1 - l;
+            b.swap(t);
+            bInv = GFInv(d);
+            m = 1;
+        } else {
+            m++;
+        }
+    }
+    PolyTrim(c);
+    return c;
+}
+
+/** Whether the monic polynomial p is a product of distinct linear factors, i.e. divides x^(2^32) - x */
+bool PolyHasDistinctRoots(const Poly& p)
+{
+    Poly x(2, 0);
+    x[1] = 1;
+    PolyDivMod(x, p, NULL);
+    Poly t = x;
+    for (int i = 0; i < 32; i++)
+        PolySqrMod(t, p);
+    return t == x;
+}
+
+/**
+ * Find the roots of the monic polynomial p, which has distinct roots only.
+ * p is split in two by its gcd with Tr(beta x) = sum (beta x)^(2^i), for
+ * beta = 2^nBit, 2^(nBit + 1), ..., which separates any two roots for some beta.
+ */
+bool PolyFindRoots(const Poly& p, int nBit, std::vector<uint32_t>& vRoots)
+{
+    if (p.size() <= 1)
+        return true;
+    if (p.size() == 2) {
+        vRoots.push_back(p[0]);
+        return true;
+    }
+    for (; nBit < 32; nBit++) {
+        Poly t(2, 0);
+        t[1] = (uint32_t)1 << nBit;
+        Poly trace = t;
+        for (int i = 1; i < 32; i++) {
+            PolySqrMod(t, p);
+            if (trace.size() < t.size())
+                trace.resize(t.size(), 0);
+            for (size_t j = 0; j < t.size(); j++)
+                trace[j] ^= t[j];
+        }
+        PolyTrim(trace);
+        if (trace.empty())
+            continue;
+        Poly g = PolyGcd(p, trace);
+        if (g.size() <= 1 || g.size() == p.size())
+            continue;
+        Poly rem = p, quot;
+        PolyDivMod(rem, g, &quot);
+        return PolyFindRoots(g, nBit + 1, vRoots) && PolyFindRoots(quot, nBit + 1, vRoots);
+    }
+    return false;
+}
+
+} // anon namespace
+
+void CSketch::Add(uint32_t nElement)
+{
+    uint32_t nSquare = GFMul(nElement, nElement);
+    uint32_t nPower = nElement;
+    for (size_t i = 0; i < vSyndromes.size(); i++) {
+        vSyndromes[i] ^= nPower;
+        nPower = GFMul(nPower, nSquare);
+    }
+}
+
+void CSketch::Merge(const CSketch& other)
+{
+    vSyndromes.resize(std::min(vSyndromes.size(), other.vSyndromes.size()));
+    for (size_t i = 0; i < vSyndromes.size(); i++)
+        vSyndromes[i] ^= other.vSyndromes[i];
+}
+
+bool CSketch::Decode(std::vector<uint32_t>& vElements) const
+{
+    vElements.clear();
+    const size_t nCapacity = GetCapacity();
+    if (std::all_of(vSyndromes.begin(), vSyndromes.end(), [](uint32_t s) { return s == 0; }))
+        return true;
+
+    // Recover all power sums s_1 ... s_2n from the odd ones, as s_2i = s_i^2
+    std::vector<uint32_t> vSums(2 * vSyndromes.size());
+    for (size_t i = 0; i < vSums.size(); i++)
+        vSums[i] = (i & 1) ? GFMul(vSums[i / 2], vSums[i / 2]) : vSyndromes[i / 2];
+
+    // The elements are the inverses of the roots of the connection polynomial,
+    // so the roots of its reverse.
+    size_t l;
+    Poly c = BerlekampMassey(vSums, l);
+    if (l > nCapacity || c.size() != l + 1)
+        return false;
+    Poly p(c.rbegin(), c.rend());
+    if (!PolyHasDistinctRoots(p) || !PolyFindRoots(p, 0, vElements) || vElements.size() != l) {
+        vElements.clear();
+        return false;
+    }
+
+    // More differences than the capacity can still produce a recurrence of
+    // length l <= c; only accept elements that reproduce the sketch, including
+    // the power sums beyond the capacity.
+    CSketch check(nCapacity);
+    for (size_t i = 0; i < vElements.size(); i++)
+        check.Add(vElements[i]);
+    if (check.vSyndromes != vSyndromes) {
+        vElements.clear();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,59 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SKETCH_H
+#define BITCOIN_SKETCH_H
+
+#include "serialize.h"
+
+#include <stdint.h>
+#include <vector>
+
+/** Number of power sums a sketch holds beyond its capacity, to detect larger differences */
+static const size_t SKETCH_CHECK_SYNDROMES = 2;
+
+/**
+ * A set sketch (PinSketch) of 32-bit elements, used to reconcile the sets of
+ * transactions two peers want to announce to each other.
+ *
+ * A sketch of capacity c holds the odd power sums x, x^3, ..., x^(2n-1) of
+ * its elements over GF(2^32), for n = c + SKETCH_CHECK_SYNDROMES, so it takes
+ * 4*n bytes no matter how many elements were added. Merging the sketches of
+ * two sets gives the sketch of their symmetric difference, which can be
+ * decoded as long as it has no more than c elements. The extra power sums are
+ * not needed to decode, but make a larger difference fail to decode instead
+ * of producing a wrong set, except with a chance of about 2^-64. Adding an
+ * element twice removes it again.
+ */
+class CSketch
+{
+private:
+    std::vector<uint32_t> vSyndromes;
+
+public:
+    CSketch() {}
+    explicit CSketch(size_t nCapacity) : vSyndromes(nCapacity + SKETCH_CHECK_SYNDROMES, 0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vSyndromes);
+    }
+
+    /** The maximum number of differences this sketch can decode */
+    size_t GetCapacity() const { return vSyndromes.size() > SKETCH_CHECK_SYNDROMES ? vSyndromes.size() - SKETCH_CHECK_SYNDROMES : 0; }
+
+    /** Add (or remove) an element, which must be non-zero */
+    void Add(uint32_t nElement);
+
+    /** Combine with the sketch of another set, leaving the sketch of the symmetric difference.
+     *  The capacity becomes the smaller of both. */
+    void Merge(const CSketch& other);
+
+    /** Recover the elements of the sketched set, returns false if there are more than the capacity */
+    bool Decode(std::vector<uint32_t>& vElements) const;
+};
+
+#endif // BITCOIN_SKETCH_H
@@ -0,0 +1,246 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "chainparams.h"
+#include "net.h"
+#include "net_processing.h"
+#include "netmessagemaker.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+// Block download window sizing and re-requesting slow blocks from faster peers
+
+BOOST_FIXTURE_TEST_SUITE(blockdownload_tests, TestingSetup)
+
+/** Number of headers on top of genesis the tests download the blocks of */
+static const int HEADERS_COUNT = 20;
+
+/**
+ * Add a chain of headers on top of the genesis block to the block index, as
+ * if they had been received from peers; returns their index entries by height.
+ */
+static std::vector<CBlockIndex*> AddHeaders()
+{
+    LOCK(cs_main);
+    std::vector<CBlockIndex*> vIndex(1, chainActive.Genesis());
+    for (int i = 1; i <= HEADERS_COUNT; i++) {
+        CBlockHeader header;
+        header.nVersion = 4;
+        header.hashPrevBlock = vIndex.back()->GetBlockHash();
+        header.nTime = vIndex.back()->nTime + 60;
+        header.nBits = vIndex.back()->nBits;
+        header.nNonce = i;
+        CBlockIndex* pindex = new CBlockIndex(header);
+        pindex->phashBlock = &mapBlockIndex.insert(std::make_pair(header.GetHash(), pindex)).first->first;
+        pindex->pprev = vIndex.back();
+        pindex->nHeight = i;
+        pindex->nChainWork = pindex->pprev->nChainWork + GetBlockProof(*pindex);
+        pindex->BuildSkip();
+        pindex->RaiseValidity(BLOCK_VALID_TREE);
+        vIndex.push_back(pindex);
+    }
+    return vIndex;
+}
+
+/** Connect a peer that has all the headers */
+static void InitNode(CNode& node, CConnman& connman, const CBlockIndex* pindexTip)
+{
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    node.SetSendVersion(PROTOCOL_VERSION);
+    GetNodeSignals().InitializeNode(&node, connman);
+    node.nVersion = PROTOCOL_VERSION;
+    node.nServices = NODE_NETWORK;
+    // Keep the peer connected while it sends us blocks that do not check out
+    node.fWhitelisted = true;
+    node.fSendCorked = true;
+    ReceiveMessage(node, connman, msgMaker.Make(NetMsgType::VERACK));
+    TakeSentMessages(node, "");
+    ReceiveMessage(node, connman, msgMaker.Make(NetMsgType::INV, std::vector<CInv>(1, CInv(MSG_BLOCK, pindexTip->GetBlockHash()))));
+    TakeSentMessages(node, "");
+}
+
+/** Let the node request blocks, and return the heights it asked for */
+static std::vector<int> RequestBlocks(CNode& node, CConnman& connman)
+{
+    std::atomic<bool> interruptDummy(false);
+    SendMessages(&node, connman, interruptDummy);
+    std::vector<int> vHeights;
+    std::vector<CDataStream> vGetData = TakeSentMessages(node, NetMsgType::GETDATA);
+    LOCK(cs_main);
+    BOOST_FOREACH(CDataStream& ss, vGetData) {
+        std::vector<CInv> vInv;
+        ss >> vInv;
+        BOOST_FOREACH(const CInv& inv, vInv)
+            vHeights.push_back(mapBlockIndex[inv.hash]->nHeight);
+    }
+    return vHeights;
+}
+
+/** The node delivers the block; it does not check out, so it is not stored */
+static void DeliverBlock(CNode& node, CConnman& connman, const CBlockIndex* pindex)
+{
+    ReceiveMessage(node, connman, CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::BLOCK, CBlock(pindex->GetBlockHeader())));
+    TakeSentMessages(node, "");
+}
+
+static std::vector<int> Heights(int nFirst, int nLast)
+{
+    std::vector<int> vHeights;
+    for (int i = nFirst; i <= nLast; i++)
+        vHeights.push_back(i);
+    return vHeights;
+}
+
+static CNodeStateStats GetStats(const CNode& node)
+{
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(node.GetId(), stats));
+    return stats;
+}
+
+static void FinalizeNodes(const std::vector<CNode*>& vNodes)
+{
+    bool fUpdateConnectionTime = false;
+    BOOST_FOREACH(CNode* pnode, vNodes)
+        GetNodeSignals().FinalizeNode(pnode->GetId(), fUpdateConnectionTime);
+}
+
+BOOST_AUTO_TEST_CASE(download_window)
+{
+    // The default until the download time is measured, then enough blocks
+    // for BLOCK_DOWNLOAD_QUEUE_TARGET, within bounds
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(0), MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(1), MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(BLOCK_DOWNLOAD_QUEUE_TARGET / 64), 64);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(BLOCK_DOWNLOAD_QUEUE_TARGET / 20), 20);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(BLOCK_DOWNLOAD_QUEUE_TARGET / 2), 2);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(BLOCK_DOWNLOAD_QUEUE_TARGET), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    BOOST_CHECK_EQUAL(GetMaxBlocksInTransit(100 * BLOCK_DOWNLOAD_QUEUE_TARGET), MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    std::vector<CBlockIndex*> vIndex = AddHeaders();
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+    CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+    CNode slow(3000, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true);
+    CNode fast(3001, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true);
+    InitNode(slow, *connman, vIndex.back());
+    InitNode(fast, *connman, vIndex.back());
+
+    BOOST_CHECK(RequestBlocks(slow, *connman) == Heights(1, MAX_BLOCKS_IN_TRANSIT_PER_PEER));
+    BOOST_CHECK(RequestBlocks(fast, *connman) == Heights(MAX_BLOCKS_IN_TRANSIT_PER_PEER + 1, HEADERS_COUNT));
+    BOOST_CHECK_EQUAL(GetStats(slow).nMaxBlocksInTransit, MAX_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Only a block at the front of the peer's queue is measured
+    DeliverBlock(fast, *connman, vIndex[17]);
+    BOOST_CHECK_EQUAL(GetStats(fast).nBlockDownloadTime, 1);
+    BOOST_CHECK_EQUAL(GetStats(fast).nMaxBlocksInTransit, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+    DeliverBlock(slow, *connman, vIndex[2]);
+    BOOST_CHECK_EQUAL(GetStats(slow).nBlockDownloadTime, 0);
+
+    SetMockTime(nTime + 4);
+    DeliverBlock(slow, *connman, vIndex[1]);
+    BOOST_CHECK_EQUAL(GetStats(slow).nBlockDownloadTime, 4000000);
+    BOOST_CHECK_EQUAL(GetStats(slow).nMaxBlocksInTransit, MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER);
+
+    // Later samples are averaged in with a weight of 1/8
+    SetMockTime(nTime + 8);
+    DeliverBlock(fast, *connman, vIndex[18]);
+    BOOST_CHECK_EQUAL(GetStats(fast).nBlockDownloadTime, 1000000);
+    BOOST_CHECK_EQUAL(GetStats(fast).nMaxBlocksInTransit, 2);
+
+    FinalizeNodes({&slow, &fast});
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(rerequest_decision)
+{
+    int64_t nTimeout = 1000000 * BLOCK_REREQUEST_TIMEOUT;
+
+    // Not from a peer whose speed is unknown
+    BOOST_CHECK(!ShouldRerequestBlock(0, 0, 100 * nTimeout));
+
+    // Not before BLOCK_REREQUEST_TIMEOUT
+    BOOST_CHECK(!ShouldRerequestBlock(1000, 0, nTimeout - 1));
+    BOOST_CHECK(ShouldRerequestBlock(1000, 0, nTimeout));
+
+    // Nor before the faster peer would have delivered it BLOCK_REREQUEST_SPEEDUP times
+    BOOST_CHECK(!ShouldRerequestBlock(nTimeout, 0, BLOCK_REREQUEST_SPEEDUP * nTimeout - 1));
+    BOOST_CHECK(ShouldRerequestBlock(nTimeout, 0, BLOCK_REREQUEST_SPEEDUP * nTimeout));
+
+    // Only from a peer that is BLOCK_REREQUEST_SPEEDUP times faster
+    BOOST_CHECK(!ShouldRerequestBlock(1000, BLOCK_REREQUEST_SPEEDUP * 1000, nTimeout));
+    BOOST_CHECK(ShouldRerequestBlock(1000, BLOCK_REREQUEST_SPEEDUP * 1000 + 1, nTimeout));
+}
+
+BOOST_AUTO_TEST_CASE(rerequest_from_faster_peer)
+{
+    std::vector<CBlockIndex*> vIndex = AddHeaders();
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+    CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+    CNode slow(3002, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true);
+    CNode fast(3003, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true);
+    InitNode(slow, *connman, vIndex.back());
+    InitNode(fast, *connman, vIndex.back());
+    BOOST_CHECK(RequestBlocks(slow, *connman) == Heights(1, 16));
+    BOOST_CHECK(RequestBlocks(fast, *connman) == Heights(17, 20));
+    DeliverBlock(fast, *connman, vIndex[17]);
+
+    // The first block is left to the slow peer until BLOCK_REREQUEST_TIMEOUT
+    BOOST_CHECK(RequestBlocks(fast, *connman) == Heights(17, 17));
+    SetMockTime(nTime + BLOCK_REREQUEST_TIMEOUT);
+    BOOST_CHECK(RequestBlocks(fast, *connman) == Heights(1, 1));
+
+    // and then moves to the fast peer
+    CNodeStateStats stats = GetStats(slow);
+    BOOST_CHECK(stats.vHeightInFlight == Heights(2, 16));
+    BOOST_CHECK_EQUAL(stats.nBlocksRerequested, 1);
+    stats = GetStats(fast);
+    BOOST_CHECK_EQUAL(std::count(stats.vHeightInFlight.begin(), stats.vHeightInFlight.end(), 1), 1);
+    BOOST_CHECK_EQUAL(stats.nBlocksRerequested, 0);
+
+    FinalizeNodes({&slow, &fast});
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(rerequest_front_of_queue)
+{
+    std::vector<CBlockIndex*> vIndex = AddHeaders();
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+    CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+    CNode slow(3004, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true);
+    CNode fast(3005, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, "", true);
+    InitNode(slow, *connman, vIndex.back());
+    InitNode(fast, *connman, vIndex.back());
+    BOOST_CHECK(RequestBlocks(slow, *connman) == Heights(1, 16));
+    BOOST_CHECK(RequestBlocks(fast, *connman) == Heights(17, 20));
+    DeliverBlock(fast, *connman, vIndex[17]);
+
+    // The slow peer queues the second block again behind the others
+    DeliverBlock(slow, *connman, vIndex[2]);
+    BOOST_CHECK(RequestBlocks(slow, *connman) == Heights(2, 2));
+    SetMockTime(nTime + 4);
+    DeliverBlock(slow, *connman, vIndex[1]);
+
+    // It holds up the window, but the slow peer is not downloading it yet
+    SetMockTime(nTime + 10);
+    std::vector<int> vExpected(1, 1);
+    vExpected.push_back(17);
+    BOOST_CHECK(RequestBlocks(fast, *connman) == vExpected);
+    BOOST_CHECK_EQUAL(GetStats(slow).nBlocksRerequested, 0);
+
+    FinalizeNodes({&slow, &fast});
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
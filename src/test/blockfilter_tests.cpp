@@ -0,0 +1,166 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockfilter.h"
+
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included_elements, excluded_elements;
+    for (int i = 0; i < 100; ++i) {
+        GCSFilter::Element element1(32);
+        element1[0] = i;
+        included_elements.insert(std::move(element1));
+
+        GCSFilter::Element element2(32);
+        element2[1] = i;
+        excluded_elements.insert(std::move(element2));
+    }
+
+    GCSFilter filter(GCSFilter::Params(0, 0, 10, 1 << 10), included_elements);
+    for (const auto& element : included_elements) {
+        BOOST_CHECK(filter.Match(element));
+
+        auto insertion = excluded_elements.insert(element);
+        BOOST_CHECK(filter.MatchAny(excluded_elements));
+        excluded_elements.erase(insertion.first);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_default_constructor)
+{
+    GCSFilter filter;
+    BOOST_CHECK_EQUAL(filter.GetN(), 0U);
+    BOOST_CHECK_EQUAL(filter.GetEncoded().size(), 1U);
+
+    const GCSFilter::Params& params = filter.GetParams();
+    BOOST_CHECK_EQUAL(params.m_siphash_k0, 0U);
+    BOOST_CHECK_EQUAL(params.m_siphash_k1, 0U);
+    BOOST_CHECK_EQUAL(params.m_P, 0);
+    BOOST_CHECK_EQUAL(params.m_M, 1U);
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_decode_encoded)
+{
+    GCSFilter::ElementSet elements;
+    for (int i = 0; i < 20; ++i) {
+        elements.insert(GCSFilter::Element(1, static_cast<unsigned char>(i)));
+    }
+
+    GCSFilter::Params params(1, 2, BASIC_FILTER_P, BASIC_FILTER_M);
+    GCSFilter filter(params, elements);
+    GCSFilter decoded(params, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), 20U);
+    for (const auto& element : elements) {
+        BOOST_CHECK(decoded.Match(element));
+    }
+
+    // Truncated or padded encodings are rejected
+    std::vector<unsigned char> encoded = filter.GetEncoded();
+    encoded.push_back(0);
+    BOOST_CHECK_THROW(GCSFilter(params, encoded), std::ios_base::failure);
+    encoded.resize(encoded.size() - 2);
+    BOOST_CHECK_THROW(GCSFilter(params, encoded), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // First two are outputs on a single transaction.
+    included_scripts[0] << std::vector<unsigned char>(0, 65) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(1, 20) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    // Third is an output on in a second transaction.
+    included_scripts[2] << OP_1 << std::vector<unsigned char>(2, 33) << OP_1 << OP_CHECKMULTISIG;
+
+    // Last two are spent by a single transaction.
+    included_scripts[3] << OP_0 << std::vector<unsigned char>(3, 32);
+    included_scripts[4] << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    // OP_RETURN output is an output on the second transaction.
+    excluded_scripts[0] << OP_RETURN << std::vector<unsigned char>(4, 40);
+
+    // This script is not related to the block at all.
+    excluded_scripts[1] << std::vector<unsigned char>(5, 33) << OP_CHECKSIG;
+
+    // OP_RETURN is non-standard since it's not followed by a data push, but is still excluded from
+    // filter.
+    excluded_scripts[2] << OP_RETURN << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+
+    CMutableTransaction tx_1;
+    tx_1.vout.push_back(CTxOut(100, included_scripts[0]));
+    tx_1.vout.push_back(CTxOut(200, included_scripts[1]));
+    tx_1.vout.push_back(CTxOut(0, excluded_scripts[0]));
+
+    CMutableTransaction tx_2;
+    tx_2.vout.push_back(CTxOut(300, included_scripts[2]));
+    tx_2.vout.push_back(CTxOut(0, excluded_scripts[2]));
+    tx_2.vout.push_back(CTxOut(400, CScript())); // Script is empty
+
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(tx_1));
+    block.vtx.push_back(MakeTransactionRef(tx_2));
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.push_back(CTxUndo());
+    block_undo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(500, included_scripts[3])));
+    block_undo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(600, included_scripts[4])));
+    block_undo.vtxundo.back().vprevout.push_back(CTxInUndo(CTxOut(700, CScript()))); // Script is empty
+
+    BlockFilter block_filter(BLOCK_FILTER_BASIC, block, block_undo);
+    const GCSFilter& filter = block_filter.GetFilter();
+
+    for (const CScript& script : included_scripts) {
+        BOOST_CHECK(filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+    for (const CScript& script : excluded_scripts) {
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+
+    // Test serialization/unserialization.
+    BlockFilter block_filter2;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block_filter;
+    stream >> block_filter2;
+
+    BOOST_CHECK_EQUAL(block_filter.GetFilterType(), block_filter2.GetFilterType());
+    BOOST_CHECK(block_filter.GetBlockHash() == block_filter2.GetBlockHash());
+    BOOST_CHECK(block_filter.GetEncodedFilter() == block_filter2.GetEncodedFilter());
+
+    // Filter headers chain through the previous header.
+    uint256 header = block_filter.ComputeHeader(uint256());
+    BOOST_CHECK(header == block_filter2.ComputeHeader(uint256()));
+    BOOST_CHECK(header != block_filter.ComputeHeader(header));
+
+    BlockFilter default_ctor_block_filter_1;
+    BlockFilter default_ctor_block_filter_2;
+    BOOST_CHECK_EQUAL(default_ctor_block_filter_1.GetFilterType(), default_ctor_block_filter_2.GetFilterType());
+    BOOST_CHECK(default_ctor_block_filter_1.GetBlockHash() == default_ctor_block_filter_2.GetBlockHash());
+    BOOST_CHECK(default_ctor_block_filter_1.GetEncodedFilter() == default_ctor_block_filter_2.GetEncodedFilter());
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_type_names)
+{
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BLOCK_FILTER_BASIC), "basic");
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(static_cast<BlockFilterType>(255)), "");
+
+    BlockFilterType filter_type;
+    BOOST_CHECK(BlockFilterTypeByName("basic", filter_type));
+    BOOST_CHECK_EQUAL(filter_type, BLOCK_FILTER_BASIC);
+
+    BOOST_CHECK(!BlockFilterTypeByName("unknown", filter_type));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,165 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockencodings.h"
+#include "chainparams.h"
+#include "consensus/merkle.h"
+#include "net.h"
+#include "net_processing.h"
+#include "netmessagemaker.h"
+#include "pow.h"
+#include "test/test_bitcoin.h"
+#include "util.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+// Relay of compact blocks between whitelisted peers (-whitelistcmpctrelay)
+
+BOOST_FIXTURE_TEST_SUITE(cmpctrelay_tests, TestingSetup)
+
+/** Nonce that gives the block built below a valid proof of work on main */
+static const uint32_t RELAY_BLOCK_NONCE = 654310;
+
+/** A block on top of the genesis block with one transaction besides the coinbase */
+static CBlock BuildBlock()
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    coinbase.vout[0].nValue = 50 * COIN;
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(uint256S("0x1"), 0);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.vout[0].nValue = COIN;
+
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = genesis.GetHash();
+    block.nTime = genesis.nTime + 60;
+    block.nBits = genesis.nBits;
+    block.nNonce = RELAY_BLOCK_NONCE;
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+    block.vtx.push_back(MakeTransactionRef(tx));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+static void InitNode(CNode& node, CConnman& connman)
+{
+    node.SetSendVersion(PROTOCOL_VERSION);
+    GetNodeSignals().InitializeNode(&node, connman);
+    node.nVersion = PROTOCOL_VERSION;
+    node.nServices = NODE_NETWORK;
+    node.fWhitelisted = true;
+    node.fSendCorked = true;
+    CConnmanTest::AddNode(node);
+    // Drop our version message to outbound peers, which would hold back processing
+    TakeSentMessages(node, "");
+    ReceiveMessage(node, connman, CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::VERACK));
+    TakeSentMessages(node, "");
+}
+
+BOOST_AUTO_TEST_CASE(whitelistcmpctrelay)
+{
+    ForceSetArg("-whitelistcmpctrelay", "1");
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CBlock block = BuildBlock();
+    BOOST_REQUIRE(CheckProofOfWork(block, block.nBits, Params().GetConsensus()));
+    SetMockTime(block.nTime + 60);
+
+    CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+    CNode source(2000, NODE_NONE, 0, INVALID_SOCKET, addr, 0, 0, "", false);
+    InitNode(source, *connman);
+    std::vector<CNode*> vPeers;
+    for (NodeId id = 2001; id <= 2004; id++) {
+        vPeers.push_back(new CNode(id, NODE_NONE, 0, INVALID_SOCKET, addr, 0, 0, "", true));
+        InitNode(*vPeers.back(), *connman);
+    }
+
+    // All whitelisted peers are asked to announce with cmpctblock, not just three
+    BOOST_FOREACH(CNode* pnode, vPeers) {
+        ReceiveMessage(*pnode, *connman, msgMaker.Make(NetMsgType::SENDCMPCT, false, (uint64_t)1));
+        std::vector<CDataStream> vSendCmpct = TakeSentMessages(*pnode, NetMsgType::SENDCMPCT);
+        BOOST_REQUIRE_EQUAL(vSendCmpct.size(), 1U);
+        bool fAnnounce;
+        uint64_t nVersion;
+        vSendCmpct[0] >> fAnnounce >> nVersion;
+        BOOST_CHECK(fAnnounce);
+        BOOST_CHECK_EQUAL(nVersion, 1U);
+    }
+    // but only once
+    ReceiveMessage(*vPeers[0], *connman, msgMaker.Make(NetMsgType::SENDCMPCT, false, (uint64_t)1));
+    BOOST_CHECK(TakeSentMessages(*vPeers[0], NetMsgType::SENDCMPCT).empty());
+
+    // The first three peers want cmpctblocks from us, and all have the genesis block
+    for (size_t i = 0; i < vPeers.size(); i++) {
+        if (i < 3)
+            ReceiveMessage(*vPeers[i], *connman, msgMaker.Make(NetMsgType::SENDCMPCT, true, (uint64_t)1));
+        ReceiveMessage(*vPeers[i], *connman, msgMaker.Make(NetMsgType::INV, std::vector<CInv>(1, CInv(MSG_BLOCK, block.hashPrevBlock))));
+        TakeSentMessages(*vPeers[i], "");
+    }
+
+    // A cmpctblock from a whitelisted peer is passed on before we have all its
+    // transactions, to the peers that want it
+    ReceiveMessage(source, *connman, msgMaker.Make(NetMsgType::SENDCMPCT, false, (uint64_t)1));
+    TakeSentMessages(source, "");
+    ReceiveMessage(source, *connman, msgMaker.Make(NetMsgType::CMPCTBLOCK, CBlockHeaderAndShortTxIDs(block, false)));
+    std::vector<CDataStream> vGetBlockTxn = TakeSentMessages(source, NetMsgType::GETBLOCKTXN);
+    BOOST_REQUIRE_EQUAL(vGetBlockTxn.size(), 1U);
+    for (size_t i = 0; i < vPeers.size(); i++) {
+        std::vector<CDataStream> vCmpctBlock = TakeSentMessages(*vPeers[i], NetMsgType::CMPCTBLOCK);
+        BOOST_CHECK_EQUAL(vCmpctBlock.size(), i < 3 ? 1U : 0U);
+    }
+
+    // Asking us for its transactions before we have them is answered once we do
+    BlockTransactionsRequest req;
+    req.blockhash = block.GetHash();
+    req.indexes.push_back(1);
+    ReceiveMessage(*vPeers[0], *connman, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
+    BOOST_CHECK(TakeSentMessages(*vPeers[0], NetMsgType::BLOCKTXN).empty());
+
+    BlockTransactionsRequest reqSource;
+    vGetBlockTxn[0] >> reqSource;
+    BOOST_CHECK(reqSource.blockhash == block.GetHash());
+    BOOST_REQUIRE(reqSource.indexes == std::vector<uint16_t>(1, 1));
+    BlockTransactions resp(reqSource);
+    resp.txn[0] = block.vtx[1];
+    ReceiveMessage(source, *connman, msgMaker.Make(NetMsgType::BLOCKTXN, resp));
+
+    BOOST_FOREACH(CNode* pnode, std::vector<CNode*>(vPeers.begin(), vPeers.begin() + 2)) {
+        if (pnode != vPeers[0])
+            ReceiveMessage(*pnode, *connman, msgMaker.Make(NetMsgType::GETBLOCKTXN, req));
+        std::vector<CDataStream> vBlockTxn = TakeSentMessages(*pnode, NetMsgType::BLOCKTXN);
+        BOOST_REQUIRE_EQUAL(vBlockTxn.size(), 1U);
+        BlockTransactions txn;
+        vBlockTxn[0] >> txn;
+        BOOST_CHECK(txn.blockhash == block.GetHash());
+        BOOST_REQUIRE_EQUAL(txn.txn.size(), 1U);
+        BOOST_CHECK(txn.txn[0]->GetHash() == block.vtx[1]->GetHash());
+    }
+
+    CConnmanTest::ClearNodes();
+    bool fUpdateConnectionTime = false;
+    GetNodeSignals().FinalizeNode(source.GetId(), fUpdateConnectionTime);
+    BOOST_FOREACH(CNode* pnode, vPeers) {
+        GetNodeSignals().FinalizeNode(pnode->GetId(), fUpdateConnectionTime);
+        delete pnode;
+    }
+    SetMockTime(0);
+    ForceSetArg("-whitelistcmpctrelay", "0");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "compressor.h"
+#include "consensus/merkle.h"
+#include "streams.h"
 #include "util.h"
 #include "test/test_bitcoin.h"
 
@@ -62,4 +64,61 @@ BOOST_AUTO_TEST_CASE(compress_amounts)
         BOOST_CHECK(TestDecode(i));
 }
 
+BOOST_AUTO_TEST_CASE(compress_block)
+{
+    CBlock block;
+    block.nVersion = 0x20000000;
+    block.nTime = 1500000000;
+    block.nBits = 0x207fffff;
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vin[0].scriptSig = CScript() << 42 << OP_0;
+    coinbase.vout.resize(2);
+    coinbase.vout[0].nValue = 50 * COIN;
+    coinbase.vout[0].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x11) << OP_EQUALVERIFY << OP_CHECKSIG;
+    coinbase.vout[1].nValue = 0;
+    coinbase.vout[1].scriptPubKey = CScript() << OP_RETURN << std::vector<unsigned char>(36, 0xaa);
+    block.vtx.push_back(MakeTransactionRef(coinbase));
+
+    CMutableTransaction spend;
+    spend.nVersion = 2;
+    spend.nLockTime = 123456;
+    spend.vin.resize(2);
+    spend.vin[0].prevout = COutPoint(coinbase.GetHash(), 0);
+    spend.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    spend.vin[1].prevout = COutPoint(uint256S("0x01"), 300);
+    spend.vin[1].nSequence = 0xfffffffe;
+    spend.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(72, 0x30));
+    spend.vin[1].scriptWitness.stack.push_back(std::vector<unsigned char>(33, 0x03));
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 12345678;
+    spend.vout[0].scriptPubKey = CScript() << OP_HASH160 << std::vector<unsigned char>(20, 0x22) << OP_EQUAL;
+    block.vtx.push_back(MakeTransactionRef(spend));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    BOOST_CHECK(CBlockCompressor::IsCompressible(block));
+
+    CDataStream ss(SER_DISK, 0);
+    ss << CBlockCompressor(block);
+    BOOST_CHECK(ss.size() < ::GetSerializeSize(block, SER_DISK, 0));
+
+    CBlock block2;
+    ss >> REF(CBlockCompressor(block2));
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK_EQUAL(block2.GetHash().ToString(), block.GetHash().ToString());
+    BOOST_REQUIRE_EQUAL(block2.vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK(block2.vtx[i]->GetWitnessHash() == block.vtx[i]->GetWitnessHash());
+    }
+    BOOST_CHECK(BlockMerkleRoot(block2) == block.hashMerkleRoot);
+
+    // Amounts out of range would not round-trip
+    CMutableTransaction invalid(spend);
+    invalid.vout[0].nValue = -1;
+    block.vtx.push_back(MakeTransactionRef(invalid));
+    BOOST_CHECK(!CBlockCompressor::IsCompressible(block));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,9 +2,13 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "consensus/validation.h"
 #include "policy/policy.h"
+#include "script/standard.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "util.h"
+#include "validation.h"
 
 #include "test/test_bitcoin.h"
 
@@ -105,6 +109,262 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     BOOST_CHECK_EQUAL(testPool.size(), 0);
 }
 
+static CMutableTransaction SpendOutpoints(const std::vector<COutPoint>& vprevout, int nOutputs)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(vprevout.size());
+    for (unsigned int i = 0; i < vprevout.size(); i++) {
+        tx.vin[i].prevout = vprevout[i];
+        tx.vin[i].scriptSig = CScript() << OP_11;
+    }
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[i].nValue = 10000LL;
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(MempoolRemoveForBlockTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool testPool(CFeeRate(0));
+
+    // txParent -> txChild are mined; txGrandChild and txSibling stay behind
+    CMutableTransaction txParent = SpendOutpoints({COutPoint(GetRandHash(), 0)}, 2);
+    CMutableTransaction txChild = SpendOutpoints({COutPoint(txParent.GetHash(), 0)}, 1);
+    CMutableTransaction txGrandChild = SpendOutpoints({COutPoint(txChild.GetHash(), 0)}, 1);
+    CMutableTransaction txSibling = SpendOutpoints({COutPoint(txParent.GetHash(), 1)}, 1);
+    // txSpent is spent by a mined transaction, but is not mined itself
+    CMutableTransaction txSpent = SpendOutpoints({COutPoint(GetRandHash(), 0)}, 1);
+    CMutableTransaction txSpender = SpendOutpoints({COutPoint(txSpent.GetHash(), 0)}, 1);
+    // txConflict (with its child) double spends a mined transaction that is
+    // not in the mempool
+    COutPoint outpointConflicted(GetRandHash(), 0);
+    CMutableTransaction txConflict = SpendOutpoints({outpointConflicted}, 1);
+    CMutableTransaction txConflictChild = SpendOutpoints({COutPoint(txConflict.GetHash(), 0)}, 1);
+    CMutableTransaction txMined = SpendOutpoints({outpointConflicted}, 2);
+
+    testPool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).FromTx(txParent));
+    testPool.addUnchecked(txChild.GetHash(), entry.FromTx(txChild));
+    testPool.addUnchecked(txGrandChild.GetHash(), entry.FromTx(txGrandChild));
+    testPool.addUnchecked(txSibling.GetHash(), entry.FromTx(txSibling));
+    testPool.addUnchecked(txSpent.GetHash(), entry.FromTx(txSpent));
+    testPool.addUnchecked(txSpender.GetHash(), entry.FromTx(txSpender));
+    testPool.addUnchecked(txConflict.GetHash(), entry.FromTx(txConflict));
+    testPool.addUnchecked(txConflictChild.GetHash(), entry.FromTx(txConflictChild));
+    BOOST_CHECK_EQUAL(testPool.size(), 8);
+
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(txParent));
+    vtx.push_back(MakeTransactionRef(txChild));
+    vtx.push_back(MakeTransactionRef(txSpender));
+    vtx.push_back(MakeTransactionRef(txMined));
+    testPool.removeForBlock(vtx, 1);
+
+    BOOST_CHECK_EQUAL(testPool.size(), 3);
+    BOOST_CHECK(!testPool.exists(txConflict.GetHash()));
+    BOOST_CHECK(!testPool.exists(txConflictChild.GetHash()));
+
+    LOCK(testPool.cs);
+    CTxMemPool::txiter it = testPool.mapTx.find(txGrandChild.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), it->GetTxSize());
+    BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), 1000LL);
+    BOOST_CHECK(testPool.GetMemPoolParents(it).empty());
+    it = testPool.mapTx.find(txSibling.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), it->GetTxSize());
+    it = testPool.mapTx.find(txSpent.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), it->GetTxSize());
+    BOOST_CHECK(testPool.GetMemPoolChildren(it).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPersistTest)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction txFunding = SpendOutpoints({COutPoint(GetRandHash(), 0)}, 2);
+    CMutableTransaction txParent = SpendOutpoints({COutPoint(txFunding.GetHash(), 0)}, 1);
+    CMutableTransaction txChild = SpendOutpoints({COutPoint(txParent.GetHash(), 0)}, 1);
+    CMutableTransaction txOther = SpendOutpoints({COutPoint(txFunding.GetHash(), 1)}, 1);
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyNewCoins(txFunding.GetHash(), false)->FromTx(txFunding, 1);
+    }
+
+    int64_t nTime = GetTime();
+    mempool.addUnchecked(txParent.GetHash(), entry.Fee(1000LL).Time(nTime).Priority(2.0).SigOpsCost(8).FromTx(txParent));
+    mempool.addUnchecked(txChild.GetHash(), entry.Fee(2000LL).SigOpsCost(12).FromTx(txChild));
+    mempool.addUnchecked(txOther.GetHash(), entry.Fee(3000LL).FromTx(txOther));
+    mempool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0, 500LL);
+
+    DumpMempool();
+    mempool.clear();
+    mempool.ClearPrioritisation(txChild.GetHash());
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    // The tip has not moved, so the entries come back as they were dumped
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+    {
+        LOCK2(cs_main, mempool.cs);
+        mempool.check(pcoinsTip);
+        CTxMemPool::txiter it = mempool.mapTx.find(txParent.GetHash());
+        BOOST_CHECK_EQUAL(it->GetFee(), 1000LL);
+        BOOST_CHECK_EQUAL(it->GetTime(), nTime);
+        BOOST_CHECK_EQUAL(it->GetSigOpCost(), 8);
+        BOOST_CHECK_EQUAL(it->GetPriority(it->GetHeight()), 2.0);
+        BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 2);
+        it = mempool.mapTx.find(txChild.GetHash());
+        BOOST_CHECK_EQUAL(it->GetModifiedFee(), 2500LL);
+        BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), 3500LL);
+        BOOST_CHECK_EQUAL(it->GetSigOpCostWithAncestors(), 20);
+    }
+
+    mempool.clear();
+    mempool.ClearPrioritisation(txChild.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolPersistRevalidateTest)
+{
+    // A parent and child that pass policy, and a non-standard transaction
+    // that only gets back in without revalidation
+    TestMemPoolEntryHelper entry;
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScript scriptSig = CScript() << std::vector<unsigned char>(redeemScript.begin(), redeemScript.end());
+    CMutableTransaction txFunding = SpendOutpoints({COutPoint(GetRandHash(), 0)}, 2);
+    txFunding.vout[0].scriptPubKey = txFunding.vout[1].scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    txFunding.vout[0].nValue = txFunding.vout[1].nValue = 10 * COIN;
+    CMutableTransaction txParent = SpendOutpoints({COutPoint(txFunding.GetHash(), 0)}, 1);
+    txParent.vin[0].scriptSig = scriptSig;
+    txParent.vout[0].scriptPubKey = txFunding.vout[0].scriptPubKey;
+    txParent.vout[0].nValue = 10 * COIN - COIN / 100;
+    CMutableTransaction txChild = SpendOutpoints({COutPoint(txParent.GetHash(), 0)}, 1);
+    txChild.vin[0].scriptSig = scriptSig;
+    txChild.vout[0].scriptPubKey = txFunding.vout[0].scriptPubKey;
+    txChild.vout[0].nValue = txParent.vout[0].nValue - COIN / 100;
+    CMutableTransaction txNonStandard = SpendOutpoints({COutPoint(txFunding.GetHash(), 1)}, 1);
+    txNonStandard.vin[0].scriptSig = scriptSig;
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyNewCoins(txFunding.GetHash(), false)->FromTx(txFunding, 1);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txParent), false, NULL));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txChild), false, NULL));
+    }
+    mempool.addUnchecked(txNonStandard.GetHash(), entry.Fee(0).Time(GetTime()).FromTx(txNonStandard));
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+    DumpMempool();
+
+    // Unchanged tip and policy: trusted as dumped
+    mempool.clear();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+
+    // A policy change revalidates, here rejecting the child
+    mempool.clear();
+    ForceSetArg("-limitancestorcount", "1");
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 1);
+    BOOST_CHECK(mempool.exists(txParent.GetHash()));
+    ForceSetArg("-limitancestorcount", std::to_string(DEFAULT_ANCESTOR_LIMIT));
+
+    // As does a mempool dumped at another tip; overwrite the tip hash, which
+    // follows the version
+    FILE* file = fopen((GetDataDir() / "mempool.dat").string().c_str(), "r+b");
+    BOOST_REQUIRE(file);
+    uint256 hashOtherTip = GetRandHash();
+    BOOST_CHECK_EQUAL(fseek(file, sizeof(uint64_t), SEEK_SET), 0);
+    BOOST_CHECK_EQUAL(fwrite(hashOtherTip.begin(), 1, hashOtherTip.size(), file), hashOtherTip.size());
+    fclose(file);
+    mempool.clear();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    BOOST_CHECK(!mempool.exists(txNonStandard.GetHash()));
+
+    // and one written before the validation state was stored
+    {
+        CAutoFile fileV1(fopen((GetDataDir() / "mempool.dat").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileV1.IsNull());
+        fileV1 << (uint64_t)1 << (uint64_t)3;
+        for (const CMutableTransaction& tx : {txParent, txChild, txNonStandard})
+            fileV1 << CTransaction(tx) << GetTime() << (int64_t)0;
+        fileV1 << std::map<uint256, CAmount>();
+    }
+    mempool.clear();
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    BOOST_CHECK(!mempool.exists(txNonStandard.GetHash()));
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    TestMemPoolEntryHelper entry;
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++)
+    {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(1);
+    txGrandChild.vin[0].scriptSig = CScript() << OP_11;
+    txGrandChild.vin[0].prevout.hash = txChild[0].GetHash();
+    txGrandChild.vin[0].prevout.n = 0;
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 11000LL;
+
+    CTxMemPool testPool(CFeeRate(0));
+    testPool.addUnchecked(txParent.GetHash(), entry.Fee(10000LL).FromTx(txParent));
+    testPool.addUnchecked(txChild[0].GetHash(), entry.Fee(0).FromTx(txChild[0]));
+    testPool.addUnchecked(txChild[1].GetHash(), entry.FromTx(txChild[1]));
+    testPool.addUnchecked(txGrandChild.GetHash(), entry.FromTx(txGrandChild));
+
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = testPool.GetSnapshot();
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 4);
+    std::vector<uint256> vtxid;
+    testPool.queryHashes(vtxid);
+    for (size_t i = 0; i < vtxid.size(); i++)
+        BOOST_CHECK(snapshot->vEntries[i].entry.GetTx().GetHash() == vtxid[i]);
+    BOOST_CHECK(snapshot->Find(txParent.GetHash()) == &snapshot->vEntries[0]);
+    BOOST_CHECK(snapshot->Find(txParent.vin[0].prevout.hash) == NULL);
+
+    const CTxMemPoolSnapshot::Entry* pentry = snapshot->Find(txChild[0].GetHash());
+    BOOST_CHECK(pentry != NULL);
+    BOOST_CHECK_EQUAL(pentry->vParents.size(), 1);
+    BOOST_CHECK_EQUAL(pentry->vChildren.size(), 1);
+
+    // Unchanged pools share the snapshot; any change makes a new one
+    BOOST_CHECK(testPool.GetSnapshot() == snapshot);
+    testPool.PrioritiseTransaction(txChild[1].GetHash(), txChild[1].GetHash().ToString(), 0, 5000LL);
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshotPrioritised = testPool.GetSnapshot();
+    BOOST_CHECK(snapshotPrioritised != snapshot);
+    BOOST_CHECK_EQUAL(snapshotPrioritised->Find(txChild[1].GetHash())->entry.GetModifiedFee(), 5000LL);
+    BOOST_CHECK_EQUAL(snapshot->Find(txChild[1].GetHash())->entry.GetModifiedFee(), 0);
+
+    testPool.removeRecursive(txChild[0]);
+    BOOST_CHECK_EQUAL(testPool.GetSnapshot()->vEntries.size(), 2);
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 4);
+}
+
 template<typename name>
 void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder)
 {
@@ -116,6 +376,49 @@ void CheckSort(CTxMemPool &pool, std::vector<std::string> &sortedOrder)
     }
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorLimitsTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool(CFeeRate(0));
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string errString;
+
+    // Diamond: txTop -> txLeft, txRight -> txBottom
+    CMutableTransaction txTop = SpendOutpoints({COutPoint(GetRandHash(), 0)}, 2);
+    CMutableTransaction txLeft = SpendOutpoints({COutPoint(txTop.GetHash(), 0)}, 1);
+    CMutableTransaction txRight = SpendOutpoints({COutPoint(txTop.GetHash(), 1)}, 1);
+    CMutableTransaction txBottom = SpendOutpoints({COutPoint(txLeft.GetHash(), 0), COutPoint(txRight.GetHash(), 0)}, 1);
+    pool.addUnchecked(txTop.GetHash(), entry.FromTx(txTop));
+    pool.addUnchecked(txLeft.GetHash(), entry.FromTx(txLeft));
+    pool.addUnchecked(txRight.GetHash(), entry.FromTx(txRight));
+
+    // txTop is reached through both parents but only counted once
+    CTxMemPoolEntry bottomEntry = entry.FromTx(txBottom);
+    CTxMemPool::setEntries setAncestors;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(bottomEntry, setAncestors, 4, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 3);
+    BOOST_CHECK(pool.CheckMemPoolAncestorLimits(bottomEntry, 4, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK(!pool.CheckMemPoolAncestorLimits(bottomEntry, 3, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(errString, "too many unconfirmed ancestors [limit: 3]");
+    BOOST_CHECK(!pool.CheckMemPoolAncestorLimits(bottomEntry, 2, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(errString, "too many unconfirmed parents [limit: 2]");
+    // txTop would get 4 descendants including itself
+    BOOST_CHECK(!pool.CheckMemPoolAncestorLimits(bottomEntry, nNoLimit, nNoLimit, 3, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(errString, strprintf("too many descendants for tx %s [limit: 3]", txTop.GetHash().ToString()));
+    BOOST_CHECK(pool.CheckMemPoolAncestorLimits(bottomEntry, nNoLimit, nNoLimit, 4, nNoLimit, errString));
+    BOOST_CHECK(!pool.CheckMemPoolAncestorLimits(bottomEntry, nNoLimit, bottomEntry.GetTxSize(), nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(errString, strprintf("exceeds ancestor size limit [limit: %u]", bottomEntry.GetTxSize()));
+
+    // Once in the mempool, the same ancestors are found through its links
+    pool.addUnchecked(txBottom.GetHash(), bottomEntry);
+    CTxMemPool::setEntries setLinkedAncestors;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(*pool.mapTx.find(txBottom.GetHash()), setLinkedAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, errString, false));
+    BOOST_CHECK(setLinkedAncestors == setAncestors);
+    CTxMemPool::setEntries setDescendants;
+    pool.CalculateDescendants(pool.mapTx.find(txTop.GetHash()), setDescendants);
+    BOOST_CHECK_EQUAL(setDescendants.size(), 4);
+}
+
 BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
 {
     CTxMemPool pool(CFeeRate(0));
@@ -546,7 +849,7 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
         pool.addUnchecked(tx5.GetHash(), entry.Fee(1000LL).FromTx(tx5, &pool));
     pool.addUnchecked(tx7.GetHash(), entry.Fee(9000LL).FromTx(tx7, &pool));
 
-    pool.TrimToSize(pool.DynamicMemoryUsage() / 2); // should maximize mempool size by only removing 5/7
+    pool.TrimToSize(pool.DynamicMemoryUsage() * 3 / 5); // should maximize mempool size by only removing 5/7
     BOOST_CHECK(pool.exists(tx4.GetHash()));
     BOOST_CHECK(!pool.exists(tx5.GetHash()));
     BOOST_CHECK(pool.exists(tx6.GetHash()));
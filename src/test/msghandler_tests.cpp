@@ -0,0 +1,110 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "net.h"
+#include "net_processing.h"
+#include "test/test_bitcoin.h"
+#include "utiltime.h"
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+// Several message handler threads (-msghandlerthreads) sharing the peers
+
+BOOST_FIXTURE_TEST_SUITE(msghandler_tests, TestingSetup)
+
+namespace {
+/** Stands in for the peers' messages, and records how they were processed */
+struct MessageLog
+{
+    std::mutex mutex;
+    std::map<NodeId, std::deque<int> > mapQueued;
+    std::map<NodeId, std::vector<int> > mapProcessed;
+    std::map<NodeId, int> mapActive;
+    std::set<std::thread::id> setThreads;
+    bool fOverlap = false;
+    size_t nRemaining = 0;
+};
+
+MessageLog messageLog;
+
+/** Process the next message of the peer, taking a while so that threads would overlap */
+bool ProcessLoggedMessage(CNode* pnode, CConnman& connman, std::atomic<bool>& interrupt)
+{
+    int nMessage;
+    {
+        std::lock_guard<std::mutex> lock(messageLog.mutex);
+        messageLog.setThreads.insert(std::this_thread::get_id());
+        messageLog.fOverlap |= ++messageLog.mapActive[pnode->GetId()] > 1;
+        std::deque<int>& queue = messageLog.mapQueued[pnode->GetId()];
+        if (queue.empty()) {
+            messageLog.mapActive[pnode->GetId()]--;
+            return false;
+        }
+        nMessage = queue.front();
+        queue.pop_front();
+    }
+    MilliSleep(1);
+    std::lock_guard<std::mutex> lock(messageLog.mutex);
+    messageLog.mapProcessed[pnode->GetId()].push_back(nMessage);
+    messageLog.mapActive[pnode->GetId()]--;
+    messageLog.nRemaining--;
+    return !messageLog.mapQueued[pnode->GetId()].empty();
+}
+}
+
+BOOST_AUTO_TEST_CASE(msghandler_peer_order)
+{
+    const int nPeers = 8;
+    const int nMessages = 50;
+    CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+    std::vector<CNode*> vNodes;
+    for (NodeId id = 4000; id < 4000 + nPeers; id++) {
+        vNodes.push_back(new CNode(id, NODE_NONE, 0, INVALID_SOCKET, addr, 0, 0, "", true));
+        for (int i = 0; i < nMessages; i++)
+            messageLog.mapQueued[id].push_back(i);
+        messageLog.nRemaining += nMessages;
+        CConnmanTest::AddNode(*vNodes.back());
+    }
+
+    // Only the messages of the peers are processed, nothing is sent
+    UnregisterNodeSignals(GetNodeSignals());
+    boost::signals2::connection conn = GetNodeSignals().ProcessMessages.connect(&ProcessLoggedMessage);
+    CConnmanTest::StartMessageHandlers(4);
+    for (int i = 0; i < 1000; i++) {
+        {
+            std::lock_guard<std::mutex> lock(messageLog.mutex);
+            if (messageLog.nRemaining == 0)
+                break;
+        }
+        MilliSleep(10);
+    }
+    CConnmanTest::StopMessageHandlers();
+    conn.disconnect();
+    RegisterNodeSignals(GetNodeSignals());
+    CConnmanTest::ClearNodes();
+
+    // All threads took part, but never two on the same peer, whose messages
+    // were processed in order
+    BOOST_CHECK_EQUAL(messageLog.nRemaining, 0U);
+    BOOST_CHECK(messageLog.setThreads.size() > 1);
+    BOOST_CHECK(!messageLog.fOverlap);
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        std::vector<int>& vProcessed = messageLog.mapProcessed[pnode->GetId()];
+        BOOST_CHECK_EQUAL(vProcessed.size(), (size_t)nMessages);
+        for (size_t i = 0; i < vProcessed.size(); i++)
+            BOOST_CHECK_EQUAL(vProcessed[i], (int)i);
+        delete pnode;
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "streams.h"
 #include "net.h"
+#include "netmessagemaker.h"
 #include "netbase.h"
 #include "chainparams.h"
 
@@ -178,4 +179,199 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+BOOST_AUTO_TEST_CASE(socketevents_mode)
+{
+    SocketEventsMode mode;
+    BOOST_CHECK(ParseSocketEventsMode("select", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_SELECT);
+#ifdef USE_POLL
+    BOOST_CHECK(ParseSocketEventsMode("poll", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_POLL);
+#endif
+#ifdef USE_EPOLL
+    BOOST_CHECK(ParseSocketEventsMode("epoll", mode));
+    BOOST_CHECK_EQUAL(mode, SOCKETEVENTS_EPOLL);
+#else
+    BOOST_CHECK(!ParseSocketEventsMode("epoll", mode));
+#endif
+    BOOST_CHECK(!ParseSocketEventsMode("kqueue", mode));
+    BOOST_CHECK(!ParseSocketEventsMode("", mode));
+
+    // The default is always available and round-trips
+    BOOST_CHECK(ParseSocketEventsMode(GetSocketEventsModeName(DEFAULT_SOCKETEVENTS), mode));
+    BOOST_CHECK_EQUAL(mode, DEFAULT_SOCKETEVENTS);
+}
+
+BOOST_AUTO_TEST_CASE(msghandler_threads)
+{
+    BOOST_CHECK_EQUAL(GetMsgHandlerThreads(DEFAULT_MSGHANDLER_THREADS), DEFAULT_MSGHANDLER_THREADS);
+    BOOST_CHECK_EQUAL(GetMsgHandlerThreads(1), 1);
+    BOOST_CHECK_EQUAL(GetMsgHandlerThreads(MAX_MSGHANDLER_THREADS), MAX_MSGHANDLER_THREADS);
+    BOOST_CHECK_EQUAL(GetMsgHandlerThreads(MAX_MSGHANDLER_THREADS + 1), MAX_MSGHANDLER_THREADS);
+
+    // Relative to the number of cores, but never less than one thread
+    BOOST_CHECK_EQUAL(GetMsgHandlerThreads(0), std::max(1, std::min(GetNumCores(), MAX_MSGHANDLER_THREADS)));
+    BOOST_CHECK_EQUAL(GetMsgHandlerThreads(-1), std::max(1, std::min(GetNumCores() - 1, MAX_MSGHANDLER_THREADS)));
+    BOOST_CHECK_EQUAL(GetMsgHandlerThreads(-1000), 1);
+}
+
+BOOST_AUTO_TEST_CASE(message_header_write)
+{
+    CMessageHeader hdr(Params().MessageStart(), "inv", 0x01020304);
+    for (int i = 0; i < CMessageHeader::CHECKSUM_SIZE; i++)
+        hdr.pchChecksum[i] = 0xa0 + i;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hdr;
+    unsigned char pch[CMessageHeader::HEADER_SIZE];
+    hdr.Write(pch);
+    BOOST_CHECK_EQUAL(ss.size(), sizeof(pch));
+    BOOST_CHECK(memcmp(ss.data(), pch, sizeof(pch)) == 0);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(push_message_framing)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CConnman connman(0x1337, 0x1337);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    CNode node(0, NODE_NETWORK, 0, fds[0], CAddress(CService(ipv4Addr, 7777), NODE_NETWORK), 0, 0, "", false);
+
+    // Messages pushed while corked are only queued, and go out together
+    // once uncorked, each framed as its header followed by its payload
+    connman.CorkSend(&node, true);
+    connman.PushMessage(&node, CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::PING, (uint64_t)42));
+    connman.PushMessage(&node, CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::VERACK));
+    connman.PushMessage(&node, CNetMsgMaker(PROTOCOL_VERSION).Make(NetMsgType::PONG, (uint64_t)7));
+    BOOST_CHECK_EQUAL(node.vSendMsg.size(), 3U);
+    BOOST_CHECK_EQUAL(node.nSendSize, 3 * CMessageHeader::HEADER_SIZE + 16U);
+    unsigned char buf[256];
+    BOOST_CHECK(recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT) < 0);
+
+    connman.CorkSend(&node, false);
+    BOOST_CHECK(node.vSendMsg.empty());
+    BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+    BOOST_CHECK_EQUAL(node.nSendOffset, 0U);
+
+    ssize_t nBytes = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+    BOOST_REQUIRE_EQUAL(nBytes, 3 * CMessageHeader::HEADER_SIZE + 16);
+    CDataStream ss((const char*)buf, (const char*)buf + nBytes, SER_NETWORK, PROTOCOL_VERSION);
+    const char* commands[] = {NetMsgType::PING, NetMsgType::VERACK, NetMsgType::PONG};
+    const uint64_t nonces[] = {42, 0, 7};
+    for (int i = 0; i < 3; i++) {
+        CMessageHeader hdr(Params().MessageStart());
+        ss >> hdr;
+        BOOST_CHECK(hdr.IsValid(Params().MessageStart()));
+        BOOST_CHECK_EQUAL(hdr.GetCommand(), commands[i]);
+        BOOST_CHECK_EQUAL(hdr.nMessageSize, nonces[i] ? 8U : 0U);
+        if (nonces[i]) {
+            uint64_t nonce = 0;
+            ss >> nonce;
+            BOOST_CHECK_EQUAL(nonce, nonces[i]);
+        }
+    }
+    BOOST_CHECK(ss.empty());
+    close(fds[1]);
+}
+
+BOOST_AUTO_TEST_CASE(push_shared_payload)
+{
+    CConnman connman(0x1337, 0x1337);
+    in_addr ipv4Addr;
+    ipv4Addr.s_addr = 0xa0b0c001;
+    std::vector<uint256> vHashes(100, GetRandHash());
+
+    // A shared payload goes out as if it had been made for each peer
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CSharedNetMsgPayloadRef payload = msgMaker.MakePayload(0, vHashes);
+    CSerializedNetMsg msg = msgMaker.Make(NetMsgType::GETHEADERS, vHashes);
+    BOOST_CHECK(payload->data == msg.data);
+    BOOST_CHECK(payload->hash == Hash(msg.data.begin(), msg.data.end()));
+
+    std::vector<unsigned char> vExpected;
+    for (int i = 0; i < 3; i++) {
+        int fds[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        CNode node(i, NODE_NETWORK, 0, fds[0], CAddress(CService(ipv4Addr, 7777), NODE_NETWORK), 0, 0, "", false);
+        if (i == 0)
+            connman.PushMessage(&node, msgMaker.Make(NetMsgType::GETHEADERS, vHashes));
+        else
+            connman.PushMessage(&node, msgMaker.MakeShared(NetMsgType::GETHEADERS, payload));
+        BOOST_CHECK(node.vSendMsg.empty());
+
+        std::vector<unsigned char> buf(CMessageHeader::HEADER_SIZE + payload->data.size() + 1);
+        ssize_t nBytes = recv(fds[1], buf.data(), buf.size(), MSG_DONTWAIT);
+        BOOST_REQUIRE_EQUAL(nBytes, (ssize_t)buf.size() - 1);
+        buf.resize(nBytes);
+        if (i == 0)
+            vExpected = buf;
+        BOOST_CHECK(buf == vExpected);
+        close(fds[1]);
+    }
+    BOOST_CHECK(payload.unique());
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(cnetmessage_receive_in_place)
+{
+    std::vector<unsigned char> payload(300000);
+    for (size_t i = 0; i < payload.size(); i++)
+        payload[i] = i * 7;
+    uint256 hash = Hash(payload.begin(), payload.end());
+    CMessageHeader hdr(Params().MessageStart(), "block", payload.size());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << hdr;
+
+    // Receiving into the message's own buffer gives the same message as
+    // copying into it, except for the tail too short to be worth it
+    for (int fInPlace = 0; fInPlace < 2; fInPlace++) {
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+        BOOST_CHECK_EQUAL(msg.readHeader(&ssHeader[0], ssHeader.size()), (int)ssHeader.size());
+        BOOST_CHECK(msg.in_data);
+        unsigned int nPos = 0;
+        int nInPlace = 0;
+        while (!msg.complete()) {
+            unsigned int nSize = 0;
+            char* pch = fInPlace ? msg.GetDataBuffer(0x10000, nSize) : NULL;
+            if (pch) {
+                BOOST_CHECK(nSize >= 0x10000 && nSize <= payload.size() - nPos);
+                memcpy(pch, &payload[nPos], nSize);
+                nInPlace++;
+            } else {
+                BOOST_CHECK(!fInPlace || payload.size() - nPos < 0x10000);
+                nSize = std::min(0x10000u, (unsigned int)payload.size() - nPos);
+                pch = (char*)&payload[nPos];
+            }
+            BOOST_CHECK_EQUAL(msg.readData(pch, nSize), (int)nSize);
+            nPos += nSize;
+        }
+        BOOST_CHECK_EQUAL(nInPlace > 0, fInPlace == 1);
+        BOOST_CHECK_EQUAL(msg.vRecv.size(), payload.size());
+        BOOST_CHECK(std::equal(payload.begin(), payload.end(), (unsigned char*)&msg.vRecv[0]));
+        BOOST_CHECK(msg.GetMessageHash() == hash);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_receive_bounded)
+{
+    // Payload buffers only grow with the bytes received, whatever size the
+    // header announces, and large buffers are not kept for reuse
+    const unsigned int nLargeSize = 8 * 1024 * 1024;
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << CMessageHeader(Params().MessageStart(), "block", nLargeSize);
+    char chByte = 0;
+    for (int i = 0; i < 2; i++) {
+        CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+        BOOST_CHECK_EQUAL(msg.readHeader(&ssHeader[0], ssHeader.size()), (int)ssHeader.size());
+        BOOST_CHECK_EQUAL(msg.readData(&chByte, 1), 1);
+        BOOST_CHECK(msg.vRecv.capacity() < 2 * 1024 * 1024);
+
+        std::vector<char> vChunk(nLargeSize - 1);
+        BOOST_CHECK_EQUAL(msg.readData(&vChunk[0], vChunk.size()), (int)vChunk.size());
+        BOOST_CHECK(msg.complete());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -151,6 +151,14 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
         BOOST_CHECK(mpool.estimateSmartFee(i, &answerFound).GetFeePerK() > origFeeEst[answerFound-1] - deltaFee);
     }
 
+    // The curve answers exactly what estimateSmartFee does for each target
+    std::vector<std::pair<CFeeRate, int> > curve = mpool.estimateSmartFeeCurve(MIN_SUCCESS_PCT);
+    BOOST_CHECK_EQUAL(curve.size(), MAX_BLOCK_CONFIRMS);
+    for (unsigned int i = 1; i <= curve.size(); i++) {
+        BOOST_CHECK(curve[i-1].first == mpool.estimateSmartFee(i, &answerFound));
+        BOOST_CHECK_EQUAL(curve[i-1].second, answerFound);
+    }
+
     // Mine all those transactions
     // Estimates should still not be below original
     for (int j = 0; j < 10; j++) {
@@ -0,0 +1,121 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sketch.h"
+
+#include "clientversion.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sketch_tests, BasicTestingSetup)
+
+static uint32_t RandomElement()
+{
+    uint32_t n = 0;
+    while (n == 0)
+        n = insecure_rand();
+    return n;
+}
+
+static std::set<uint32_t> Decode(const CSketch& sketch)
+{
+    std::vector<uint32_t> vElements;
+    BOOST_CHECK(sketch.Decode(vElements));
+    return std::set<uint32_t>(vElements.begin(), vElements.end());
+}
+
+BOOST_AUTO_TEST_CASE(sketch_decode)
+{
+    CSketch empty(10);
+    BOOST_CHECK(Decode(empty).empty());
+
+    CSketch single(10);
+    single.Add(12345);
+    BOOST_CHECK(Decode(single) == std::set<uint32_t>({12345}));
+    single.Add(12345);
+    BOOST_CHECK(Decode(single).empty());
+
+    for (size_t nCapacity = 1; nCapacity <= 64; nCapacity++) {
+        std::set<uint32_t> setElements;
+        while (setElements.size() < nCapacity)
+            setElements.insert(RandomElement());
+        CSketch sketch(nCapacity);
+        BOOST_FOREACH(uint32_t n, setElements)
+            sketch.Add(n);
+        BOOST_CHECK(Decode(sketch) == setElements);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sketch_reconcile)
+{
+    seed_insecure_rand(true);
+    for (int i = 0; i < 20; i++) {
+        size_t nCapacity = 1 + insecure_rand() % 40;
+        CSketch sketch1(nCapacity), sketch2(nCapacity + insecure_rand() % 10);
+
+        // Elements in both sets cancel out
+        for (int j = 0; j < 200; j++) {
+            uint32_t n = RandomElement();
+            sketch1.Add(n);
+            sketch2.Add(n);
+        }
+        std::set<uint32_t> setDifference;
+        while (setDifference.size() < insecure_rand() % (nCapacity + 1))
+            setDifference.insert(RandomElement());
+        BOOST_FOREACH(uint32_t n, setDifference) {
+            if (insecure_rand() % 2)
+                sketch1.Add(n);
+            else
+                sketch2.Add(n);
+        }
+
+        sketch1.Merge(sketch2);
+        BOOST_CHECK_EQUAL(sketch1.GetCapacity(), nCapacity);
+        BOOST_CHECK(Decode(sketch1) == setDifference);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sketch_overflow)
+{
+    // Larger differences than the capacity do not decode, not even for the
+    // smallest capacities, where any difference has a short recurrence
+    seed_insecure_rand(true);
+    for (size_t nCapacity = 1; nCapacity <= 16; nCapacity++) {
+        for (int i = 0; i < 50; i++) {
+            CSketch sketch(nCapacity);
+            size_t nElements = nCapacity + 1 + insecure_rand() % (nCapacity + 2);
+            for (size_t j = 0; j < nElements; j++)
+                sketch.Add(RandomElement());
+            std::vector<uint32_t> vElements;
+            BOOST_CHECK(!sketch.Decode(vElements));
+            BOOST_CHECK(vElements.empty());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sketch_serialize)
+{
+    CSketch sketch(5);
+    sketch.Add(1);
+    sketch.Add(0xffffffff);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << sketch;
+    BOOST_CHECK_EQUAL(ss.size(), 1 + 4 * (5 + SKETCH_CHECK_SYNDROMES));
+
+    CSketch sketch2;
+    ss >> sketch2;
+    BOOST_CHECK_EQUAL(sketch2.GetCapacity(), 5);
+    BOOST_CHECK(Decode(sketch2) == std::set<uint32_t>({1, 0xffffffff}));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,61 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "index/spentindex.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(spentindex_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(spentindex_update)
+{
+    SpentIndex::DB db(1 << 20, true);
+
+    uint256 prevHash = GetRandHash();
+    uint256 spendHash = GetRandHash();
+    CSpentIndexKey key0(prevHash, 0);
+    CSpentIndexKey key1(prevHash, 1);
+    CSpentIndexValue value;
+
+    BOOST_CHECK(!db.ReadSpent(key0, value));
+
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vect;
+    vect.push_back(std::make_pair(key0, CSpentIndexValue(spendHash, 2, 100)));
+    BOOST_CHECK(db.UpdateSpent(vect));
+
+    BOOST_CHECK(db.ReadSpent(key0, value));
+    BOOST_CHECK(value.txid == spendHash);
+    BOOST_CHECK_EQUAL(value.inputIndex, 2U);
+    BOOST_CHECK_EQUAL(value.blockHeight, 100);
+
+    // Other outputs of the same transaction are not affected
+    BOOST_CHECK(!db.ReadSpent(key1, value));
+
+    // A null value erases the entry, as done when a block is disconnected
+    vect.clear();
+    vect.push_back(std::make_pair(key0, CSpentIndexValue()));
+    BOOST_CHECK(db.UpdateSpent(vect));
+    BOOST_CHECK(!db.ReadSpent(key0, value));
+}
+
+BOOST_AUTO_TEST_CASE(spentindex_best_block)
+{
+    SpentIndex::DB db(1 << 20, true);
+
+    CBlockLocator locator;
+    BOOST_CHECK(!db.ReadBestBlock(locator));
+    BOOST_CHECK(locator.IsNull());
+
+    std::vector<uint256> vHave;
+    vHave.push_back(GetRandHash());
+    vHave.push_back(GetRandHash());
+    BOOST_CHECK(db.WriteBestBlock(CBlockLocator(vHave)));
+
+    BOOST_CHECK(db.ReadBestBlock(locator));
+    BOOST_CHECK(locator.vHave == vHave);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
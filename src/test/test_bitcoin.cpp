@@ -11,6 +11,7 @@
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "hash.h"
 #include "key.h"
 #include "validation.h"
 #include "miner.h"
@@ -146,6 +147,80 @@ TestChain100Setup::~TestChain100Setup()
 {
 }
 
+void CConnmanTest::AddNode(CNode& node)
+{
+    LOCK(g_connman->cs_vNodes);
+    g_connman->vNodes.push_back(&node);
+}
+
+void CConnmanTest::ClearNodes()
+{
+    LOCK(g_connman->cs_vNodes);
+    g_connman->vNodes.clear();
+}
+
+void CConnmanTest::StartMessageHandlers(int nThreads)
+{
+    for (int i = 0; i < nThreads; i++)
+        g_connman->threadMessageHandlers.push_back(std::thread(&CConnman::ThreadMessageHandler, g_connman.get(), i));
+}
+
+void CConnmanTest::StopMessageHandlers()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_connman->mutexMsgProc);
+        g_connman->flagInterruptMsgProc = true;
+    }
+    g_connman->condMsgProc.notify_all();
+    BOOST_FOREACH(std::thread& thread, g_connman->threadMessageHandlers)
+        thread.join();
+    g_connman->threadMessageHandlers.clear();
+    g_connman->flagInterruptMsgProc = false;
+}
+
+void ReceiveMessage(CNode& node, CConnman& connman, const CSerializedNetMsg& msg)
+{
+    CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), msg.data.size());
+    uint256 hash = Hash(msg.data.begin(), msg.data.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << hdr;
+    ss.write((const char*)msg.data.data(), msg.data.size());
+
+    CNetMessage netmsg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+    int nHeader = netmsg.readHeader(&ss[0], ss.size());
+    if ((size_t)nHeader < ss.size())
+        netmsg.readData(&ss[nHeader], ss.size() - nHeader);
+    BOOST_REQUIRE(netmsg.complete());
+    {
+        LOCK(node.cs_vProcessMsg);
+        node.vProcessMsg.push_back(netmsg);
+    }
+    std::atomic<bool> interruptDummy(false);
+    ProcessMessages(&node, connman, interruptDummy);
+}
+
+std::map<std::string, std::vector<CDataStream> > TakeSentMessages(CNode& node)
+{
+    std::map<std::string, std::vector<CDataStream> > mapPayloads;
+    LOCK(node.cs_vSend);
+    BOOST_FOREACH(const CSendMsg& msg, node.vSendMsg) {
+        CMessageHeader hdr(Params().MessageStart());
+        CDataStream ssHeader((const char*)msg.header, (const char*)msg.header + CMessageHeader::HEADER_SIZE, SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader >> hdr;
+        mapPayloads[hdr.GetCommand()].push_back(CDataStream(msg.payload(), SER_NETWORK, PROTOCOL_VERSION));
+    }
+    node.vSendMsg.clear();
+    node.nSendSize = 0;
+    node.fPauseSend = false;
+    return mapPayloads;
+}
+
+std::vector<CDataStream> TakeSentMessages(CNode& node, const std::string& strCommand)
+{
+    return TakeSentMessages(node)[strCommand];
+}
+
 
 CTxMemPoolEntry TestMemPoolEntryHelper::FromTx(const CMutableTransaction &tx, CTxMemPool *pool) {
     CTransaction txn(tx);
@@ -60,6 +60,25 @@ struct TestChain100Setup : public TestingSetup {
     CKey coinbaseKey; // private/public key needed to spend coinbase transactions
 };
 
+class CNode;
+class CDataStream;
+struct CSerializedNetMsg;
+
+/** Access to the nodes of the CConnman of a TestingSetup */
+struct CConnmanTest {
+    static void AddNode(CNode& node);
+    static void ClearNodes();
+    static void StartMessageHandlers(int nThreads);
+    static void StopMessageHandlers();
+};
+
+/** Hand the node a message as if it came in from the network, and process it */
+void ReceiveMessage(CNode& node, CConnman& connman, const CSerializedNetMsg& msg);
+/** The payloads of the messages sent to the node by command, dropping them from its send queue */
+std::map<std::string, std::vector<CDataStream> > TakeSentMessages(CNode& node);
+/** The payloads of the messages of one type that were sent to the node, dropping all messages sent to it */
+std::vector<CDataStream> TakeSentMessages(CNode& node, const std::string& strCommand);
+
 class CTxMemPoolEntry;
 class CTxMemPool;
 
@@ -0,0 +1,160 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "consensus/validation.h"
+#include "random.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+#include "txmempool.h"
+#include "validation.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txpackage_tests, TestingSetup)
+
+static const CScript REDEEM_SCRIPT = CScript() << OP_TRUE;
+
+/** Add a fake confirmed transaction with nOutputs spendable outputs to the coins view */
+static CTransactionRef AddFunding(int nOutputs)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vout.resize(nOutputs);
+    for (int i = 0; i < nOutputs; i++) {
+        tx.vout[i].scriptPubKey = GetScriptForDestination(CScriptID(REDEEM_SCRIPT));
+        tx.vout[i].nValue = 10 * COIN;
+    }
+    CTransactionRef ptx = MakeTransactionRef(tx);
+    LOCK(cs_main);
+    CCoinsModifier coins = pcoinsTip->ModifyCoins(ptx->GetHash());
+    coins->FromTx(*ptx, 0);
+    return ptx;
+}
+
+/** Spend the given outputs into a single output, leaving nFee as the fee */
+static CTransactionRef Spend(const std::vector<COutPoint>& vPrevouts, const std::vector<CTransactionRef>& vFrom, CAmount nFee)
+{
+    CMutableTransaction tx;
+    CAmount nValueIn = 0;
+    for (size_t i = 0; i < vPrevouts.size(); i++) {
+        tx.vin.push_back(CTxIn(vPrevouts[i], CScript() << std::vector<unsigned char>(REDEEM_SCRIPT.begin(), REDEEM_SCRIPT.end())));
+        nValueIn += vFrom[i]->vout[vPrevouts[i].n].nValue;
+    }
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = GetScriptForDestination(CScriptID(REDEEM_SCRIPT));
+    tx.vout[0].nValue = nValueIn - nFee;
+    return MakeTransactionRef(tx);
+}
+
+static CTransactionRef Spend(const CTransactionRef& from, uint32_t n, CAmount nFee)
+{
+    return Spend(std::vector<COutPoint>(1, COutPoint(from->GetHash(), n)), std::vector<CTransactionRef>(1, from), nFee);
+}
+
+static bool SubmitPackage(const std::vector<CTransactionRef>& package, std::string& strReason)
+{
+    LOCK(cs_main);
+    CValidationState state;
+    bool fMissingInputs;
+    bool fAccepted = AcceptPackageToMemoryPool(mempool, state, package, &fMissingInputs);
+    strReason = state.GetRejectReason();
+    return fAccepted;
+}
+
+BOOST_AUTO_TEST_CASE(package_accept)
+{
+    mempool.clear();
+    CTransactionRef funding = AddFunding(2);
+    CTransactionRef parent = Spend(funding, 0, 0);
+    CTransactionRef child = Spend(parent, 0, COIN / 100);
+
+    // A parent without fee is not accepted on its own
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(!AcceptToMemoryPool(mempool, state, parent, false, NULL));
+        BOOST_CHECK_EQUAL(state.GetRejectReason(), "insufficient priority");
+    }
+
+    // but the child pays for it in a package
+    std::string strReason;
+    BOOST_CHECK(SubmitPackage({parent, child}, strReason));
+    BOOST_CHECK(mempool.exists(parent->GetHash()));
+    BOOST_CHECK(mempool.exists(child->GetHash()));
+
+    // Parents already in the pool are skipped
+    CTransactionRef parent2 = Spend(funding, 1, 0);
+    CTransactionRef child2 = Spend({COutPoint(child->GetHash(), 0), COutPoint(parent2->GetHash(), 0)}, {child, parent2}, COIN / 100);
+    BOOST_CHECK(SubmitPackage({child, parent2, child2}, strReason));
+    BOOST_CHECK_EQUAL(mempool.size(), 4U);
+}
+
+BOOST_AUTO_TEST_CASE(package_reject)
+{
+    mempool.clear();
+    CTransactionRef funding = AddFunding(4);
+    CTransactionRef parent = Spend(funding, 0, 0);
+    CTransactionRef child = Spend(parent, 0, COIN / 100);
+    std::string strReason;
+
+    // Transactions the child does not spend from
+    CTransactionRef unrelated = Spend(funding, 1, 0);
+    BOOST_CHECK(!SubmitPackage({unrelated, parent, child}, strReason));
+    BOOST_CHECK_EQUAL(strReason, "package-not-child-with-parents");
+
+    // Parents after their children
+    BOOST_CHECK(!SubmitPackage({child, parent}, strReason));
+    BOOST_CHECK_EQUAL(strReason, "package-not-child-with-parents");
+
+    // Two transactions spending the same output
+    CTransactionRef doublespend = Spend(funding, 0, COIN / 100);
+    CTransactionRef child2 = Spend({COutPoint(parent->GetHash(), 0), COutPoint(doublespend->GetHash(), 0)}, {parent, doublespend}, COIN / 100);
+    BOOST_CHECK(!SubmitPackage({parent, doublespend, child2}, strReason));
+    BOOST_CHECK_EQUAL(strReason, "package-conflict");
+
+    // Replacing a pool transaction
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, doublespend, false, NULL));
+    }
+    BOOST_CHECK(!SubmitPackage({parent, child}, strReason));
+    BOOST_CHECK_EQUAL(strReason, "package-mempool-conflict");
+    BOOST_CHECK(mempool.exists(doublespend->GetHash()));
+    BOOST_CHECK_EQUAL(mempool.size(), 1U);
+
+    // A child without fee does not get in with a parent paying for it
+    CTransactionRef payingParent = Spend(funding, 2, COIN / 100);
+    CTransactionRef freeChild = Spend(payingParent, 0, 0);
+    BOOST_CHECK(!SubmitPackage({payingParent, freeChild}, strReason));
+    BOOST_CHECK_EQUAL(strReason, "insufficient priority");
+    BOOST_CHECK(!mempool.exists(payingParent->GetHash()));
+    BOOST_CHECK_EQUAL(mempool.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(package_rollback)
+{
+    mempool.clear();
+    CTransactionRef funding = AddFunding(2);
+
+    // The first parent pays enough to be accepted, the second parent does not
+    // get the package feerate as the child pays less than that, so the first
+    // parent has to be removed again.
+    CTransactionRef parent1 = Spend(funding, 0, COIN / 10);
+    CTransactionRef parent2 = Spend(funding, 1, 0);
+    CTransactionRef child = Spend({COutPoint(parent1->GetHash(), 0), COutPoint(parent2->GetHash(), 0)}, {parent1, parent2}, COIN / 1000);
+    std::string strReason;
+    BOOST_CHECK(!SubmitPackage({parent1, parent2, child}, strReason));
+    BOOST_CHECK_EQUAL(strReason, "insufficient priority");
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+
+    // With the child paying more than the package feerate all of it gets in
+    CTransactionRef child2 = Spend({COutPoint(parent1->GetHash(), 0), COutPoint(parent2->GetHash(), 0)}, {parent1, parent2}, COIN);
+    BOOST_CHECK(SubmitPackage({parent1, parent2, child2}, strReason));
+    BOOST_CHECK_EQUAL(mempool.size(), 3U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
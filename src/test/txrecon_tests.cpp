@@ -0,0 +1,266 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "hash.h"
+#include "net.h"
+#include "net_processing.h"
+#include "netmessagemaker.h"
+#include "random.h"
+#include "sketch.h"
+#include "test/test_bitcoin.h"
+#include "txmempool.h"
+#include "utiltime.h"
+#include "validation.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/test/unit_test.hpp>
+
+// Reconciliations with an inbound peer, which asks us for our sketch, and
+// with an outbound peer, which we ask for its sketch
+
+BOOST_FIXTURE_TEST_SUITE(txrecon_tests, TestingSetup)
+
+/** The transactions announced in the given inv messages */
+static std::set<uint256> GetAnnounced(std::vector<CDataStream>& vPayloads)
+{
+    std::set<uint256> setAnnounced;
+    BOOST_FOREACH(CDataStream& ss, vPayloads) {
+        std::vector<CInv> vInv;
+        ss >> vInv;
+        BOOST_FOREACH(const CInv& inv, vInv)
+            setAnnounced.insert(inv.hash);
+    }
+    return setAnnounced;
+}
+
+/** The transactions announced in the inv messages the node sent */
+static std::set<uint256> TakeAnnounced(CNode& node)
+{
+    std::vector<CDataStream> vPayloads = TakeSentMessages(node, NetMsgType::INV);
+    return GetAnnounced(vPayloads);
+}
+
+/** Add new transactions to the pool and queue them for announcement to the node */
+static std::vector<uint256> AddTransactions(CNode& node, CConnman& connman, int nCount)
+{
+    TestMemPoolEntryHelper entry;
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < nCount; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN;
+        mempool.addUnchecked(tx.GetHash(), entry.Fee(10000).FromTx(tx));
+        node.PushInventory(CInv(MSG_TX, tx.GetHash()));
+        vHashes.push_back(tx.GetHash());
+    }
+    std::atomic<bool> interruptDummy(false);
+    SendMessages(&node, connman, interruptDummy);
+    return vHashes;
+}
+
+/** Connect a reconciling peer, and offer to reconcile from both sides; returns the short id key */
+static uint256 ConnectReconNode(CNode& node, CConnman& connman, uint64_t nPeerSalt)
+{
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    node.SetSendVersion(PROTOCOL_VERSION);
+    GetNodeSignals().InitializeNode(&node, connman);
+    node.nVersion = PROTOCOL_VERSION;
+    node.nServices = ServiceFlags(NODE_NETWORK | NODE_TXRECON);
+    node.fRelayTxes = true;
+    // Trickle transactions to the node right away, and keep what it sends
+    node.fWhitelisted = true;
+    node.fSendCorked = true;
+    // Drop our version message to outbound peers, which would hold back processing
+    TakeSentMessages(node, "");
+
+    ReceiveMessage(node, connman, msgMaker.Make(NetMsgType::VERACK));
+    std::vector<CDataStream> vSendRecon = TakeSentMessages(node, NetMsgType::SENDRECON);
+    BOOST_REQUIRE_EQUAL(vSendRecon.size(), 1U);
+    uint64_t nSalt;
+    vSendRecon[0] >> nSalt;
+    ReceiveMessage(node, connman, msgMaker.Make(NetMsgType::SENDRECON, nPeerSalt));
+    CHashWriter ssSalt(SER_GETHASH, 0);
+    ssSalt << std::min(nSalt, nPeerSalt) << std::max(nSalt, nPeerSalt);
+    return ssSalt.GetHash();
+}
+
+static uint32_t GetShortId(const uint256& hashSalt, const uint256& hash)
+{
+    return 1 + (uint32_t)(SipHashUint256(hashSalt.GetUint64(0), hashSalt.GetUint64(1), hash) % 0xffffffff);
+}
+
+BOOST_AUTO_TEST_CASE(txrecon_inbound)
+{
+    mempool.clear();
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+    CNode node(1000, ServiceFlags(NODE_NETWORK | NODE_TXRECON), 0, INVALID_SOCKET, addr, 0, 0, "", true);
+    uint256 hashSalt = ConnectReconNode(node, *connman, 12345);
+    auto ShortId = [&hashSalt](const uint256& hash) {
+        return GetShortId(hashSalt, hash);
+    };
+
+    // New transactions wait for the next reconciliation
+    std::vector<uint256> vHashes = AddTransactions(node, *connman, 10);
+    BOOST_CHECK(TakeAnnounced(node).empty());
+
+    // We have seen the first seven, and one the node does not have
+    ReceiveMessage(node, *connman, msgMaker.Make(NetMsgType::REQRECON, (uint16_t)8));
+    std::vector<CDataStream> vSketch = TakeSentMessages(node, NetMsgType::SKETCH);
+    BOOST_REQUIRE_EQUAL(vSketch.size(), 1U);
+    CSketch sketch;
+    vSketch[0] >> sketch;
+    BOOST_CHECK(sketch.GetCapacity() >= 4);
+    CSketch peerSketch(sketch.GetCapacity());
+    for (int i = 0; i < 7; i++)
+        peerSketch.Add(ShortId(vHashes[i]));
+    peerSketch.Add(ShortId(GetRandHash()));
+    sketch.Merge(peerSketch);
+    std::vector<uint32_t> vDifference;
+    BOOST_CHECK(sketch.Decode(vDifference));
+    BOOST_CHECK_EQUAL(vDifference.size(), 4U);
+
+    std::vector<uint32_t> vRequest;
+    for (int i = 7; i < 10; i++) {
+        BOOST_CHECK(std::count(vDifference.begin(), vDifference.end(), ShortId(vHashes[i])));
+        vRequest.push_back(ShortId(vHashes[i]));
+    }
+    ReceiveMessage(node, *connman, msgMaker.Make(NetMsgType::RECONCILDIFF, true, vRequest));
+    BOOST_CHECK(TakeAnnounced(node) == std::set<uint256>(vHashes.begin() + 7, vHashes.end()));
+
+    // When the sketch cannot be decoded, the whole set is announced
+    vHashes = AddTransactions(node, *connman, 5);
+    ReceiveMessage(node, *connman, msgMaker.Make(NetMsgType::REQRECON, (uint16_t)0));
+    TakeSentMessages(node, NetMsgType::SKETCH);
+    ReceiveMessage(node, *connman, msgMaker.Make(NetMsgType::RECONCILDIFF, false, std::vector<uint32_t>()));
+    BOOST_CHECK(TakeAnnounced(node) == std::set<uint256>(vHashes.begin(), vHashes.end()));
+
+    // As it is when the difference contains a short id that is in neither set
+    vHashes = AddTransactions(node, *connman, 5);
+    ReceiveMessage(node, *connman, msgMaker.Make(NetMsgType::REQRECON, (uint16_t)0));
+    TakeSentMessages(node, NetMsgType::SKETCH);
+    vRequest.assign(1, ShortId(vHashes[0]));
+    vRequest.push_back(ShortId(GetRandHash()));
+    ReceiveMessage(node, *connman, msgMaker.Make(NetMsgType::RECONCILDIFF, true, vRequest));
+    BOOST_CHECK(TakeAnnounced(node) == std::set<uint256>(vHashes.begin(), vHashes.end()));
+
+    // A peer that does not ask to reconcile gets a full set announced anyway
+    vHashes = AddTransactions(node, *connman, 2999);
+    BOOST_CHECK(TakeAnnounced(node).empty());
+    vHashes.push_back(AddTransactions(node, *connman, 1)[0]);
+    BOOST_CHECK(TakeAnnounced(node) == std::set<uint256>(vHashes.begin(), vHashes.end()));
+
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(node.GetId(), stats));
+    BOOST_CHECK(stats.fTxReconciliation);
+    BOOST_CHECK_EQUAL(stats.nReconciliations, 1);
+    BOOST_CHECK_EQUAL(stats.nReconFailures, 2);
+
+    bool fUpdateConnectionTime = false;
+    GetNodeSignals().FinalizeNode(node.GetId(), fUpdateConnectionTime);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(txrecon_outbound)
+{
+    mempool.clear();
+    const CNetMsgMaker msgMaker(PROTOCOL_VERSION);
+    std::atomic<bool> interruptDummy(false);
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+    CAddress addr(CService(CNetAddr(), Params().GetDefaultPort()), NODE_NONE);
+    std::vector<CNode*> vNodes;
+    uint256 hashSalt;
+    for (NodeId id = 1001; id <= 1003; id++) {
+        vNodes.push_back(new CNode(id, ServiceFlags(NODE_NETWORK | NODE_TXRECON), 0, INVALID_SOCKET, addr, 0, 0, "", false));
+        hashSalt = ConnectReconNode(*vNodes.back(), *connman, 12345 + id);
+    }
+    CNode& node = *vNodes.back();
+    auto ShortId = [&hashSalt](const uint256& hash) {
+        return GetShortId(hashSalt, hash);
+    };
+
+    // We keep flooding to the first outbound peers, the others wait for our request
+    std::vector<uint256> vHashes;
+    for (size_t i = 0; i < vNodes.size(); i++) {
+        vHashes = AddTransactions(*vNodes[i], *connman, 3);
+        if (i < 2)
+            BOOST_CHECK(TakeAnnounced(*vNodes[i]) == std::set<uint256>(vHashes.begin(), vHashes.end()));
+        else
+            BOOST_CHECK(TakeAnnounced(*vNodes[i]).empty());
+    }
+    std::vector<uint256> vMore = AddTransactions(node, *connman, 7);
+    vHashes.insert(vHashes.end(), vMore.begin(), vMore.end());
+    BOOST_CHECK(TakeAnnounced(node).empty());
+
+    nTime += 3600;
+    SetMockTime(nTime);
+    SendMessages(&node, *connman, interruptDummy);
+    std::vector<CDataStream> vReqRecon = TakeSentMessages(node, NetMsgType::REQRECON);
+    BOOST_REQUIRE_EQUAL(vReqRecon.size(), 1U);
+    uint16_t nSize;
+    vReqRecon[0] >> nSize;
+    BOOST_CHECK_EQUAL(nSize, 10);
+    // Only one request at a time
+    SendMessages(&node, *connman, interruptDummy);
+    BOOST_CHECK(TakeSentMessages(node, NetMsgType::REQRECON).empty());
+
+    // The node has the first seven we have, and one we do not have
+    CSketch sketch(8);
+    for (int i = 0; i < 7; i++)
+        sketch.Add(ShortId(vHashes[i]));
+    uint256 hashMissing = GetRandHash();
+    sketch.Add(ShortId(hashMissing));
+    ReceiveMessage(node, *connman, msgMaker.Make(NetMsgType::SKETCH, sketch));
+    std::map<std::string, std::vector<CDataStream> > mapSent = TakeSentMessages(node);
+    BOOST_REQUIRE_EQUAL(mapSent[NetMsgType::RECONCILDIFF].size(), 1U);
+    bool fSuccess;
+    std::vector<uint32_t> vRequest;
+    mapSent[NetMsgType::RECONCILDIFF][0] >> fSuccess >> vRequest;
+    BOOST_CHECK(fSuccess);
+    BOOST_CHECK(vRequest == std::vector<uint32_t>(1, ShortId(hashMissing)));
+    BOOST_CHECK(GetAnnounced(mapSent[NetMsgType::INV]) == std::set<uint256>(vHashes.begin() + 7, vHashes.end()));
+
+    // A sketch we did not ask for is ignored
+    ReceiveMessage(node, *connman, msgMaker.Make(NetMsgType::SKETCH, sketch));
+    BOOST_CHECK(TakeSentMessages(node, NetMsgType::RECONCILDIFF).empty());
+
+    // The set of a request the node never answers is announced after a while
+    vHashes = AddTransactions(node, *connman, 5);
+    nTime += 3600;
+    SetMockTime(nTime);
+    SendMessages(&node, *connman, interruptDummy);
+    BOOST_CHECK_EQUAL(TakeSentMessages(node, NetMsgType::REQRECON).size(), 1U);
+    nTime += 30;
+    SetMockTime(nTime);
+    SendMessages(&node, *connman, interruptDummy);
+    BOOST_CHECK(TakeAnnounced(node).empty());
+    nTime += 3600;
+    SetMockTime(nTime);
+    SendMessages(&node, *connman, interruptDummy);
+    BOOST_CHECK(TakeAnnounced(node) == std::set<uint256>(vHashes.begin(), vHashes.end()));
+
+    CNodeStateStats stats;
+    BOOST_CHECK(GetNodeStateStats(node.GetId(), stats));
+    BOOST_CHECK_EQUAL(stats.nReconciliations, 1);
+    BOOST_CHECK_EQUAL(stats.nReconFailures, 1);
+
+    bool fUpdateConnectionTime = false;
+    BOOST_FOREACH(CNode* pnode, vNodes) {
+        GetNodeSignals().FinalizeNode(pnode->GetId(), fUpdateConnectionTime);
+        delete pnode;
+    }
+    SetMockTime(0);
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
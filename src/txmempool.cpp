@@ -22,9 +22,9 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransactionRef& _tx, const CAmount& _nFe
                                  int64_t _nTime, double _entryPriority, unsigned int _entryHeight,
                                  CAmount _inChainInputValue,
                                  bool _spendsCoinbase, int64_t _sigOpsCost, LockPoints lp):
-    tx(_tx), nFee(_nFee), nTime(_nTime), entryPriority(_entryPriority), entryHeight(_entryHeight),
-    inChainInputValue(_inChainInputValue),
-    spendsCoinbase(_spendsCoinbase), sigOpCost(_sigOpsCost), lockPoints(lp)
+    tx(_tx), nFee(_nFee), entryHeight(_entryHeight), nTime(_nTime), entryPriority(_entryPriority),
+    inChainInputValue(_inChainInputValue), sigOpCost(_sigOpsCost), lockPoints(lp),
+    spendsCoinbase(_spendsCoinbase)
 {
     nTxWeight = GetTransactionWeight(*tx);
     nModSize = tx->CalculateModifiedSize(GetTxSize());
@@ -81,14 +81,15 @@ size_t CTxMemPoolEntry::GetTxSize() const
 // descendants.
 void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendants, const std::set<uint256> &setExclude)
 {
-    setEntries stageEntries, setAllDescendants;
-    stageEntries = GetMemPoolChildren(updateIt);
+    setEntries setAllDescendants;
+    const vecLinks &children = GetMemPoolChildren(updateIt);
+    setEntries stageEntries(children.begin(), children.end());
 
     while (!stageEntries.empty()) {
         const txiter cit = *stageEntries.begin();
         setAllDescendants.insert(cit);
         stageEntries.erase(cit);
-        const setEntries &setChildren = GetMemPoolChildren(cit);
+        const vecLinks &setChildren = GetMemPoolChildren(cit);
         BOOST_FOREACH(const txiter childEntry, setChildren) {
             cacheMap::iterator cacheIt = cachedDescendants.find(childEntry);
             if (cacheIt != cachedDescendants.end()) {
@@ -129,6 +130,7 @@ void CTxMemPool::UpdateForDescendants(txiter updateIt, cacheMap &cachedDescendan
 void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashesToUpdate)
 {
     LOCK(cs);
+    nTransactionsUpdated++;
     // For each entry in vHashesToUpdate, store the set of in-mempool, but not
     // in-vHashesToUpdate transactions, so that we don't have to recalculate
     // descendants when we come across a previously seen entry.
@@ -170,10 +172,23 @@ void CTxMemPool::UpdateTransactionsFromBlock(const std::vector<uint256> &vHashes
 }
 
 bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents /* = true */) const
+{
+    return WalkMemPoolAncestors(entry, &setAncestors, limitAncestorCount, limitAncestorSize, limitDescendantCount, limitDescendantSize, errString, fSearchForParents);
+}
+
+bool CTxMemPool::CheckMemPoolAncestorLimits(const CTxMemPoolEntry &entry, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString) const
+{
+    return WalkMemPoolAncestors(entry, NULL, limitAncestorCount, limitAncestorSize, limitDescendantCount, limitDescendantSize, errString, true);
+}
+
+bool CTxMemPool::WalkMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries *pAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents) const
 {
     LOCK(cs);
 
-    setEntries parentHashes;
+    // Ancestors found but not walked yet. Entries are marked visited when
+    // staged, so each ancestor is staged once however many paths lead to it.
+    std::vector<txiter> vStage;
+    ++nVisitEpoch;
     const CTransaction &tx = entry.GetTx();
 
     if (fSearchForParents) {
@@ -182,9 +197,9 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // iterate mapTx to find parents.
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
             txiter piter = mapTx.find(tx.vin[i].prevout.hash);
-            if (piter != mapTx.end()) {
-                parentHashes.insert(piter);
-                if (parentHashes.size() + 1 > limitAncestorCount) {
+            if (piter != mapTx.end() && !Visit(piter)) {
+                vStage.push_back(piter);
+                if (vStage.size() + 1 > limitAncestorCount) {
                     errString = strprintf("too many unconfirmed parents [limit: %u]", limitAncestorCount);
                     return false;
                 }
@@ -194,16 +209,23 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
         // If we're not searching for parents, we require this to be an
         // entry in the mempool already.
         txiter it = mapTx.iterator_to(entry);
-        parentHashes = GetMemPoolParents(it);
+        const vecLinks &parents = GetMemPoolParents(it);
+        BOOST_FOREACH(const txiter &piter, parents) {
+            Visit(piter);
+            vStage.push_back(piter);
+        }
     }
 
+    // Number of ancestors found so far, walked or staged
+    uint64_t nAncestors = vStage.size();
     size_t totalSizeWithAncestors = entry.GetTxSize();
 
-    while (!parentHashes.empty()) {
-        txiter stageit = *parentHashes.begin();
+    while (!vStage.empty()) {
+        txiter stageit = vStage.back();
+        vStage.pop_back();
 
-        setAncestors.insert(stageit);
-        parentHashes.erase(stageit);
+        if (pAncestors)
+            pAncestors->insert(stageit);
         totalSizeWithAncestors += stageit->GetTxSize();
 
         if (stageit->GetSizeWithDescendants() + entry.GetTxSize() > limitDescendantSize) {
@@ -217,13 +239,14 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
             return false;
         }
 
-        const setEntries & setMemPoolParents = GetMemPoolParents(stageit);
+        const vecLinks & setMemPoolParents = GetMemPoolParents(stageit);
         BOOST_FOREACH(const txiter &phash, setMemPoolParents) {
             // If this is a new ancestor, add it.
-            if (setAncestors.count(phash) == 0) {
-                parentHashes.insert(phash);
+            if (!Visit(phash)) {
+                vStage.push_back(phash);
+                nAncestors++;
             }
-            if (parentHashes.size() + setAncestors.size() + 1 > limitAncestorCount) {
+            if (nAncestors + 1 > limitAncestorCount) {
                 errString = strprintf("too many unconfirmed ancestors [limit: %u]", limitAncestorCount);
                 return false;
             }
@@ -235,7 +258,7 @@ bool CTxMemPool::CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntr
 
 void CTxMemPool::UpdateAncestorsOf(bool add, txiter it, setEntries &setAncestors)
 {
-    setEntries parentIters = GetMemPoolParents(it);
+    const vecLinks &parentIters = GetMemPoolParents(it);
     // add or remove this tx as a child of each parent
     BOOST_FOREACH(txiter piter, parentIters) {
         UpdateChild(piter, it, add);
@@ -264,12 +287,93 @@ void CTxMemPool::UpdateEntryForAncestors(txiter it, const setEntries &setAncesto
 
 void CTxMemPool::UpdateChildrenForRemoval(txiter it)
 {
-    const setEntries &setMemPoolChildren = GetMemPoolChildren(it);
+    const vecLinks &setMemPoolChildren = GetMemPoolChildren(it);
     BOOST_FOREACH(txiter updateIt, setMemPoolChildren) {
         UpdateParent(updateIt, it, false);
     }
 }
 
+void CTxMemPool::UpdateForRemoveConfirmed(const setEntries &entriesToRemove)
+{
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+
+    // Walk the in-mempool descendants and ancestors of the whole set at once,
+    // so that chains of confirmed transactions are only traversed a single
+    // time rather than once per transaction.
+    setEntries setDescendants;
+    setEntries setAncestors;
+    BOOST_FOREACH(txiter removeIt, entriesToRemove) {
+        CalculateDescendants(removeIt, setDescendants);
+        const vecLinks &parents = GetMemPoolParents(removeIt);
+        setEntries stage(parents.begin(), parents.end());
+        while (!stage.empty()) {
+            txiter it = *stage.begin();
+            stage.erase(stage.begin());
+            if (!setAncestors.insert(it).second)
+                continue;
+            BOOST_FOREACH(txiter parentIt, GetMemPoolParents(it)) {
+                if (!setAncestors.count(parentIt))
+                    stage.insert(parentIt);
+            }
+        }
+    }
+
+    // Only entries that stay in the mempool need their package state
+    // updated, and each of them is modified once with the combined change.
+    BOOST_FOREACH(txiter descendantIt, setDescendants) {
+        if (entriesToRemove.count(descendantIt))
+            continue;
+        setEntries setEntryAncestors;
+        CalculateMemPoolAncestors(*descendantIt, setEntryAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+        int64_t modifySize = 0;
+        CAmount modifyFee = 0;
+        int64_t modifyCount = 0;
+        int64_t modifySigOps = 0;
+        BOOST_FOREACH(txiter ancestorIt, setEntryAncestors) {
+            if (entriesToRemove.count(ancestorIt)) {
+                modifySize -= ancestorIt->GetTxSize();
+                modifyFee -= ancestorIt->GetModifiedFee();
+                modifyCount--;
+                modifySigOps -= ancestorIt->GetSigOpCost();
+            }
+        }
+        mapTx.modify(descendantIt, update_ancestor_state(modifySize, modifyFee, modifyCount, modifySigOps));
+    }
+    // A block normally confirms all in-mempool ancestors of its transactions,
+    // so this set is usually empty.
+    BOOST_FOREACH(txiter ancestorIt, setAncestors) {
+        if (entriesToRemove.count(ancestorIt))
+            continue;
+        setEntries setEntryDescendants;
+        CalculateDescendants(ancestorIt, setEntryDescendants);
+        int64_t modifySize = 0;
+        CAmount modifyFee = 0;
+        int64_t modifyCount = 0;
+        BOOST_FOREACH(txiter descendantIt, setEntryDescendants) {
+            if (entriesToRemove.count(descendantIt)) {
+                modifySize -= descendantIt->GetTxSize();
+                modifyFee -= descendantIt->GetModifiedFee();
+                modifyCount--;
+            }
+        }
+        mapTx.modify(ancestorIt, update_descendant_state(modifySize, modifyFee, modifyCount));
+    }
+
+    // Links between two removed entries disappear with them in
+    // removeUnchecked; only sever those to entries that stay.
+    BOOST_FOREACH(txiter removeIt, entriesToRemove) {
+        BOOST_FOREACH(txiter parentIt, GetMemPoolParents(removeIt)) {
+            if (!entriesToRemove.count(parentIt))
+                UpdateChild(parentIt, removeIt, false);
+        }
+        BOOST_FOREACH(txiter childIt, GetMemPoolChildren(removeIt)) {
+            if (!entriesToRemove.count(childIt))
+                UpdateParent(childIt, removeIt, false);
+        }
+    }
+}
+
 void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants)
 {
     // For each entry, walk back all ancestors and decrement size associated with this
@@ -279,20 +383,8 @@ void CTxMemPool::UpdateForRemoveFromMempool(const setEntries &entriesToRemove, b
         // updateDescendants should be true whenever we're not recursively
         // removing a tx and all its descendants, eg when a transaction is
         // confirmed in a block.
-        // Here we only update statistics and not data in mapLinks (which
-        // we need to preserve until we're finished with all operations that
-        // need to traverse the mempool).
-        BOOST_FOREACH(txiter removeIt, entriesToRemove) {
-            setEntries setDescendants;
-            CalculateDescendants(removeIt, setDescendants);
-            setDescendants.erase(removeIt); // don't update state for self
-            int64_t modifySize = -((int64_t)removeIt->GetTxSize());
-            CAmount modifyFee = -removeIt->GetModifiedFee();
-            int modifySigOps = -removeIt->GetSigOpCost();
-            BOOST_FOREACH(txiter dit, setDescendants) {
-                mapTx.modify(dit, update_ancestor_state(modifySize, modifyFee, -1, modifySigOps));
-            }
-        }
+        UpdateForRemoveConfirmed(entriesToRemove);
+        return;
     }
     BOOST_FOREACH(txiter removeIt, entriesToRemove) {
         setEntries setAncestors;
@@ -349,7 +441,7 @@ void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee,
 }
 
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
-    nTransactionsUpdated(0)
+    nTransactionsUpdated(0), nVisitEpoch(0)
 {
     _clear(); //lock free clear
 
@@ -381,7 +473,6 @@ void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
 {
-    LOCK(cs);
     return nTransactionsUpdated;
 }
 
@@ -399,7 +490,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // all the appropriate checks.
     LOCK(cs);
     indexed_transaction_set::iterator newit = mapTx.insert(entry).first;
-    mapLinks.insert(make_pair(newit, TxLinks()));
+    vTxLinks.emplace_back(newit);
+    newit->vTxLinksIdx = vTxLinks.size() - 1;
 
     // Update transaction for any feeDelta created by PrioritiseTransaction
     // TODO: refactor so that the fee delta is calculated before inserting
@@ -468,8 +560,19 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 
     totalTxSize -= it->GetTxSize();
     cachedInnerUsage -= it->DynamicMemoryUsage();
-    cachedInnerUsage -= memusage::DynamicUsage(mapLinks[it].parents) + memusage::DynamicUsage(mapLinks[it].children);
-    mapLinks.erase(it);
+    cachedInnerUsage -= memusage::DynamicUsage(vTxLinks[it->vTxLinksIdx].parents) + memusage::DynamicUsage(vTxLinks[it->vTxLinksIdx].children);
+    if (vTxLinks.size() > 1) {
+        TxLinks& last = vTxLinks.back();
+        TxLinks& links = vTxLinks[it->vTxLinksIdx];
+        links.entry = last.entry;
+        links.parents.swap(last.parents);
+        links.children.swap(last.children);
+        links.entry->vTxLinksIdx = it->vTxLinksIdx;
+        vTxLinks.pop_back();
+        if (vTxLinks.size() * 2 < vTxLinks.capacity())
+            vTxLinks.shrink_to_fit();
+    } else
+        vTxLinks.clear();
     mapTx.erase(it);
     nTransactionsUpdated++;
     minerPolicyEstimator->removeTx(hash);
@@ -483,22 +586,25 @@ void CTxMemPool::removeUnchecked(txiter it, MemPoolRemovalReason reason)
 // can save time by not iterating over those entries.
 void CTxMemPool::CalculateDescendants(txiter entryit, setEntries &setDescendants)
 {
-    setEntries stage;
+    std::vector<txiter> vStage;
     if (setDescendants.count(entryit) == 0) {
-        stage.insert(entryit);
+        vStage.push_back(entryit);
     }
     // Traverse down the children of entry, only adding children that are not
     // accounted for in setDescendants already (because those children have either
-    // already been walked, or will be walked in this iteration).
-    while (!stage.empty()) {
-        txiter it = *stage.begin();
-        setDescendants.insert(it);
-        stage.erase(it);
+    // already been walked, or will be walked in this iteration). A child
+    // reachable through several parents may be staged more than once, but is
+    // only walked the first time.
+    while (!vStage.empty()) {
+        txiter it = vStage.back();
+        vStage.pop_back();
+        if (!setDescendants.insert(it).second)
+            continue;
 
-        const setEntries &setChildren = GetMemPoolChildren(it);
+        const vecLinks &setChildren = GetMemPoolChildren(it);
         BOOST_FOREACH(const txiter &childiter, setChildren) {
             if (!setDescendants.count(childiter)) {
-                stage.insert(childiter);
+                vStage.push_back(childiter);
             }
         }
     }
@@ -573,10 +679,8 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
     RemoveStaged(setAllRemoves, false, MemPoolRemovalReason::REORG);
 }
 
-void CTxMemPool::removeConflicts(const CTransaction &tx)
+void CTxMemPool::CalculateConflicts(const CTransaction &tx, setEntries &setAllRemoves)
 {
-    // Remove transactions which depend on inputs of tx, recursively
-    LOCK(cs);
     BOOST_FOREACH(const CTxIn &txin, tx.vin) {
         auto it = mapNextTx.find(txin.prevout);
         if (it != mapNextTx.end()) {
@@ -584,12 +688,23 @@ void CTxMemPool::removeConflicts(const CTransaction &tx)
             if (txConflict != tx)
             {
                 ClearPrioritisation(txConflict.GetHash());
-                removeRecursive(txConflict, MemPoolRemovalReason::CONFLICT);
+                txiter conflictit = mapTx.find(txConflict.GetHash());
+                assert(conflictit != mapTx.end());
+                CalculateDescendants(conflictit, setAllRemoves);
             }
         }
     }
 }
 
+void CTxMemPool::removeConflicts(const CTransaction &tx)
+{
+    // Remove transactions which depend on inputs of tx, recursively
+    LOCK(cs);
+    setEntries setAllRemoves;
+    CalculateConflicts(tx, setAllRemoves);
+    RemoveStaged(setAllRemoves, false, MemPoolRemovalReason::CONFLICT);
+}
+
 /**
  * Called when a block is connected. Removes from mempool and updates the miner fee estimator.
  */
@@ -597,34 +712,35 @@ void CTxMemPool::removeForBlock(const std::vector<CTransactionRef>& vtx, unsigne
 {
     LOCK(cs);
     std::vector<const CTxMemPoolEntry*> entries;
+    setEntries stage;
     for (const auto& tx : vtx)
     {
-        uint256 hash = tx->GetHash();
-
-        indexed_transaction_set::iterator i = mapTx.find(hash);
-        if (i != mapTx.end())
-            entries.push_back(&*i);
+        txiter it = mapTx.find(tx->GetHash());
+        if (it != mapTx.end()) {
+            entries.push_back(&*it);
+            stage.insert(it);
+        }
     }
     // Before the txs in the new block have been removed from the mempool, update policy estimates
     minerPolicyEstimator->processBlock(nBlockHeight, entries);
+    RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
+
+    // Anything still spending an input of the block's transactions is now a
+    // conflict; remove all of them, and their descendants, in one go.
+    setEntries setAllRemoves;
     for (const auto& tx : vtx)
     {
-        txiter it = mapTx.find(tx->GetHash());
-        if (it != mapTx.end()) {
-            setEntries stage;
-            stage.insert(it);
-            RemoveStaged(stage, true, MemPoolRemovalReason::BLOCK);
-        }
-        removeConflicts(*tx);
+        CalculateConflicts(*tx, setAllRemoves);
         ClearPrioritisation(tx->GetHash());
     }
+    RemoveStaged(setAllRemoves, false, MemPoolRemovalReason::CONFLICT);
     lastRollingFeeUpdate = GetTime();
     blockSinceLastRollingFeeBump = true;
 }
 
 void CTxMemPool::_clear()
 {
-    mapLinks.clear();
+    vTxLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
     totalTxSize = 0;
@@ -664,9 +780,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
         checkTotal += it->GetTxSize();
         innerUsage += it->DynamicMemoryUsage();
         const CTransaction& tx = it->GetTx();
-        txlinksMap::const_iterator linksiter = mapLinks.find(it);
-        assert(linksiter != mapLinks.end());
-        const TxLinks &links = linksiter->second;
+        assert(it->vTxLinksIdx < vTxLinks.size());
+        const TxLinks &links = vTxLinks[it->vTxLinksIdx];
+        assert(links.entry == it);
         innerUsage += memusage::DynamicUsage(links.parents) + memusage::DynamicUsage(links.children);
         bool fDependsWait = false;
         setEntries setParentCheck;
@@ -694,7 +810,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             assert(it3->second == &tx);
             i++;
         }
-        assert(setParentCheck == GetMemPoolParents(it));
+        assert(setParentCheck == setEntries(links.parents.begin(), links.parents.end()));
+        assert(setParentCheck.size() == links.parents.size());
         // Verify ancestor state is correct.
         setEntries setAncestors;
         uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
@@ -727,7 +844,8 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 childSizes += childit->GetTxSize();
             }
         }
-        assert(setChildrenCheck == GetMemPoolChildren(it));
+        assert(setChildrenCheck == setEntries(links.children.begin(), links.children.end()));
+        assert(setChildrenCheck.size() == links.children.size());
         // Also check to make sure size is greater than sum with immediate children.
         // just a sanity check, not definitive that this calc is correct...
         assert(it->GetSizeWithDescendants() >= childSizes + it->GetTxSize());
@@ -847,6 +965,43 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     return ret;
 }
 
+std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPool::GetSnapshot() const
+{
+    LOCK(cs_snapshot);
+    if (snapshot && snapshot->nTransactionsUpdated == nTransactionsUpdated)
+        return snapshot;
+
+    std::shared_ptr<CTxMemPoolSnapshot> snapshotNew = std::make_shared<CTxMemPoolSnapshot>();
+    {
+        LOCK(cs);
+        snapshotNew->nTransactionsUpdated = nTransactionsUpdated;
+        auto iters = GetSortedDepthAndScore();
+
+        snapshotNew->vEntries.reserve(iters.size());
+        for (auto it : iters) {
+            snapshotNew->mapIndex.emplace(it->GetTx().GetHash(), snapshotNew->vEntries.size());
+            snapshotNew->vEntries.emplace_back(*it);
+        }
+        for (size_t i = 0; i < iters.size(); i++) {
+            CTxMemPoolSnapshot::Entry& entry = snapshotNew->vEntries[i];
+            BOOST_FOREACH(txiter parent, GetMemPoolParents(iters[i]))
+                entry.vParents.push_back(snapshotNew->mapIndex[parent->GetTx().GetHash()]);
+            BOOST_FOREACH(txiter child, GetMemPoolChildren(iters[i]))
+                entry.vChildren.push_back(snapshotNew->mapIndex[child->GetTx().GetHash()]);
+        }
+    }
+    snapshot = snapshotNew;
+    return snapshot;
+}
+
+const CTxMemPoolSnapshot::Entry* CTxMemPoolSnapshot::Find(const uint256& hash) const
+{
+    std::map<uint256, size_t>::const_iterator it = mapIndex.find(hash);
+    if (it == mapIndex.end())
+        return NULL;
+    return &vEntries[it->second];
+}
+
 CTransactionRef CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -875,6 +1030,11 @@ CFeeRate CTxMemPool::estimateSmartFee(int nBlocks, int *answerFoundAtBlocks) con
     LOCK(cs);
     return minerPolicyEstimator->estimateSmartFee(nBlocks, answerFoundAtBlocks, *this);
 }
+std::vector<std::pair<CFeeRate, int> > CTxMemPool::estimateSmartFeeCurve(double successThreshold) const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->estimateSmartFeeCurve(successThreshold, *this);
+}
 double CTxMemPool::estimatePriority(int nBlocks) const
 {
     LOCK(cs);
@@ -945,6 +1105,7 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
             BOOST_FOREACH(txiter descendantIt, setDescendants) {
                 mapTx.modify(descendantIt, update_ancestor_state(0, nFeeDelta, 0, 0));
             }
+            nTransactionsUpdated++;
         }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
@@ -996,7 +1157,7 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(vTxLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants, MemPoolRemovalReason reason) {
@@ -1033,40 +1194,52 @@ bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry,
     return addUnchecked(hash, entry, setAncestors, validFeeEstimate);
 }
 
+void CTxMemPool::UpdateLinks(vecLinks& links, txiter it, bool add)
+{
+    vecLinks::iterator pos = std::lower_bound(links.begin(), links.end(), it, CompareIteratorByHash());
+    bool fFound = pos != links.end() && *pos == it;
+    if (add == fFound)
+        return;
+    cachedInnerUsage -= memusage::DynamicUsage(links);
+    if (add)
+        links.insert(pos, it);
+    else
+        links.erase(pos);
+    cachedInnerUsage += memusage::DynamicUsage(links);
+}
+
 void CTxMemPool::UpdateChild(txiter entry, txiter child, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].children.insert(child).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].children.erase(child)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
-    }
+    UpdateLinks(vTxLinks[entry->vTxLinksIdx].children, child, add);
 }
 
 void CTxMemPool::UpdateParent(txiter entry, txiter parent, bool add)
 {
-    setEntries s;
-    if (add && mapLinks[entry].parents.insert(parent).second) {
-        cachedInnerUsage += memusage::IncrementalDynamicUsage(s);
-    } else if (!add && mapLinks[entry].parents.erase(parent)) {
-        cachedInnerUsage -= memusage::IncrementalDynamicUsage(s);
-    }
+    UpdateLinks(vTxLinks[entry->vTxLinksIdx].parents, parent, add);
+}
+
+bool CTxMemPool::Visit(txiter it) const
+{
+    assert(it->vTxLinksIdx < vTxLinks.size());
+    uint64_t &nVisitedEpoch = vTxLinks[it->vTxLinksIdx].nVisitedEpoch;
+    if (nVisitedEpoch == nVisitEpoch)
+        return true;
+    nVisitedEpoch = nVisitEpoch;
+    return false;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolParents(txiter entry) const
+const CTxMemPool::vecLinks & CTxMemPool::GetMemPoolParents(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.parents;
+    assert (entry->vTxLinksIdx < vTxLinks.size());
+    return vTxLinks[entry->vTxLinksIdx].parents;
 }
 
-const CTxMemPool::setEntries & CTxMemPool::GetMemPoolChildren(txiter entry) const
+const CTxMemPool::vecLinks & CTxMemPool::GetMemPoolChildren(txiter entry) const
 {
     assert (entry != mapTx.end());
-    txlinksMap::const_iterator it = mapLinks.find(entry);
-    assert(it != mapLinks.end());
-    return it->second.children;
+    assert (entry->vTxLinksIdx < vTxLinks.size());
+    return vTxLinks[entry->vTxLinksIdx].children;
 }
 
 CFeeRate CTxMemPool::GetMinFee(size_t sizelimit) const {
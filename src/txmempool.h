@@ -6,6 +6,7 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <atomic>
 #include <memory>
 #include <set>
 #include <map>
@@ -16,6 +17,7 @@
 #include "amount.h"
 #include "coins.h"
 #include "indirectmap.h"
+#include "prevector.h"
 #include "primitives/transaction.h"
 #include "sync.h"
 #include "random.h"
@@ -84,17 +86,17 @@ class CTxMemPoolEntry
 private:
     CTransactionRef tx;
     CAmount nFee;              //!< Cached to avoid expensive parent-transaction lookups
-    size_t nTxWeight;          //!< ... and avoid recomputing tx weight (also used for GetTxSize())
-    size_t nModSize;           //!< ... and modified size for priority
-    size_t nUsageSize;         //!< ... and total memory usage
+    uint32_t nTxWeight;        //!< ... and avoid recomputing tx weight (also used for GetTxSize())
+    uint32_t nModSize;         //!< ... and modified size for priority
+    uint32_t nUsageSize;       //!< ... and total memory usage
+    unsigned int entryHeight;  //!< Chain height when entering the mempool
     int64_t nTime;             //!< Local time when entering the mempool
     double entryPriority;      //!< Priority when entering the mempool
-    unsigned int entryHeight;  //!< Chain height when entering the mempool
     CAmount inChainInputValue; //!< Sum of all txin values that are already in blockchain
-    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
     int64_t sigOpCost;         //!< Total sigop cost
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     LockPoints lockPoints;     //!< Track the height and time at which tx was final
+    bool spendsCoinbase;       //!< keep track of transactions that spend a coinbase
 
     // Information about descendants of this transaction that are in the
     // mempool; if we remove this transaction we must remove all of these
@@ -132,6 +134,7 @@ public:
     int64_t GetTime() const { return nTime; }
     unsigned int GetHeight() const { return entryHeight; }
     int64_t GetSigOpCost() const { return sigOpCost; }
+    CAmount GetInChainInputValue() const { return inChainInputValue; }
     int64_t GetModifiedFee() const { return nFee + feeDelta; }
     size_t DynamicMemoryUsage() const { return nUsageSize; }
     const LockPoints& GetLockPoints() const { return lockPoints; }
@@ -157,7 +160,8 @@ public:
     CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
     int64_t GetSigOpCostWithAncestors() const { return nSigOpCostWithAncestors; }
 
-    mutable size_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint32_t vTxHashesIdx; //!< Index in mempool's vTxHashes
+    mutable uint32_t vTxLinksIdx;  //!< Index in mempool's vTxLinks
 };
 
 // Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
@@ -335,6 +339,32 @@ struct TxMempoolInfo
     int64_t nFeeDelta;
 };
 
+/**
+ * Read-only copy of the mempool entries and the links between them, for
+ * consumers (RPC, REST) that work through the whole pool without needing
+ * it to stay locked meanwhile. Transactions are shared with the pool.
+ */
+struct CTxMemPoolSnapshot
+{
+    struct Entry
+    {
+        CTxMemPoolEntry entry;
+        //! Positions of the in-mempool parents and children in vEntries
+        std::vector<size_t> vParents;
+        std::vector<size_t> vChildren;
+
+        Entry(const CTxMemPoolEntry& _entry) : entry(_entry) {}
+    };
+
+    //! Value of the pool's update counter the snapshot reflects
+    unsigned int nTransactionsUpdated;
+    //! Entries sorted by depth and score, as by CTxMemPool::queryHashes
+    std::vector<Entry> vEntries;
+    std::map<uint256, size_t> mapIndex;
+
+    const Entry* Find(const uint256& hash) const;
+};
+
 /** Reason why a transaction was removed from the mempool,
  * this is passed to the notification signal.
  */
@@ -375,7 +405,7 @@ enum class MemPoolRemovalReason {
  *
  * In order for the feerate sort to remain correct, we must update transactions
  * in the mempool when new descendants arrive.  To facilitate this, we track
- * the set of in-mempool direct parents and direct children in mapLinks.  Within
+ * the set of in-mempool direct parents and direct children in vTxLinks.  Within
  * each CTxMemPoolEntry, we track the size and fees of all descendants.
  *
  * Usually when a new transaction is added to the mempool, it has no in-mempool
@@ -408,7 +438,7 @@ enum class MemPoolRemovalReason {
  * state, to account for in-mempool, out-of-block descendants for all the
  * in-block transactions by calling UpdateTransactionsFromBlock().  Note that
  * until this is called, the mempool state is not consistent, and in particular
- * mapLinks may not be correct (and therefore functions like
+ * vTxLinks may not be correct (and therefore functions like
  * CalculateMemPoolAncestors() and CalculateDescendants() that rely
  * on them to walk the mempool are not generally safe to use).
  *
@@ -432,7 +462,7 @@ class CTxMemPool
 {
 private:
     uint32_t nCheckFrequency; //!< Value n means that n times in 2^32 we check.
-    unsigned int nTransactionsUpdated;
+    std::atomic<unsigned int> nTransactionsUpdated; //!< Changed with any change to the entries; readable without cs
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize;      //!< sum of all mempool tx's virtual sizes. Differs from serialized tx size since witness data is discounted. Defined in BIP 141.
@@ -442,6 +472,9 @@ private:
     mutable bool blockSinceLastRollingFeeBump;
     mutable double rollingMinimumFeeRate; //!< minimum fee to get into the pool, decreases exponentially
 
+    mutable CCriticalSection cs_snapshot;
+    mutable std::shared_ptr<const CTxMemPoolSnapshot> snapshot; //!< Last snapshot handed out, protected by cs_snapshot
+
     void trackPackageRemoved(const CFeeRate& rate);
 
 public:
@@ -492,20 +525,40 @@ public:
         }
     };
     typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    /** Direct in-mempool parents or children of an entry, sorted by hash.
+     *  Most transactions have no more than two of either, which are then
+     *  stored inline without a separate allocation. */
+    typedef prevector<2, txiter, uint64_t, int64_t> vecLinks;
 
-    const setEntries & GetMemPoolParents(txiter entry) const;
-    const setEntries & GetMemPoolChildren(txiter entry) const;
+    const vecLinks & GetMemPoolParents(txiter entry) const;
+    const vecLinks & GetMemPoolChildren(txiter entry) const;
 private:
     typedef std::map<txiter, setEntries, CompareIteratorByHash> cacheMap;
 
     struct TxLinks {
-        setEntries parents;
-        setEntries children;
+        txiter entry;
+        vecLinks parents;
+        vecLinks children;
+        mutable uint64_t nVisitedEpoch; //!< Last traversal that reached this entry, see Visit()
+
+        TxLinks(txiter _entry) : entry(_entry), nVisitedEpoch(0) {}
     };
 
-    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
-    txlinksMap mapLinks;
+    //! Links of all entries in mapTx, kept in one array and found through
+    //! CTxMemPoolEntry::vTxLinksIdx
+    std::vector<TxLinks> vTxLinks;
 
+    //! Current traversal of the links. Bumping it forgets every earlier
+    //! visit at once, so walks need no set of what they have seen.
+    mutable uint64_t nVisitEpoch;
+
+    /** Mark it visited in the current traversal and return whether it already was */
+    bool Visit(txiter it) const;
+
+    /** CalculateMemPoolAncestors, only adding ancestors to *pAncestors if it is not NULL */
+    bool WalkMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries *pAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents) const;
+
+    void UpdateLinks(vecLinks& links, txiter it, bool add);
     void UpdateParent(txiter entry, txiter parent, bool add);
     void UpdateChild(txiter entry, txiter child, bool add);
 
@@ -588,10 +641,14 @@ public:
      *  limitDescendantSize = max size of descendants any ancestor can have
      *  errString = populated with error reason if any limits are hit
      *  fSearchForParents = whether to search a tx's vin for in-mempool parents, or
-     *    look up parents from mapLinks. Must be true for entries not in the mempool
+     *    look up parents from vTxLinks. Must be true for entries not in the mempool
      */
     bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString, bool fSearchForParents = true) const;
 
+    /** Check the limits of CalculateMemPoolAncestors for a transaction not in
+     *  the mempool yet, without building its ancestor set. */
+    bool CheckMemPoolAncestorLimits(const CTxMemPoolEntry &entry, uint64_t limitAncestorCount, uint64_t limitAncestorSize, uint64_t limitDescendantCount, uint64_t limitDescendantSize, std::string &errString) const;
+
     /** Populate setDescendants with all in-mempool descendants of hash.
      *  Assumes that setDescendants includes all in-mempool descendants of anything
      *  already in it.  */
@@ -638,6 +695,9 @@ public:
     CTransactionRef get(const uint256& hash) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
+    /** Return a snapshot of the current entries. While the pool does not
+      * change, callers share one snapshot and do not take cs. */
+    std::shared_ptr<const CTxMemPoolSnapshot> GetSnapshot() const;
 
     /** Estimate fee rate needed to get into the next nBlocks
      *  If no answer can be given at nBlocks, return an estimate
@@ -645,6 +705,10 @@ public:
      */
     CFeeRate estimateSmartFee(int nBlocks, int *answerFoundAtBlocks = NULL) const;
 
+    /** estimateSmartFee for every number of blocks tracked, starting at 1,
+     *  with a custom success threshold; see CBlockPolicyEstimator */
+    std::vector<std::pair<CFeeRate, int> > estimateSmartFeeCurve(double successThreshold) const;
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
@@ -691,6 +755,13 @@ private:
       * If updateDescendants is true, then also update in-mempool descendants'
       * ancestor state. */
     void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants);
+    /** UpdateForRemoveFromMempool for a set of transactions confirmed in a
+     *  block: update the package state of every entry that stays in the
+     *  mempool once, and only sever links to those entries. */
+    void UpdateForRemoveConfirmed(const setEntries &entriesToRemove);
+    /** Add the in-mempool transactions that spend an input of tx (other than
+     *  tx itself), and their descendants, to setAllRemoves. */
+    void CalculateConflicts(const CTransaction &tx, setEntries &setAllRemoves);
     /** Sever link between specified transaction and direct children. */
     void UpdateChildrenForRemoval(txiter entry);
 
@@ -508,6 +508,7 @@ boost::filesystem::path GetDefaultDataDir()
 
 static boost::filesystem::path pathCached;
 static boost::filesystem::path pathCachedNetSpecific;
+static boost::filesystem::path pathCachedBlocks;
 static CCriticalSection csPathCached;
 
 const boost::filesystem::path &GetDataDir(bool fNetSpecific)
@@ -540,12 +541,43 @@ const boost::filesystem::path &GetDataDir(bool fNetSpecific)
     return path;
 }
 
+const boost::filesystem::path &GetBlocksDir()
+{
+    namespace fs = boost::filesystem;
+
+    LOCK(csPathCached);
+
+    fs::path &path = pathCachedBlocks;
+
+    if (!path.empty())
+        return path;
+
+    // -blocksdir only moves the block and undo files; the block index
+    // database stays in the data directory.
+    if (IsArgSet("-blocksdir")) {
+        path = fs::system_complete(GetArg("-blocksdir", ""));
+        if (!fs::is_directory(path)) {
+            path = "";
+            return path;
+        }
+        path /= BaseParams().DataDir();
+    } else {
+        path = GetDataDir();
+    }
+    path /= "blocks";
+
+    fs::create_directories(path);
+
+    return path;
+}
+
 void ClearDatadirCache()
 {
     LOCK(csPathCached);
 
     pathCached = boost::filesystem::path();
     pathCachedNetSpecific = boost::filesystem::path();
+    pathCachedBlocks = boost::filesystem::path();
 }
 
 boost::filesystem::path GetConfigFile(const std::string& confPath)
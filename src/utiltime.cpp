@@ -51,6 +51,13 @@ int64_t GetSystemTimeInSeconds()
     return GetTimeMicros()/1000000;
 }
 
+int64_t GetMockableTimeMicros()
+{
+    if (nMockTime) return nMockTime*1000000;
+
+    return GetTimeMicros();
+}
+
 /** Return a time useful for the debug log */
 int64_t GetLogTimeMicros()
 {
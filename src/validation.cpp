@@ -9,10 +9,12 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "compressor.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
 #include "hash.h"
+#include "index/txindex.h"
 #include "init.h"
 #include "policy/fees.h"
 #include "policy/policy.h"
@@ -37,7 +39,10 @@
 #include "warnings.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/join.hpp>
@@ -64,13 +69,13 @@ CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
 std::atomic_bool fImporting(false);
 bool fReindex = false;
-bool fTxIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fBlockCompression = DEFAULT_BLOCKCOMPRESSION;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -570,9 +575,20 @@ static bool IsCurrentForFeeEstimation()
     return true;
 }
 
+/** Script verification flags loose transactions are checked with */
+static unsigned int GetMempoolScriptVerifyFlags()
+{
+    unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+    if (!Params().RequireStandard()) {
+        scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+    }
+    return scriptVerifyFlags;
+}
+
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache)
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache,
+                              const CFeeRate& packageFeeRate)
 {
     const CTransaction& tx = *ptx;
     const uint256 hash = tx.GetHash();
@@ -750,10 +766,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             return state.DoS(0, false, REJECT_NONSTANDARD, "bad-txns-too-many-sigops", false,
                              strprintf("%d", nSigOpsCost));
 
+        // Members of a package are judged by the package's feerate if it is higher than their own
+        CAmount nPolicyFees = std::max(nModifiedFees, packageFeeRate.GetFee(nSize));
+
         CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
-        if (mempoolRejectFee > 0 && nModifiedFees < mempoolRejectFee) {
+        if (mempoolRejectFee > 0 && nPolicyFees < mempoolRejectFee) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool min fee not met", false, strprintf("%d < %d", nFees, mempoolRejectFee));
-        } else if (GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) && nModifiedFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(entry.GetPriority(chainActive.Height() + 1))) {
+        } else if (GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) && nPolicyFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(entry.GetPriority(chainActive.Height() + 1))) {
             // Require that free transactions have sufficient priority to be mined in the next block.
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
         }
@@ -761,7 +780,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // Continuously rate-limit free (really, very-low-fee) transactions
         // This mitigates 'penny-flooding' -- sending thousands of free transactions just to
         // be annoying or make others' transactions take longer to confirm.
-        if (fLimitFree && nModifiedFees < ::minRelayTxFee.GetFee(nSize))
+        if (fLimitFree && nPolicyFees < ::minRelayTxFee.GetFee(nSize))
         {
             static CCriticalSection csFreeLimiter;
             static double dFreeCount;
@@ -941,10 +960,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
-        unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
-        if (!Params().RequireStandard()) {
-            scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
-        }
+        unsigned int scriptVerifyFlags = GetMempoolScriptVerifyFlags();
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
@@ -1007,8 +1023,6 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         }
     }
 
-    GetMainSignals().SyncTransaction(tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
-
     return true;
 }
 
@@ -1017,8 +1031,10 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                                 bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
     std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
-    if (!res) {
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache, CFeeRate(0));
+    if (res) {
+        GetMainSignals().SyncTransaction(*tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+    } else {
         BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
                         pcoinsTip->Uncache(hashTx);
     }
@@ -1028,6 +1044,209 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
     return res;
 }
 
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, CValidationState &state, const std::vector<CTransactionRef>& package,
+                               bool* pfMissingInputs, uint256* phashFailed, CFeeRate* pPackageFeeRate,
+                               const CAmount nAbsurdFee)
+{
+    AssertLockHeld(cs_main);
+    if (pfMissingInputs)
+        *pfMissingInputs = false;
+
+    if (package.empty() || package.size() > MAX_PACKAGE_COUNT)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "package-too-many-transactions");
+
+    std::set<uint256> setPackageHashes;
+    BOOST_FOREACH(const CTransactionRef& ptx, package) {
+        if (!setPackageHashes.insert(ptx->GetHash()).second) {
+            if (phashFailed)
+                *phashFailed = ptx->GetHash();
+            return state.DoS(0, false, REJECT_INVALID, "package-contains-duplicates");
+        }
+    }
+
+    // The package must be a child with its unconfirmed parents: every
+    // other transaction is spent from by the last one.
+    const CTransaction& child = *package.back();
+    std::set<uint256> setChildInputs;
+    BOOST_FOREACH(const CTxIn& txin, child.vin)
+        setChildInputs.insert(txin.prevout.hash);
+    for (size_t i = 0; i + 1 < package.size(); i++) {
+        if (!setChildInputs.count(package[i]->GetHash())) {
+            if (phashFailed)
+                *phashFailed = package[i]->GetHash();
+            return state.DoS(0, false, REJECT_NONSTANDARD, "package-not-child-with-parents");
+        }
+    }
+
+    // Check that parents come before their children, that no two
+    // transactions spend the same output and that none replaces a pool
+    // transaction, and add up the fees and sizes of the transactions that are
+    // not in the pool yet. Replacements would evict transactions that could
+    // not be restored if a later member of the package fails.
+    CAmount nPackageFees = 0;
+    int64_t nPackageSize = 0;
+    CAmount nChildFees = 0;
+    int64_t nChildSize = 0;
+    {
+        LOCK(pool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        CCoinsViewCache view(&viewMemPool);
+        std::map<uint256, const CTransaction*> mapPackageTx;
+        std::set<COutPoint> setSpent;
+        BOOST_FOREACH(const CTransactionRef& ptx, package) {
+            const CTransaction& tx = *ptx;
+            const bool fInPool = pool.exists(tx.GetHash());
+            if (phashFailed)
+                *phashFailed = tx.GetHash();
+            CAmount nValueIn = 0;
+            BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                if (!setSpent.insert(txin.prevout).second)
+                    return state.DoS(0, false, REJECT_INVALID, "package-conflict");
+                if (!fInPool && pool.mapNextTx.count(txin.prevout))
+                    return state.Invalid(false, REJECT_CONFLICT, "package-mempool-conflict");
+                std::map<uint256, const CTransaction*>::const_iterator it = mapPackageTx.find(txin.prevout.hash);
+                if (it != mapPackageTx.end()) {
+                    if (txin.prevout.n >= it->second->vout.size())
+                        return state.DoS(0, false, REJECT_INVALID, "bad-txns-inputs-missingorspent");
+                    nValueIn += it->second->vout[txin.prevout.n].nValue;
+                    continue;
+                }
+                if (setPackageHashes.count(txin.prevout.hash))
+                    return state.DoS(0, false, REJECT_INVALID, "package-not-sorted");
+                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
+                if (!coins || !coins->IsAvailable(txin.prevout.n)) {
+                    if (pfMissingInputs)
+                        *pfMissingInputs = true;
+                    return false;
+                }
+                nValueIn += coins->vout[txin.prevout.n].nValue;
+            }
+            mapPackageTx[tx.GetHash()] = &tx;
+
+            if (!fInPool) {
+                CAmount nModifiedFees = nValueIn - tx.GetValueOut();
+                double nPriorityDummy = 0;
+                pool.ApplyDeltas(tx.GetHash(), nPriorityDummy, nModifiedFees);
+                nPackageFees += nModifiedFees;
+                nPackageSize += GetVirtualTransactionSize(tx);
+                if (&tx == &child) {
+                    nChildFees = nModifiedFees;
+                    nChildSize = GetVirtualTransactionSize(tx);
+                }
+            }
+        }
+    }
+    if (nPackageSize > MAX_PACKAGE_SIZE * 1000)
+        return state.DoS(0, false, REJECT_NONSTANDARD, "package-too-large");
+
+    CFeeRate packageFeeRate(std::max(nPackageFees, CAmount(0)), nPackageSize);
+    if (pPackageFeeRate)
+        *pPackageFeeRate = packageFeeRate;
+
+    // Only a child that pays at least the package feerate itself can pay for
+    // its parents; the child is always judged by its own feerate.
+    CFeeRate parentFeeRate(0);
+    if (nChildSize > 0 && CFeeRate(std::max(nChildFees, CAmount(0)), nChildSize) >= packageFeeRate)
+        parentFeeRate = packageFeeRate;
+
+    // The pool is only trimmed once the whole package is in, as a parent
+    // paid for by its child would be evicted right away otherwise. Nobody is
+    // told about the new transactions until all of them are accepted.
+    std::vector<CTransactionRef> vAccepted;
+    BOOST_FOREACH(const CTransactionRef& ptx, package) {
+        if (pool.exists(ptx->GetHash()))
+            continue;
+        if (phashFailed)
+            *phashFailed = ptx->GetHash();
+        CFeeRate feeRate = ptx == package.back() ? CFeeRate(0) : parentFeeRate;
+        std::vector<uint256> vHashTxToUncache;
+        if (!AcceptToMemoryPoolWorker(pool, state, ptx, false, pfMissingInputs, GetTime(), NULL, true, nAbsurdFee, vHashTxToUncache, feeRate)) {
+            BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
+                pcoinsTip->Uncache(hashTx);
+            BOOST_REVERSE_FOREACH(const CTransactionRef& ptxAccepted, vAccepted)
+                pool.removeRecursive(*ptxAccepted);
+            return false;
+        }
+        vAccepted.push_back(ptx);
+    }
+
+    LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    BOOST_FOREACH(const CTransactionRef& ptx, vAccepted) {
+        if (!pool.exists(ptx->GetHash())) {
+            if (phashFailed)
+                *phashFailed = ptx->GetHash();
+            BOOST_REVERSE_FOREACH(const CTransactionRef& ptxAccepted, vAccepted)
+                pool.removeRecursive(*ptxAccepted);
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
+        }
+    }
+
+    BOOST_FOREACH(const CTransactionRef& ptx, vAccepted)
+        GetMainSignals().SyncTransaction(*ptx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+
+    CValidationState stateDummy;
+    FlushStateToDisk(stateDummy, FLUSH_STATE_PERIODIC);
+    return true;
+}
+
+bool PreVerifyTransaction(CTxMemPool& pool, const CTransactionRef& ptx)
+{
+    const CTransaction& tx = *ptx;
+    CValidationState state;
+    if (!CheckTransaction(tx, state) || tx.IsCoinBase())
+        return false;
+
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+    // Like AcceptToMemoryPool, don't leave coins of transactions that turn
+    // out to be invalid in the coins cache.
+    std::vector<uint256> vHashTxnToUncache;
+    bool witnessEnabled;
+    {
+        // Only fetch what the checks below need; AcceptToMemoryPool does
+        // everything else once it gets to this transaction.
+        LOCK2(cs_main, pool.cs);
+        if (pool.exists(tx.GetHash()))
+            return false;
+        witnessEnabled = IsWitnessEnabled(chainActive.Tip(), Params().GetConsensus());
+        if (tx.HasWitness() && !witnessEnabled && !GetBoolArg("-prematurewitness", false))
+            return false;
+
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        view.SetBackend(viewMemPool);
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                vHashTxnToUncache.push_back(txin.prevout.hash);
+            view.AccessCoins(txin.prevout.hash);
+        }
+
+        // Bring the best block into scope
+        view.GetBestBlock();
+        view.SetBackend(dummy);
+    }
+
+    // Only spend time on the scripts of transactions that pass the cheap
+    // checks which do not depend on the rest of the memory pool
+    std::string reason;
+    bool fValid = view.HaveInputs(tx);
+    if (fValid && fRequireStandard)
+        fValid = IsStandardTx(tx, reason, witnessEnabled) && AreInputsStandard(tx, view) && (!tx.HasWitness() || IsWitnessStandard(tx, view));
+    if (fValid)
+        fValid = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS) <= MAX_STANDARD_TX_SIGOPS_COST;
+    // Free transactions are rare and rate limited; leave them to AcceptToMemoryPool
+    if (fValid)
+        fValid = view.GetValueIn(tx) - tx.GetValueOut() >= ::minRelayTxFee.GetFee(GetVirtualTransactionSize(tx));
+
+    PrecomputedTransactionData txdata(tx);
+    if (!fValid || !CheckInputs(tx, state, view, true, GetMempoolScriptVerifyFlags(), true, txdata)) {
+        LOCK(cs_main);
+        BOOST_FOREACH(const uint256& hashTx, vHashTxnToUncache)
+            pcoinsTip->Uncache(hashTx);
+        return false;
+    }
+    return true;
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced,
                         bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
@@ -1049,25 +1268,9 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
         return true;
     }
 
-    if (fTxIndex) {
-        CDiskTxPos postx;
-        if (pblocktree->ReadTxIndex(hash, postx)) {
-            CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-            if (file.IsNull())
-                return error("%s: OpenBlockFile failed", __func__);
-            CBlockHeader header;
-            try {
-                file >> header;
-                fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                file >> txOut;
-            } catch (const std::exception& e) {
-                return error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            }
-            hashBlock = header.GetHash();
-            if (txOut->GetHash() != hash)
-                return error("%s: txid mismatch", __func__);
+    if (g_txindex) {
+        if (g_txindex->FindTx(hash, hashBlock, txOut))
             return true;
-        }
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
@@ -1108,6 +1311,45 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
 // CBlock and CBlockIndex
 //
 
+BlockRecordCodec GetBlockRecordCodec(const CBlock& block)
+{
+    if (fBlockCompression && CBlockCompressor::IsCompressible(block))
+        return BLOCK_CODEC_COMPACT;
+    return BLOCK_CODEC_RAW;
+}
+
+unsigned int GetBlockRecordSize(const CBlock& block, BlockRecordCodec codec)
+{
+    unsigned int nSize;
+    if (codec == BLOCK_CODEC_COMPACT)
+        nSize = ::GetSerializeSize(CBlockCompressor(REF(block)), SER_DISK, CLIENT_VERSION);
+    else
+        nSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    return nSize + CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+}
+
+bool ReadBlockRecordCodec(const CDiskBlockPos& pos, BlockRecordCodec& codec)
+{
+    // The size field directly precedes the payload
+    if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: no block record header before %s", __func__, pos.ToString());
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(unsigned int)), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    unsigned int nSizeField;
+    try {
+        filein >> nSizeField;
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    codec = (BlockRecordCodec)(nSizeField >> BLOCK_RECORD_CODEC_SHIFT);
+    if (codec != BLOCK_CODEC_RAW && codec != BLOCK_CODEC_COMPACT)
+        return error("%s: unknown block record codec %d at %s", __func__, codec, pos.ToString());
+    return true;
+}
+
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
@@ -1115,16 +1357,21 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     if (fileout.IsNull())
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
-    // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
-    fileout << FLATDATA(messageStart) << nSize;
+    // Write index header; the codec goes in the top byte of the size
+    BlockRecordCodec codec = GetBlockRecordCodec(block);
+    unsigned int nSize = GetBlockRecordSize(block, codec) - CMessageHeader::MESSAGE_START_SIZE - sizeof(unsigned int);
+    unsigned int nSizeField = nSize | ((unsigned int)codec << BLOCK_RECORD_CODEC_SHIFT);
+    fileout << FLATDATA(messageStart) << nSizeField;
 
     // Write block
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("WriteBlockToDisk: ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    if (codec == BLOCK_CODEC_COMPACT)
+        fileout << CBlockCompressor(REF(block));
+    else
+        fileout << block;
 
     return true;
 }
@@ -1133,14 +1380,28 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+    if (pos.nPos < CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("ReadBlockFromDisk: no block record header before %s", pos.ToString());
+
+    // Open history file to read, at the size field of the record
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - sizeof(unsigned int)), true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
     // Read block
     try {
-        filein >> block;
+        unsigned int nSizeField;
+        filein >> nSizeField;
+        switch (nSizeField >> BLOCK_RECORD_CODEC_SHIFT) {
+        case BLOCK_CODEC_RAW:
+            filein >> block;
+            break;
+        case BLOCK_CODEC_COMPACT:
+            filein >> REF(CBlockCompressor(block));
+            break;
+        default:
+            return error("ReadBlockFromDisk: unknown block record codec %u at %s", nSizeField >> BLOCK_RECORD_CODEC_SHIFT, pos.ToString());
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1599,6 +1860,173 @@ namespace {
 
 } // anon namespace
 
+/** Number of threads a CBlockPrefetcher reads with */
+static const int BLOCK_PREFETCH_THREADS = 4;
+/** Maximum number of blocks a CBlockPrefetcher reads ahead of its consumer */
+static const size_t BLOCK_PREFETCH_AHEAD = 32;
+/** Maximum number of blocks handed to a single CBlockPrefetcher */
+static const size_t BLOCK_PREFETCH_BATCH = 1024;
+
+/**
+ * Reads a sequence of blocks, and optionally their undo data, on worker
+ * threads ahead of the code that processes them in order, so that deep
+ * reorganizations and chain verification do not wait on one sequential
+ * read after another.
+ *
+ * The disk positions are taken from the block index when the prefetcher is
+ * created, so cs_main must be held then.
+ */
+class CBlockPrefetcher
+{
+private:
+    struct Entry {
+        uint256 hash;
+        uint256 hashPrev;
+        CDiskBlockPos posBlock;
+        CDiskBlockPos posUndo;
+        bool fDone;
+        //! NULL if reading failed
+        std::shared_ptr<const CBlock> pblock;
+        std::shared_ptr<const CBlockUndo> pundo;
+    };
+
+    const Consensus::Params& consensusParams;
+    const bool fUndo;
+    std::vector<Entry> vEntries;
+    std::map<const CBlockIndex*, size_t> mapEntries;
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    //! Index of the next entry to be read
+    size_t nNext;
+    //! One past the furthest entry handed out, bounds the read-ahead
+    size_t nConsumed;
+    bool fInterrupt;
+    std::vector<std::thread> threads;
+
+    void ThreadRead();
+
+public:
+    CBlockPrefetcher(const std::vector<const CBlockIndex*>& vpindex, bool fUndoIn, const Consensus::Params& consensusParamsIn);
+    ~CBlockPrefetcher();
+
+    bool Contains(const CBlockIndex* pindex) const { return mapEntries.count(pindex); }
+
+    /** Wait for the block (and undo data) of pindex to be read. Returns false if
+     *  it is not part of this prefetcher or could not be read, in which case
+     *  the caller reads it itself. */
+    bool Get(const CBlockIndex* pindex, std::shared_ptr<const CBlock>& pblock, std::shared_ptr<const CBlockUndo>* ppundo = NULL);
+};
+
+CBlockPrefetcher::CBlockPrefetcher(const std::vector<const CBlockIndex*>& vpindex, bool fUndoIn, const Consensus::Params& consensusParamsIn) :
+    consensusParams(consensusParamsIn), fUndo(fUndoIn), nNext(0), nConsumed(0), fInterrupt(false)
+{
+    // A single block gains nothing from being read on another thread
+    if (vpindex.size() < 2)
+        return;
+
+    vEntries.resize(vpindex.size());
+    for (size_t i = 0; i < vpindex.size(); i++) {
+        const CBlockIndex* pindex = vpindex[i];
+        Entry& entry = vEntries[i];
+        entry.hash = pindex->GetBlockHash();
+        if (pindex->pprev)
+            entry.hashPrev = pindex->pprev->GetBlockHash();
+        entry.posBlock = pindex->GetBlockPos();
+        entry.posUndo = pindex->GetUndoPos();
+        entry.fDone = false;
+        mapEntries[pindex] = i;
+    }
+
+    int nThreads = std::min<int>(BLOCK_PREFETCH_THREADS, vEntries.size());
+    for (int i = 0; i < nThreads; i++)
+        threads.emplace_back(&CBlockPrefetcher::ThreadRead, this);
+}
+
+CBlockPrefetcher::~CBlockPrefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fInterrupt = true;
+        cond.notify_all();
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+}
+
+void CBlockPrefetcher::ThreadRead()
+{
+    while (true) {
+        size_t i;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return fInterrupt || nNext >= vEntries.size() || nNext < nConsumed + BLOCK_PREFETCH_AHEAD; });
+            if (fInterrupt || nNext >= vEntries.size())
+                return;
+            i = nNext++;
+        }
+
+        const Entry& entry = vEntries[i];
+        std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+        std::shared_ptr<CBlockUndo> pundo;
+        bool fOk = ReadBlockFromDisk(*pblock, entry.posBlock, consensusParams) && pblock->GetHash() == entry.hash;
+        if (fOk && fUndo) {
+            pundo = std::make_shared<CBlockUndo>();
+            fOk = !entry.posUndo.IsNull() && UndoReadFromDisk(*pundo, entry.posUndo, entry.hashPrev);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (fOk) {
+            vEntries[i].pblock = pblock;
+            vEntries[i].pundo = pundo;
+        }
+        vEntries[i].fDone = true;
+        cond.notify_all();
+    }
+}
+
+bool CBlockPrefetcher::Get(const CBlockIndex* pindex, std::shared_ptr<const CBlock>& pblock, std::shared_ptr<const CBlockUndo>* ppundo)
+{
+    std::map<const CBlockIndex*, size_t>::const_iterator it = mapEntries.find(pindex);
+    if (it == mapEntries.end())
+        return false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    Entry& entry = vEntries[it->second];
+    nConsumed = std::max(nConsumed, it->second + 1);
+    cond.notify_all();
+    cond.wait(lock, [&entry] { return entry.fDone; });
+    if (!entry.pblock)
+        return false;
+    pblock = entry.pblock;
+    if (ppundo)
+        *ppundo = entry.pundo;
+    // Release the data as soon as it has been handed out
+    entry.pblock.reset();
+    entry.pundo.reset();
+    return true;
+}
+
+/** The blocks from pindexTip down to (not including) pindexStop whose data is on disk, at most BLOCK_PREFETCH_BATCH of them */
+static std::vector<const CBlockIndex*> GetBlocksToPrefetch(const CBlockIndex* pindexTip, const CBlockIndex* pindexStop)
+{
+    std::vector<const CBlockIndex*> vpindex;
+    for (const CBlockIndex* pindex = pindexTip; pindex && pindex != pindexStop && pindex->pprev && vpindex.size() < BLOCK_PREFETCH_BATCH; pindex = pindex->pprev) {
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            break;
+        vpindex.push_back(pindex);
+    }
+    return vpindex;
+}
+
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex)
+{
+    CDiskBlockPos pos = pindex->GetUndoPos();
+    if (pos.IsNull())
+        return error("%s: no undo data available for block %s", __func__, pindex->GetBlockHash().ToString());
+    return UndoReadFromDisk(blockundo, pos, pindex->pprev->GetBlockHash());
+}
+
 /**
  * Apply the undo operation of a CTxInUndo to the given chain state.
  * @param undo The undo object.
@@ -1632,7 +2060,7 @@ bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, const CBlockUndo* pblockUndo)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1641,12 +2069,16 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
     bool fClean = true;
 
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull())
-        return error("DisconnectBlock(): no undo data available");
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
-        return error("DisconnectBlock(): failure reading undo data");
+    CBlockUndo blockUndoRead;
+    if (!pblockUndo) {
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull())
+            return error("DisconnectBlock(): no undo data available");
+        if (!UndoReadFromDisk(blockUndoRead, pos, pindex->pprev->GetBlockHash()))
+            return error("DisconnectBlock(): failure reading undo data");
+        pblockUndo = &blockUndoRead;
+    }
+    const CBlockUndo& blockUndo = *pblockUndo;
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
@@ -1921,9 +2353,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CAmount nFees = 0;
     int nInputs = 0;
     int64_t nSigOpsCost = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
     std::vector<PrecomputedTransactionData> txdata;
     txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
@@ -1980,9 +2409,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             blockundo.vtxundo.push_back(CTxUndo());
         }
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
     int64_t nTime3 = GetTimeMicros(); nTimeConnect += nTime3 - nTime2;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime3 - nTime2), 0.001 * (nTime3 - nTime2) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime3 - nTime2) / (nInputs-1), nTimeConnect * 0.000001);
@@ -2021,10 +2447,6 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
-
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2228,20 +2650,27 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
 
 }
 
-/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
-bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, bool fBare = false)
+/** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held.
+ *  The block and its undo data are taken from prefetcher if it has them. */
+bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, bool fBare = false, CBlockPrefetcher* prefetcher = NULL)
 {
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
     // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
-        return AbortNode(state, "Failed to read block");
+    std::shared_ptr<const CBlock> pblock;
+    std::shared_ptr<const CBlockUndo> pblockUndo;
+    if (!prefetcher || !prefetcher->Get(pindexDelete, pblock, &pblockUndo)) {
+        std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockRead, pindexDelete, chainparams.GetConsensus()))
+            return AbortNode(state, "Failed to read block");
+        pblock = pblockRead;
+    }
+    const CBlock& block = *pblock;
     // Apply the block atomically to the chain state.
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, pblockUndo.get()))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
@@ -2434,10 +2863,14 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     const CBlockIndex *pindexOldTip = chainActive.Tip();
     const CBlockIndex *pindexFork = chainActive.FindFork(pindexMostWork);
 
-    // Disconnect active blocks which are no longer in the best chain.
+    // Disconnect active blocks which are no longer in the best chain,
+    // reading their block and undo data ahead.
     bool fBlocksDisconnected = false;
+    std::unique_ptr<CBlockPrefetcher> prefetcher;
     while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams))
+        if (!prefetcher || !prefetcher->Contains(chainActive.Tip()))
+            prefetcher.reset(new CBlockPrefetcher(GetBlocksToPrefetch(chainActive.Tip(), pindexFork), true, chainparams.GetConsensus()));
+        if (!DisconnectTip(state, chainparams, false, prefetcher.get()))
             return false;
         fBlocksDisconnected = true;
     }
@@ -2459,9 +2892,26 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         }
         nHeight = nTargetHeight;
 
+        // After disconnecting, every block up to the first one with more work
+        // than the old tip is connected in this step; read those ahead.
+        std::vector<const CBlockIndex*> vpindexPrefetch;
+        if (fBlocksDisconnected) {
+            BOOST_REVERSE_FOREACH(CBlockIndex *pindexPrefetch, vpindexToConnect) {
+                if (pindexPrefetch == pindexMostWork && pblock)
+                    break;
+                vpindexPrefetch.push_back(pindexPrefetch);
+                if (pindexPrefetch->nChainWork > pindexOldTip->nChainWork)
+                    break;
+            }
+        }
+        prefetcher.reset(new CBlockPrefetcher(vpindexPrefetch, false, chainparams.GetConsensus()));
+
         // Connect new blocks.
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-                        if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace)) {
+                        std::shared_ptr<const CBlock> pblockConnect = pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>();
+                        if (!pblockConnect)
+                            prefetcher->Get(pindexConnect, pblockConnect);
+                        if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace)) {
                             if (state.IsInvalid()) {
                                 // The block violates a consensus rule.
                                 if (!state.CorruptionPossible())
@@ -2837,7 +3287,7 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         if (nNewChunks > nOldChunks) {
             if (fPruneMode)
                 fCheckForPruning = true;
-            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
+            if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos, true)) {
                 FILE *file = OpenBlockFile(pos);
                 if (file) {
                     LogPrintf("Pre-allocating up to position 0x%x in blk%05u.dat\n", nNewChunks * BLOCKFILE_CHUNK_SIZE, pos.nFile);
@@ -2870,7 +3320,7 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     if (nNewChunks > nOldChunks) {
         if (fPruneMode)
             fCheckForPruning = true;
-        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
+        if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos, true)) {
             FILE *file = OpenUndoFile(pos);
             if (file) {
                 LogPrintf("Pre-allocating up to position 0x%x in rev%05u.dat\n", nNewChunks * UNDOFILE_CHUNK_SIZE, pos.nFile);
@@ -3276,11 +3726,15 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        // A block that is already on disk keeps the codec it was stored with
+        BlockRecordCodec codec = GetBlockRecordCodec(block);
+        if (dbp != NULL && !ReadBlockRecordCodec(*dbp, codec))
+            return error("AcceptBlock(): ReadBlockRecordCodec failed");
+        unsigned int nBlockSize = GetBlockRecordSize(block, codec);
         CDiskBlockPos blockPos;
         if (dbp != NULL)
             blockPos = *dbp;
-        if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
+        if (!FindBlockPos(state, blockPos, nBlockSize, nHeight, block.GetBlockTime(), dbp != NULL))
             return error("AcceptBlock(): FindBlockPos failed");
         if (dbp == NULL)
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
@@ -3489,9 +3943,9 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
              nLastBlockWeCanPrune, count);
 }
 
-bool CheckDiskSpace(uint64_t nAdditionalBytes)
+bool CheckDiskSpace(uint64_t nAdditionalBytes, bool fBlocksDir)
 {
-    uint64_t nFreeBytesAvailable = boost::filesystem::space(GetDataDir()).available;
+    uint64_t nFreeBytesAvailable = boost::filesystem::space(fBlocksDir ? GetBlocksDir() : GetDataDir()).available;
 
     // Check for nMinDiskSpace bytes (currently 50MB)
     if (nFreeBytesAvailable < nMinDiskSpace + nAdditionalBytes)
@@ -3533,7 +3987,7 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
 
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix)
 {
-    return GetDataDir() / "blocks" / strprintf("%s%05u.dat", prefix, pos.nFile);
+    return GetBlocksDir() / strprintf("%s%05u.dat", prefix, pos.nFile);
 }
 
 CBlockIndex * InsertBlockIndex(uint256 hash)
@@ -3646,10 +4100,6 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadReindexing(fReindexing);
     fReindex |= fReindexing;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
-
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -3696,6 +4146,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     int nGoodTransactions = 0;
     CValidationState state;
     int reportDone = 0;
+    // Blocks are read ahead down to (not including) pindexStop
+    const CBlockIndex* pindexStop = chainActive[std::max(0, chainActive.Height() - nCheckDepth - 1)];
+    std::unique_ptr<CBlockPrefetcher> prefetcher;
     LogPrintf("[0%%]...");
     for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
     {
@@ -3714,27 +4167,36 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
-        CBlock block;
+        if (!prefetcher || !prefetcher->Contains(pindex))
+            prefetcher.reset(new CBlockPrefetcher(GetBlocksToPrefetch(pindex, pindexStop), nCheckLevel >= 2, chainparams.GetConsensus()));
+        std::shared_ptr<const CBlock> pblock;
+        std::shared_ptr<const CBlockUndo> pundo;
         // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        if (!prefetcher->Get(pindex, pblock, &pundo)) {
+            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+            if (!ReadBlockFromDisk(*pblockRead, pindex, chainparams.GetConsensus()))
+                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            pblock = pblockRead;
+        }
+        const CBlock& block = *pblock;
         // check level 1: verify block validity
         if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
             return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
                          pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
         // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
+        if (nCheckLevel >= 2 && pindex && !pundo) {
             CDiskBlockPos pos = pindex->GetUndoPos();
             if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
+                std::shared_ptr<CBlockUndo> pundoRead = std::make_shared<CBlockUndo>();
+                if (!UndoReadFromDisk(*pundoRead, pos, pindex->pprev->GetBlockHash()))
                     return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                pundo = pundoRead;
             }
         }
         // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
         if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
             bool fClean = true;
-            if (!DisconnectBlock(block, state, pindex, coins, &fClean))
+            if (!DisconnectBlock(block, state, pindex, coins, &fClean, pundo.get()))
                 return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
             pindexState = pindex->pprev;
             if (!fClean) {
@@ -3785,6 +4247,7 @@ bool RewindBlockIndex(const CChainParams& params)
     // nHeight is now the height of the first insufficiently-validated block, or tipheight + 1
     CValidationState state;
     CBlockIndex* pindex = chainActive.Tip();
+    std::unique_ptr<CBlockPrefetcher> prefetcher;
     while (chainActive.Height() >= nHeight) {
         if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
             // If pruning, don't try rewinding past the HAVE_DATA point;
@@ -3794,7 +4257,9 @@ bool RewindBlockIndex(const CChainParams& params)
             // of the blockchain).
             break;
         }
-        if (!DisconnectTip(state, params, true)) {
+        if (!prefetcher || !prefetcher->Contains(chainActive.Tip()))
+            prefetcher.reset(new CBlockPrefetcher(GetBlocksToPrefetch(chainActive.Tip(), chainActive[nHeight - 1]), true, params.GetConsensus()));
+        if (!DisconnectTip(state, params, true, prefetcher.get())) {
             return error("RewindBlockIndex: unable to disconnect block at height %i", pindex->nHeight);
         }
         // Occasionally flush state to disk.
@@ -3899,9 +4364,6 @@ bool InitBlockIndex(const CChainParams& chainparams)
     if (chainActive.Genesis() != NULL)
         return true;
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
-    pblocktree->WriteFlag("txindex", fTxIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -3909,10 +4371,10 @@ bool InitBlockIndex(const CChainParams& chainparams)
         try {
             CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            unsigned int nBlockSize = GetBlockRecordSize(block, GetBlockRecordCodec(block));
             CDiskBlockPos blockPos;
             CValidationState state;
-            if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
+            if (!FindBlockPos(state, blockPos, nBlockSize, 0, block.GetBlockTime()))
                 return error("LoadBlockIndex(): FindBlockPos failed");
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
@@ -3947,6 +4409,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
             nRewind++; // start one byte further next time, in case of failure
             blkdat.SetLimit(); // remove former limit
             unsigned int nSize = 0;
+            unsigned int nCodec = BLOCK_CODEC_RAW;
             try {
                 // locate a header
                 unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
@@ -3955,10 +4418,14 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 blkdat >> FLATDATA(buf);
                 if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
                     continue;
-                // read size
+                // read size and codec
                 blkdat >> nSize;
+                nCodec = nSize >> BLOCK_RECORD_CODEC_SHIFT;
+                nSize &= BLOCK_RECORD_SIZE_MASK;
                 if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
                     continue;
+                if (nCodec != BLOCK_CODEC_RAW && nCodec != BLOCK_CODEC_COMPACT)
+                    continue;
             } catch (const std::exception&) {
                 // no valid block header found; don't complain
                 break;
@@ -3972,7 +4439,14 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 blkdat.SetPos(nBlockPos);
                 std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
                 CBlock& block = *pblock;
-                blkdat >> block;
+                if (nCodec == BLOCK_CODEC_COMPACT) {
+                    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+                    ssRecord.resize(nSize);
+                    blkdat.read(&ssRecord[0], nSize);
+                    ssRecord >> REF(CBlockCompressor(block));
+                } else {
+                    blkdat >> block;
+                }
                 nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
@@ -4252,7 +4726,113 @@ int VersionBitsTipStateSinceHeight(const Consensus::Params& params, Consensus::D
     return VersionBitsStateSinceHeight(chainActive.Tip(), params, pos, versionbitscache);
 }
 
-static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION_TXONLY = 1;
+static const uint64_t MEMPOOL_DUMP_VERSION = 2;
+
+namespace {
+/** A transaction as stored in mempool.dat */
+struct MempoolDumpEntry
+{
+    CTransactionRef tx;
+    int64_t nTime;
+    int64_t nFeeDelta;
+
+    // State established when the transaction was validated; only stored
+    // since MEMPOOL_DUMP_VERSION 2.
+    CAmount nFee;
+    unsigned int nHeight;
+    double dPriority;
+    CAmount inChainInputValue;
+    bool fSpendsCoinbase;
+    int64_t nSigOpCost;
+    int nLockHeight;
+    int64_t nLockTime;
+    uint256 hashLockMaxInputBlock;
+};
+}
+
+/**
+ * A hash of the policy settings the mempool was accepted under. Entries from
+ * mempool.dat are only trusted when it matches, as a changed -minrelaytxfee,
+ * -limitancestorcount, -datacarrier etc. could reject them now.
+ */
+static uint256 GetMempoolPolicyHash()
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << ::minRelayTxFee << ::incrementalRelayFee << ::dustRelayFee;
+    ss << GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT) << GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT);
+    ss << GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT) << GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT);
+    ss << GetBoolArg("-relaypriority", DEFAULT_RELAYPRIORITY) << GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY);
+    ss << fRequireStandard << fIsBareMultisigStd << nBytesPerSigOp << fAcceptDatacarrier << nMaxDatacarrierBytes;
+    return ss.GetHash();
+}
+
+/**
+ * Add a transaction from mempool.dat without validating it again. Only valid
+ * while chainActive is at the tip the mempool was dumped at, under the same
+ * policy; the caller makes sure of that.
+ */
+static bool AddDumpedMempoolEntry(const MempoolDumpEntry& dumped)
+{
+    AssertLockHeld(cs_main);
+    const CTransaction& tx = *dumped.tx;
+    {
+        LOCK(mempool.cs);
+        if (mempool.exists(tx.GetHash()))
+            return false;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (mempool.mapNextTx.count(txin.prevout))
+                return false;
+        }
+        // Parents that expired or failed to load leave their children
+        // without inputs
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        CCoinsViewCache view(&viewMemPool);
+        if (!view.HaveInputs(tx))
+            return false;
+
+        LockPoints lp;
+        lp.height = dumped.nLockHeight;
+        lp.time = dumped.nLockTime;
+        if (!dumped.hashLockMaxInputBlock.IsNull()) {
+            BlockMap::iterator mi = mapBlockIndex.find(dumped.hashLockMaxInputBlock);
+            if (mi == mapBlockIndex.end())
+                return false;
+            lp.maxInputBlock = mi->second;
+        }
+
+        CTxMemPoolEntry entry(dumped.tx, dumped.nFee, dumped.nTime, dumped.dPriority, dumped.nHeight,
+                              dumped.inChainInputValue, dumped.fSpendsCoinbase, dumped.nSigOpCost, lp);
+        mempool.addUnchecked(tx.GetHash(), entry, false);
+    }
+    GetMainSignals().SyncTransaction(tx, NULL, CMainSignals::SYNC_TRANSACTION_NOT_IN_BLOCK);
+    return true;
+}
+
+/**
+ * Check the scripts of transactions from mempool.dat on nScriptCheckThreads
+ * threads, so that accepting them one by one afterwards mostly hits the
+ * script cache. Transactions that spend other unconfirmed transactions are
+ * left for AcceptToMemoryPool to check.
+ */
+static void PreVerifyDumpedMempool(const std::vector<MempoolDumpEntry>& vDumped)
+{
+    if (nScriptCheckThreads == 0)
+        return;
+
+    std::atomic<size_t> nNext(0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nScriptCheckThreads; i++) {
+        threads.emplace_back([&vDumped, &nNext] {
+            RenameThread("creativecoin-loadmempool");
+            size_t n;
+            while ((n = nNext++) < vDumped.size() && !ShutdownRequested())
+                PreVerifyTransaction(mempool, vDumped[n].tx);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+}
 
 bool LoadMempool(void)
 {
@@ -4265,49 +4845,57 @@ bool LoadMempool(void)
     }
 
     int64_t count = 0;
+    int64_t trusted = 0;
     int64_t skipped = 0;
     int64_t failed = 0;
     int64_t nNow = GetTime();
+    int64_t nStart = GetTimeMicros();
 
+    std::vector<MempoolDumpEntry> vDumped;
+    uint256 hashBestBlock, hashPolicy;
     try {
         uint64_t version;
         file >> version;
-        if (version != MEMPOOL_DUMP_VERSION) {
+        if (version != MEMPOOL_DUMP_VERSION && version != MEMPOOL_DUMP_VERSION_TXONLY) {
             return false;
         }
+        if (version >= MEMPOOL_DUMP_VERSION)
+            file >> hashBestBlock >> hashPolicy;
         uint64_t num;
         file >> num;
         double prioritydummy = 0;
         while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), tx->GetHash().ToString(), prioritydummy, amountdelta);
+            MempoolDumpEntry dumped;
+            file >> dumped.tx;
+            file >> dumped.nTime;
+            file >> dumped.nFeeDelta;
+            if (version >= MEMPOOL_DUMP_VERSION) {
+                file >> dumped.nFee;
+                file >> dumped.nHeight;
+                file >> dumped.dPriority;
+                file >> dumped.inChainInputValue;
+                file >> dumped.fSpendsCoinbase;
+                file >> dumped.nSigOpCost;
+                file >> dumped.nLockHeight;
+                file >> dumped.nLockTime;
+                file >> dumped.hashLockMaxInputBlock;
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
-                LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
-                if (state.IsValid()) {
-                    ++count;
-                } else {
-                    ++failed;
-                }
+
+            if (dumped.nTime + nExpiryTimeout > nNow) {
+                vDumped.push_back(dumped);
             } else {
                 ++skipped;
             }
-            if (ShutdownRequested())
-                return false;
         }
         std::map<uint256, CAmount> mapDeltas;
         file >> mapDeltas;
 
+        for (const auto& i : vDumped) {
+            CAmount amountdelta = i.nFeeDelta;
+            if (amountdelta) {
+                mempool.PrioritiseTransaction(i.tx->GetHash(), i.tx->GetHash().ToString(), prioritydummy, amountdelta);
+            }
+        }
         for (const auto& i : mapDeltas) {
             mempool.PrioritiseTransaction(i.first, i.first.ToString(), prioritydummy, i.second);
         }
@@ -4316,7 +4904,51 @@ bool LoadMempool(void)
         return false;
     }
 
-    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired\n", count, failed, skipped);
+    // A mempool dumped at the current tip was valid against exactly the
+    // current UTXO set, so its entries can be added back as they were, unless
+    // the policy they were accepted under has changed.
+    bool fTrusted = false;
+    if (!hashBestBlock.IsNull() && hashPolicy == GetMempoolPolicyHash()) {
+        LOCK(cs_main);
+        fTrusted = chainActive.Tip() && chainActive.Tip()->GetBlockHash() == hashBestBlock;
+    }
+    if (!fTrusted)
+        PreVerifyDumpedMempool(vDumped);
+
+    for (const auto& dumped : vDumped) {
+        {
+            LOCK(cs_main);
+            if (fTrusted && chainActive.Tip()->GetBlockHash() != hashBestBlock) {
+                LogPrintf("Tip changed while importing mempool, validating the remaining transactions\n");
+                fTrusted = false;
+            }
+            if (fTrusted) {
+                if (AddDumpedMempoolEntry(dumped)) {
+                    ++count;
+                    ++trusted;
+                } else {
+                    ++failed;
+                }
+            } else {
+                CValidationState state;
+                AcceptToMemoryPoolWithTime(mempool, state, dumped.tx, true, NULL, dumped.nTime);
+                if (state.IsValid()) {
+                    ++count;
+                } else {
+                    ++failed;
+                }
+            }
+        }
+        if (ShutdownRequested())
+            return false;
+    }
+    if (trusted) {
+        LOCK(cs_main);
+        LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, nExpiryTimeout);
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes (%i without revalidation), %i failed, %i expired, %.2fs\n",
+              count, trusted, failed, skipped, (GetTimeMicros() - nStart) * 0.000001);
     return true;
 }
 
@@ -4325,14 +4957,21 @@ void DumpMempool(void)
     int64_t start = GetTimeMicros();
 
     std::map<uint256, CAmount> mapDeltas;
-    std::vector<TxMempoolInfo> vinfo;
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot;
+    uint256 hashBestBlock;
 
     {
-        LOCK(mempool.cs);
-        for (const auto &i : mempool.mapDeltas) {
-            mapDeltas[i.first] = i.second.second;
+        // Holding cs_main keeps the mempool consistent with the tip
+        LOCK(cs_main);
+        {
+            LOCK(mempool.cs);
+            for (const auto &i : mempool.mapDeltas) {
+                mapDeltas[i.first] = i.second.second;
+            }
         }
-        vinfo = mempool.infoAll();
+        snapshot = mempool.GetSnapshot();
+        if (chainActive.Tip())
+            hashBestBlock = chainActive.Tip()->GetBlockHash();
     }
 
     int64_t mid = GetTimeMicros();
@@ -4347,13 +4986,27 @@ void DumpMempool(void)
 
         uint64_t version = MEMPOOL_DUMP_VERSION;
         file << version;
-
-        file << (uint64_t)vinfo.size();
-        for (const auto& i : vinfo) {
-            file << *(i.tx);
-            file << (int64_t)i.nTime;
-            file << (int64_t)i.nFeeDelta;
-            mapDeltas.erase(i.tx->GetHash());
+        file << hashBestBlock;
+        file << GetMempoolPolicyHash();
+
+        // Entries are in depth order, so parents are loaded before their children
+        file << (uint64_t)snapshot->vEntries.size();
+        for (const auto& i : snapshot->vEntries) {
+            const CTxMemPoolEntry& entry = i.entry;
+            const LockPoints& lp = entry.GetLockPoints();
+            file << entry.GetTx();
+            file << (int64_t)entry.GetTime();
+            file << (int64_t)(entry.GetModifiedFee() - entry.GetFee());
+            file << entry.GetFee();
+            file << entry.GetHeight();
+            file << entry.GetPriority(entry.GetHeight());
+            file << entry.GetInChainInputValue();
+            file << entry.GetSpendsCoinbase();
+            file << entry.GetSigOpCost();
+            file << lp.height;
+            file << lp.time;
+            file << (lp.maxInputBlock ? lp.maxInputBlock->GetBlockHash() : uint256());
+            mapDeltas.erase(entry.GetTx().GetHash());
         }
 
         file << mapDeltas;
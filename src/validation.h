@@ -34,6 +34,7 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CBlockUndo;
 class CBloomFilter;
 class CChainParams;
 class CInv;
@@ -51,6 +52,8 @@ struct LockPoints;
 static const bool DEFAULT_WHITELISTRELAY = true;
 /** Default for DEFAULT_WHITELISTFORCERELAY. */
 static const bool DEFAULT_WHITELISTFORCERELAY = true;
+/** Default for -whitelistcmpctrelay. */
+static const bool DEFAULT_WHITELISTCMPCTRELAY = false;
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100000;
 //! -maxtxfee default
@@ -67,6 +70,10 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Maximum number of transactions in a package submitted with AcceptPackageToMemoryPool */
+static const unsigned int MAX_PACKAGE_COUNT = DEFAULT_ANCESTOR_LIMIT;
+/** Maximum virtual size of a package, in kilobytes */
+static const unsigned int MAX_PACKAGE_SIZE = DEFAULT_ANCESTOR_SIZE_LIMIT;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 336;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -75,15 +82,38 @@ static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
+/** Default for -blockcompression, store new blocks in blk?????.dat files compressed */
+static const bool DEFAULT_BLOCKCOMPRESSION = false;
+/** The codec of a block record is stored in the top byte of its size field */
+static const unsigned int BLOCK_RECORD_CODEC_SHIFT = 24;
+static const unsigned int BLOCK_RECORD_SIZE_MASK = (1 << BLOCK_RECORD_CODEC_SHIFT) - 1;
+
+/** Payload encodings of block records in blk?????.dat files */
+enum BlockRecordCodec : uint8_t {
+    BLOCK_CODEC_RAW = 0,     //!< network serialization, the format of all block files before -blockcompression
+    BLOCK_CODEC_COMPACT = 1, //!< CBlockCompressor
+};
 
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of blocks that can be requested at any given time from a single peer,
+ *  until its block download speed has been measured. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Lower and upper bound on the number of blocks in flight from a peer whose download speed is known. */
+static const int MIN_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** Download time in microseconds worth of blocks to keep in flight from a peer whose download speed is known. */
+static const int64_t BLOCK_DOWNLOAD_QUEUE_TARGET = 2 * 1000000;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
+/** Time in seconds a block holding up the download window must have been in flight before
+ *  it may be requested again from a faster peer. Shorter than BLOCK_STALLING_TIMEOUT, so the
+ *  block moves before its peer gets disconnected for stalling. */
+static const unsigned int BLOCK_REREQUEST_TIMEOUT = 1;
+/** A block is only re-requested from a peer that is expected to deliver it at least this many times sooner. */
+static const int BLOCK_REREQUEST_SPEEDUP = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 2000;
@@ -132,6 +162,7 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+static const bool DEFAULT_SPENTINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -mempoolreplacement */
@@ -146,6 +177,9 @@ static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 static const int MAX_UNCONNECTING_HEADERS = 10;
 
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+/** Default for -txreconciliation */
+static const bool DEFAULT_TXRECONCILIATION = false;
 
 struct BlockHasher
 {
@@ -166,11 +200,11 @@ extern CConditionVariable cvBlockChange;
 extern std::atomic_bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
-extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+extern bool fBlockCompression;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -245,8 +279,8 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
  */
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex=NULL);
 
-/** Check whether enough disk space is available for an incoming block */
-bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
+/** Check whether enough disk space is available for an incoming block, in the data or the blocks directory */
+bool CheckDiskSpace(uint64_t nAdditionalBytes = 0, bool fBlocksDir = false);
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Open an undo file (rev?????.dat) */
@@ -324,6 +358,33 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced = NULL,
                         bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/**
+ * (try to) add a package of transactions to the memory pool. The package must
+ * be a child preceded by its unconfirmed parents, sorted so that parents come
+ * before their children, and may not conflict with itself or replace pool
+ * transactions. If the child pays at least the feerate of the package's
+ * transactions which are not in the pool yet, the fee policy checks judge its
+ * parents by the higher of their own feerate and that of the package, so the
+ * child can pay for them. Either all transactions end up in the pool or, if
+ * one fails, none of those added for the package remain. On failure
+ * phashFailed, if given, is set to the transaction that failed.
+ */
+bool AcceptPackageToMemoryPool(CTxMemPool& pool, CValidationState &state, const std::vector<CTransactionRef>& package,
+                               bool* pfMissingInputs, uint256* phashFailed = NULL, CFeeRate* pPackageFeeRate = NULL,
+                               const CAmount nAbsurdFee=0);
+
+/**
+ * Check the scripts of a loose transaction against the current chain and
+ * memory pool ahead of AcceptToMemoryPool, storing the signatures it verifies
+ * in the signature cache. cs_main is only held to fetch the coins it spends;
+ * the standardness and fee checks that do not depend on other pool
+ * transactions, and the scripts, are checked without it, so this can run on
+ * several threads while transactions are being accepted. Returns false if the
+ * transaction would be rejected or is left to AcceptToMemoryPool, which
+ * remains the one to decide on it.
+ */
+bool PreVerifyTransaction(CTxMemPool& pool, const CTransactionRef& ptx);
+
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced = NULL,
@@ -469,9 +530,16 @@ public:
 
 
 /** Functions for disk access for blocks */
+/** The codec WriteBlockToDisk stores the block with */
+BlockRecordCodec GetBlockRecordCodec(const CBlock& block);
+/** Size of the block's record in a block file, including the 8 byte header */
+unsigned int GetBlockRecordSize(const CBlock& block, BlockRecordCodec codec);
+/** Read the codec of the block record whose payload starts at pos */
+bool ReadBlockRecordCodec(const CDiskBlockPos& pos, BlockRecordCodec& codec);
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CBlockIndex* pindex);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -494,8 +562,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified. The block's undo data is read
+ *  from disk unless pblockUndo is provided. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, const CBlockUndo* pblockUndo = NULL);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
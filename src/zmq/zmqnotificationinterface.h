@@ -26,6 +26,7 @@ protected:
     // CValidationInterface
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, int posInBlock);
     void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload);
+    void BlockTemplateInvalid(const CBlock& block, const CValidationState& state);
 
 private:
     CZMQNotificationInterface();
@@ -15,6 +15,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_HASHINVALIDTEMPLATE = "hashinvalidtemplate";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -191,3 +192,14 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishHashInvalidTemplateNotifier::NotifyInvalidBlockTemplate(const CBlock &block)
+{
+    // Templates are identified to miners by the block they build on
+    uint256 hash = block.hashPrevBlock;
+    LogPrint("zmq", "zmq: Publish hashinvalidtemplate %s\n", hash.GetHex());
+    char data[32];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = hash.begin()[i];
+    return SendMessage(MSG_HASHINVALIDTEMPLATE, data, 32);
+}
@@ -52,4 +52,10 @@ public:
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
+class CZMQPublishHashInvalidTemplateNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyInvalidBlockTemplate(const CBlock &block);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H